@@ -0,0 +1,135 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Initialize an empty arena, the first block is allocated on demand
+ *
+ * @param self the arena to initialize
+ */
+void arena_create(struct arena *self)
+{
+	self->current = NULL;
+	self->allocated = 0;
+	self->reserved = 0;
+	self->block_count = 0;
+}
+
+/**
+ * Free all the blocks of an arena and everything allocated in them
+ *
+ * @param self the arena to destroy
+ */
+void arena_destroy(struct arena *self)
+{
+	struct arena_block *block = self->current;
+	while (block != NULL)
+	{
+		struct arena_block *prev = block->prev;
+		free(block);
+		block = prev;
+	}
+	self->current = NULL;
+}
+
+/**
+ * Save the current position of an arena
+ *
+ * @param self the arena
+ * @param mark where the position is saved
+ */
+void arena_save(const struct arena *self, struct arena_mark *mark)
+{
+	mark->block = self->current;
+	mark->used = self->current != NULL ? self->current->used : 0;
+	mark->allocated = self->allocated;
+}
+
+/**
+ * Release everything allocated since a position was saved, the blocks
+ * started since then are freed. Positions saved after this one become invalid.
+ *
+ * @param self the arena
+ * @param mark the position to go back to
+ */
+void arena_rewind(struct arena *self, const struct arena_mark *mark)
+{
+	while (self->current != mark->block)
+	{
+		struct arena_block *block = self->current;
+		self->current = block->prev;
+		self->reserved -= sizeof(struct arena_block) + block->size;
+		self->block_count--;
+		free(block);
+	}
+	if (self->current != NULL)
+	{
+		self->current->used = mark->used;
+	}
+	self->allocated = mark->allocated;
+}
+
+/**
+ * Allocate some zeroed memory in the arena, a new block is started when the
+ * current one is full. Allocations bigger than a block get a block of their own.
+ *
+ * @param self the arena
+ * @param size the number of bytes to allocate
+ *
+ * @return the allocated memory
+ */
+void *arena_alloc(struct arena *self, size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+	struct arena_block *block = self->current;
+	if (block == NULL || block->used + size > block->size)
+	{
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(struct arena_block) + block_size);
+		block->prev = self->current;
+		block->size = block_size;
+		block->used = 0;
+		self->current = block;
+		self->reserved += sizeof(struct arena_block) + block_size;
+		self->block_count++;
+	}
+
+	void *ptr = block->data + block->used;
+	block->used += size;
+	self->allocated += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/**
+ * Copy a string in the arena
+ *
+ * @param self the arena
+ * @param text the string to copy
+ *
+ * @return the copy of the string
+ */
+char *arena_strdup(struct arena *self, const char *text)
+{
+	return arena_strndup(self, text, strlen(text));
+}
+
+/**
+ * Copy the start of a string in the arena, the copy is nul terminated
+ *
+ * @param self the arena
+ * @param text the string to copy, not necessarily nul terminated
+ * @param size the number of characters to copy
+ *
+ * @return the copy of the string
+ */
+char *arena_strndup(struct arena *self, const char *text, size_t size)
+{
+	// the memory is zeroed, so the copy is already terminated
+	char *copy = arena_alloc(self, size + 1);
+	memcpy(copy, text, size);
+	return copy;
+}
@@ -0,0 +1,49 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_ARENA_H
+#define TURTLE_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 8
+
+// a block of memory in which the allocations are made one after the other
+struct arena_block
+{
+	struct arena_block *prev; // the block filled before this one
+	size_t size;			  // the size of the data
+	size_t used;			  // the number of bytes of the data already allocated
+	char data[];
+};
+
+// a bump allocator, everything is released at once when the arena is destroyed,
+// or everything allocated after a saved position when the arena is rewound
+struct arena
+{
+	struct arena_block *current; // the block where the next allocation is made
+	size_t allocated;			 // the number of bytes handed out
+	size_t reserved;			 // the number of bytes asked to the system
+	size_t block_count;			 // the number of blocks
+};
+
+// a position in an arena
+struct arena_mark
+{
+	struct arena_block *block; // the current block at that time, NULL if there was none
+	size_t used;			   // the bytes used in the block at that time
+	size_t allocated;		   // the bytes handed out at that time
+};
+
+void arena_create(struct arena *self);
+void arena_destroy(struct arena *self);
+
+// release everything allocated since a position, in last in first out order
+void arena_save(const struct arena *self, struct arena_mark *mark);
+void arena_rewind(struct arena *self, const struct arena_mark *mark);
+
+// allocate zeroed memory, aligned for any node of the tree
+void *arena_alloc(struct arena *self, size_t size);
+char *arena_strdup(struct arena *self, const char *text);
+char *arena_strndup(struct arena *self, const char *text, size_t size);
+
+#endif /* TURTLE_ARENA_H */
@@ -1,5 +1,7 @@
 // Jade GURNAUD and Charlotte KRUZIC
 #include "turtle-ast.h"
+#include "turtle-memo.h"
+#include "turtle-output.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -7,22 +9,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
-#define PI 3.14159265358979323846
-#define SQRT2 1.41421356237309504880
-#define SQRT3 1.7320508075688772935
+/**
+ * Allocate a node in the arena, with room for its children only
+ *
+ * @param arena the arena in which the node is allocated
+ * @param children_count the number of children of the node
+ *
+ * @return the pointer to the new node, zeroed
+ */
+struct ast_node *ast_node_alloc(struct arena *arena, size_t children_count)
+{
+	struct ast_node *node = arena_alloc(arena, sizeof(struct ast_node) + children_count * sizeof(struct ast_node *));
+	node->children_count = children_count;
+	return node;
+}
 
 /**
  *
  * Create and initialize a new node representing a numerical value expression
  *
+ * @param arena the arena in which the node is allocated
  * @param value the numerical value
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_value(double value)
+struct ast_node *make_expr_value(struct arena *arena, double value)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 0);
 	node->kind = KIND_EXPR_VALUE;
 	node->u.value = value;
 	return node;
@@ -32,15 +47,18 @@ struct ast_node *make_expr_value(double value)
  *
  * Create and initialize a new node representing a string expression
  *
- * @param name the string
+ * @param arena the arena in which the node is allocated
+ * @param symbols the symbol table in which the name was interned
+ * @param symbol the index of the name
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_name(char *name)
+struct ast_node *make_expr_name(struct arena *arena, const struct symbol_table *symbols, size_t symbol)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 0);
 	node->kind = KIND_EXPR_NAME;
-	node->u.name = name;
+	node->symbol = symbol;
+	node->u.name = symbols->names[node->symbol];
 	return node;
 }
 
@@ -48,15 +66,15 @@ struct ast_node *make_expr_name(char *name)
  *
  * Create and initialize a new node representing a parentheses expression
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression block
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_parentheses(struct ast_node *expr)
+struct ast_node *make_expr_parentheses(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_BLOCK;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -65,16 +83,16 @@ struct ast_node *make_expr_parentheses(struct ast_node *expr)
  *
  * Create and initialize a new node representing a square root function expression
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression to which the square root function is applied
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_sqrt(struct ast_node *expr)
+struct ast_node *make_expr_sqrt(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_FUNC;
 	node->u.func = FUNC_SQRT;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -83,16 +101,16 @@ struct ast_node *make_expr_sqrt(struct ast_node *expr)
  *
  * Create and initialize a new node representing a sin function expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression to which the sin function is applied
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_sin(struct ast_node *expr)
+struct ast_node *make_expr_sin(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_FUNC;
 	node->u.func = FUNC_SIN;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -101,16 +119,16 @@ struct ast_node *make_expr_sin(struct ast_node *expr)
  *
  * Create and initialize a new node representing a cos function expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression to which the cos function is applied
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_cos(struct ast_node *expr)
+struct ast_node *make_expr_cos(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_FUNC;
 	node->u.func = FUNC_COS;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -119,16 +137,16 @@ struct ast_node *make_expr_cos(struct ast_node *expr)
  *
  * Create and initialize a new node representing a tan function expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression to which the tan function is applied
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_tan(struct ast_node *expr)
+struct ast_node *make_expr_tan(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_FUNC;
 	node->u.func = FUNC_TAN;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -137,16 +155,16 @@ struct ast_node *make_expr_tan(struct ast_node *expr)
  *
  * Create and initialize a new node representing a random function expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that represents the two bounds of the random function
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_random(struct ast_node *expr)
+struct ast_node *make_expr_random(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_FUNC;
 	node->u.func = FUNC_RANDOM;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -155,17 +173,17 @@ struct ast_node *make_expr_random(struct ast_node *expr)
  *
  * Create and initialize a new node representing a comma operator expression with two operandes
  *
+ * @param arena the arena in which the node is allocated
  * @param expr1 the expression that represents the first operand
  * @param expr2 the expression that represents the second operand
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_expr_virgule(struct ast_node *expr1, struct ast_node *expr2)
+struct ast_node *make_expr_virgule(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 2);
 	node->kind = KIND_EXPR_BINOP;
 	node->u.op = ',';
-	node->children_count = 2;
 	node->children[0] = expr1;
 	node->children[1] = expr2;
 	return node;
@@ -175,18 +193,18 @@ struct ast_node *make_expr_virgule(struct ast_node *expr1, struct ast_node *expr
  *
  * Create and initialize a new node representing a binary operation expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param left_expr the expression that represents the left operand
  * @param right_expr the expression that represents the right operand
  * @param binary_op the operator
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_binary_op(struct ast_node *left_expr, struct ast_node *right_expr, char binary_op)
+struct ast_node *make_binary_op(struct arena *arena, struct ast_node *left_expr, struct ast_node *right_expr, char binary_op)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 2);
 	node->kind = KIND_EXPR_BINOP;
 	node->u.op = binary_op;
-	node->children_count = 2;
 	node->children[0] = left_expr;
 	node->children[1] = right_expr;
 	return node;
@@ -196,16 +214,16 @@ struct ast_node *make_binary_op(struct ast_node *left_expr, struct ast_node *rig
  *
  * Create and initialize a new node representing a unary minus operator expression.
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression to which the unary minus operator is applied
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_op_uminus(struct ast_node *expr)
+struct ast_node *make_op_uminus(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_EXPR_UNOP;
 	node->u.op = '-';
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -214,16 +232,16 @@ struct ast_node *make_op_uminus(struct ast_node *expr)
  *
  * Create and initialize a new node representing the "print" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that will be displayed by the print
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_print(struct ast_node *expr)
+struct ast_node *make_cmd_print(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_PRINT;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -232,15 +250,16 @@ struct ast_node *make_cmd_print(struct ast_node *expr)
  *
  * Create and initialize a new node representing the "up" command
  *
- *@return the pointer to the new node
+ * @param arena the arena in which the node is allocated
+ *
+ * @return the pointer to the new node
  *
  */
-struct ast_node *make_cmd_up()
+struct ast_node *make_cmd_up(struct arena *arena)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 0);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_UP;
-	node->children_count = 0;
 	return node;
 }
 
@@ -248,30 +267,31 @@ struct ast_node *make_cmd_up()
  *
  * Create and initialize a new node representing the "down" command
  *
- *@return the pointer to the new node
+ * @param arena the arena in which the node is allocated
+ *
+ * @return the pointer to the new node
  *
  */
-struct ast_node *make_cmd_down()
+struct ast_node *make_cmd_down(struct arena *arena)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 0);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_DOWN;
-	node->children_count = 0;
 	return node;
 }
 
 /**
  * Create and initialize a new node representing the "forward"
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression representing the distance to move forward
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_forward(struct ast_node *expr)
+struct ast_node *make_cmd_forward(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_FORWARD;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -279,15 +299,15 @@ struct ast_node *make_cmd_forward(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "backward" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression representing the distance to move backward
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_backward(struct ast_node *expr)
+struct ast_node *make_cmd_backward(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_BACKWARD;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -295,16 +315,16 @@ struct ast_node *make_cmd_backward(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "position" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression which represents the position to go to
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_position(struct ast_node *expr)
+struct ast_node *make_cmd_position(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_POSITION;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -312,16 +332,16 @@ struct ast_node *make_cmd_position(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "right" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that represents the value of the angle that must be made to the right
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_right(struct ast_node *expr)
+struct ast_node *make_cmd_right(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_RIGHT;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -329,16 +349,16 @@ struct ast_node *make_cmd_right(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "left" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that represents the value of the angle that must be made to the left
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_left(struct ast_node *expr)
+struct ast_node *make_cmd_left(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_LEFT;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -346,16 +366,16 @@ struct ast_node *make_cmd_left(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "heading" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that represents the absolute angle for orientation
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_heading(struct ast_node *expr)
+struct ast_node *make_cmd_heading(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_HEADING;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -363,16 +383,16 @@ struct ast_node *make_cmd_heading(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "color" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression that represents the color
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_color(struct ast_node *expr)
+struct ast_node *make_cmd_color(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_COLOR;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -380,30 +400,31 @@ struct ast_node *make_cmd_color(struct ast_node *expr)
 /**
  * Create and initialize a new node representing the "home" command
  *
+ * @param arena the arena in which the node is allocated
+ *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_home()
+struct ast_node *make_cmd_home(struct arena *arena)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 0);
 	node->kind = KIND_CMD_SIMPLE;
 	node->u.cmd = CMD_HOME;
-	node->children_count = 0;
 	return node;
 }
 
 /**
  * Create and initialize a new node representing the "repeat"
  *
+ * @param arena the arena in which the node is allocated
  * @param expr1 the expression representing the number of times to repeat the command
  * @param expr2 the command to repeat
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_repeat(struct ast_node *expr1, struct ast_node *expr2)
+struct ast_node *make_cmd_repeat(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 2);
 	node->kind = KIND_CMD_REPEAT;
-	node->children_count = 2;
 	node->children[0] = expr1;
 	node->children[1] = expr2;
 	return node;
@@ -412,16 +433,16 @@ struct ast_node *make_cmd_repeat(struct ast_node *expr1, struct ast_node *expr2)
 /**
  * Create and initialize a new node for the "set" command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr1 the expression representing the variable name
  * @param expr2 the expression representing the value to set to this variable
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_set(struct ast_node *expr1, struct ast_node *expr2)
+struct ast_node *make_cmd_set(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 2);
 	node->kind = KIND_CMD_SET;
-	node->children_count = 2;
 	node->children[0] = expr1;
 	node->children[1] = expr2;
 	return node;
@@ -430,15 +451,15 @@ struct ast_node *make_cmd_set(struct ast_node *expr1, struct ast_node *expr2)
 /**
  * Create and initialize a new node representing a block of commands
  *
+ * @param arena the arena in which the node is allocated
  * @param cmds the node representing the commands present in the block
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_block_cmds(struct ast_node *cmds)
+struct ast_node *make_block_cmds(struct arena *arena, struct ast_node *cmds)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_BLOCK;
-	node->children_count = 1;
 	node->children[0] = cmds;
 	return node;
 }
@@ -446,16 +467,16 @@ struct ast_node *make_block_cmds(struct ast_node *cmds)
 /**
  * Create and initialize a new node for a procedure definition command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr1 the expression representing the procedure name
  * @param expr2 the expression representing the block of command present in the procedure body
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_proc(struct ast_node *expr1, struct ast_node *expr2)
+struct ast_node *make_cmd_proc(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 2);
 	node->kind = KIND_CMD_PROC;
-	node->children_count = 2;
 	node->children[0] = expr1;
 	node->children[1] = expr2;
 	return node;
@@ -464,15 +485,15 @@ struct ast_node *make_cmd_proc(struct ast_node *expr1, struct ast_node *expr2)
 /**
  * Create and initialize a new node representing a procedure call command
  *
+ * @param arena the arena in which the node is allocated
  * @param expr the expression node representing the name of the procedure to call
  *
  * @return the pointer to the new node
  */
-struct ast_node *make_cmd_call(struct ast_node *expr)
+struct ast_node *make_cmd_call(struct arena *arena, struct ast_node *expr)
 {
-	struct ast_node *node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *node = ast_node_alloc(arena, 1);
 	node->kind = KIND_CMD_CALL;
-	node->children_count = 1;
 	node->children[0] = expr;
 	return node;
 }
@@ -485,60 +506,340 @@ struct ast_node *make_cmd_call(struct ast_node *expr)
  */
 void context_destroy(struct context *self)
 {
-	// Free memory allocated to variables
-	struct variable *current_node = self->var_list;
-	while (current_node != NULL)
+	for (size_t i = 0; i < self->slot_count; i++)
 	{
-		struct variable *next_node = current_node->next;
-		free(current_node);
-		current_node = next_node;
+		if (self->procedures[i].memo != NULL)
+		{
+			memo_destroy(self->procedures[i].memo);
+		}
 	}
+	free(self->variables);
+	free(self->procedures);
+	free(self->quarter_turns);
+}
+
+/**
+ * Get a child of a node, the arguments of position, color and random are
+ * looked up without knowing the shape the parser gave them
+ *
+ * @param node the node, may be NULL
+ * @param index the index of the child
+ *
+ * @return the child, NULL if the node has no such child
+ */
+const struct ast_node *ast_node_child(const struct ast_node *node, size_t index)
+{
+	return node != NULL && index < node->children_count ? node->children[index] : NULL;
+}
+
+/**
+ * Copy a node in the arena, the copy shares the children and the next node of the original
+ *
+ * @param arena the arena in which the copy is allocated
+ * @param node the node to copy
+ *
+ * @return the pointer to the new node
+ */
+struct ast_node *ast_node_copy(struct arena *arena, const struct ast_node *node)
+{
+	struct ast_node *copy = ast_node_alloc(arena, node->children_count);
+	copy->kind = node->kind;
+	copy->u = node->u;
+	copy->symbol = node->symbol;
+	copy->next = node->next;
+	memcpy(copy->children, node->children, node->children_count * sizeof(struct ast_node *));
+	return copy;
+}
 
-	// Free memory allocated to procedures
-	struct procedure *current_node_procedure = self->proc_list;
-	while (current_node_procedure != NULL)
+/**
+ * Initialize an empty abstract syntax tree, ready to be filled by the parser
+ *
+ * @param self the tree to initialize
+ */
+void ast_create(struct ast *self)
+{
+	arena_create(&self->arena);
+	arena_create(&self->names);
+	self->unit = NULL;
+	self->optimized = NULL;
+	symbol_table_create(&self->symbols, &self->names);
+	self->stream = NULL;
+	self->source = NULL;
+	self->scan = NULL;
+}
+
+/**
+ * Print a message about the program on stderr, after the name of its source if it has one
+ *
+ * @param self the tree
+ * @param format the format of the message, as for printf
+ */
+void ast_error(const struct ast *self, const char *format, ...)
+{
+	char message[CONTEXT_ERROR_MAX];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	if (self->source != NULL)
 	{
-		struct procedure *next_node = current_node_procedure->next;
-		free(current_node_procedure);
-		current_node_procedure = next_node;
+		fprintf(stderr, "%s: %s\n", self->source, message);
+	}
+	else
+	{
+		fprintf(stderr, "%s\n", message);
 	}
 }
 
 /**
- * Destroy recursively an ast node and all of its children.
+ * Get the commands to run, the optimized ones when the tree went through the optimizer
+ *
+ * @param self the tree
  *
- * @param self the ast node to destroy
+ * @return the first command of the program
  */
-void ast_node_destroy(struct ast_node *self)
+const struct ast_node *ast_program(const struct ast *self)
+{
+	return self->optimized != NULL ? self->optimized : self->unit;
+}
+
+/**
+ * Destroy all ast node and the ast, the nodes and the names are released with the arena
+ *
+ * @param self the root of the syntax tree to destroy
+ */
+void ast_destroy(struct ast *self)
 {
 	if (self == NULL)
 	{
 		return;
 	}
-	for (int i = 0; i < self->children_count; i++)
+	symbol_table_destroy(&self->symbols);
+	arena_destroy(&self->arena);
+	arena_destroy(&self->names);
+	self->unit = NULL;
+	self->optimized = NULL;
+}
+
+/**
+ * Compute the hash of a name (FNV-1a)
+ *
+ * @param name the name to hash
+ * @param size its length
+ *
+ * @return the hash of the name
+ */
+static size_t symbol_hash(const char *name, size_t size)
+{
+	size_t hash = 14695981039346656037ULL;
+	for (const unsigned char *c = (const unsigned char *)name; c < (const unsigned char *)name + size; c++)
 	{
-		ast_node_destroy(self->children[i]);
+		hash ^= *c;
+		hash *= 1099511628211ULL;
 	}
-	if (self->kind == KIND_EXPR_NAME)
+	return hash;
+}
+
+/**
+ * Initialize an empty symbol table
+ *
+ * @param self the symbol table to initialize
+ * @param arena the arena in which the names are copied
+ */
+void symbol_table_create(struct symbol_table *self, struct arena *arena)
+{
+	self->arena = arena;
+	self->names = NULL;
+	self->hashes = NULL;
+	self->count = 0;
+	self->capacity = 0;
+	self->bucket_count = 64;
+	self->buckets = calloc(self->bucket_count, sizeof(size_t));
+}
+
+/**
+ * Free the memory allocated for a symbol table, the names belong to its arena
+ *
+ * @param self the symbol table to destroy
+ */
+void symbol_table_destroy(struct symbol_table *self)
+{
+	free(self->names);
+	free(self->hashes);
+	free(self->buckets);
+}
+
+/**
+ * Find the bucket of a name in the hash table
+ *
+ * @param self the symbol table
+ * @param name the name to look for
+ * @param size its length
+ * @param hash the hash of the name
+ *
+ * @return the bucket holding the name, or the empty bucket where it would be inserted
+ */
+static size_t *symbol_bucket(const struct symbol_table *self, const char *name, size_t size, size_t hash)
+{
+	size_t mask = self->bucket_count - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
 	{
-		free(self->u.name);
+		size_t *bucket = &self->buckets[i];
+		if (*bucket == 0)
+		{
+			return bucket;
+		}
+		const char *interned = self->names[*bucket - 1];
+		if (self->hashes[*bucket - 1] == hash && strncmp(interned, name, size) == 0 && interned[size] == '\0')
+		{
+			return bucket;
+		}
 	}
-	ast_node_destroy(self->next);
-	free(self);
 }
 
 /**
- * Destroy all ast node and the ast
+ * Find the index of a name in the symbol table
  *
- * @param self the root of the syntax tree to destroy
+ * @param self the symbol table
+ * @param name the name to look for
+ *
+ * @return the index of the name, SYMBOL_NONE if it was never interned
  */
-void ast_destroy(struct ast *self)
+size_t symbol_find(const struct symbol_table *self, const char *name)
 {
-	if (self == NULL)
+	size_t size = strlen(name);
+	size_t *bucket = symbol_bucket(self, name, size, symbol_hash(name, size));
+	return *bucket == 0 ? SYMBOL_NONE : *bucket - 1;
+}
+
+/**
+ * Intern a name in the symbol table, the name is copied in the arena the first time it is seen
+ *
+ * @param self the symbol table
+ * @param name the name to intern
+ *
+ * @return the index of the name
+ */
+size_t symbol_intern(struct symbol_table *self, const char *name)
+{
+	return symbol_intern_view(self, name, strlen(name));
+}
+
+/**
+ * Intern a name given by its characters, for instance in the text of the
+ * program, the name is copied in the arena the first time it is seen
+ *
+ * @param self the symbol table
+ * @param name the characters of the name, not necessarily nul terminated
+ * @param size the number of characters
+ *
+ * @return the index of the name
+ */
+size_t symbol_intern_view(struct symbol_table *self, const char *name, size_t size)
+{
+	size_t hash = symbol_hash(name, size);
+	size_t *bucket = symbol_bucket(self, name, size, hash);
+	if (*bucket != 0)
+	{
+		return *bucket - 1;
+	}
+
+	if (self->count == self->capacity)
+	{
+		self->capacity = self->capacity == 0 ? 16 : self->capacity * 2;
+		self->names = realloc(self->names, self->capacity * sizeof(char *));
+		self->hashes = realloc(self->hashes, self->capacity * sizeof(size_t));
+	}
+	size_t index = self->count++;
+	self->names[index] = arena_strndup(self->arena, name, size);
+	self->hashes[index] = hash;
+	*bucket = index + 1;
+
+	// Keep the table at most half full
+	if (self->count * 2 > self->bucket_count)
+	{
+		free(self->buckets);
+		self->bucket_count *= 2;
+		self->buckets = calloc(self->bucket_count, sizeof(size_t));
+		for (size_t i = 0; i < self->count; i++)
+		{
+			size_t mask = self->bucket_count - 1;
+			size_t b = self->hashes[i] & mask;
+			while (self->buckets[b] != 0)
+			{
+				b = (b + 1) & mask;
+			}
+			self->buckets[b] = i + 1;
+		}
+	}
+	return index;
+}
+
+/**
+ * Make sure the context has a variable and a procedure slot for every symbol
+ *
+ * @param ctx the execution context
+ */
+void context_reserve(struct context *ctx)
+{
+	size_t count = ctx->symbols->count;
+	if (count <= ctx->slot_count)
 	{
 		return;
 	}
-	ast_node_destroy(self->unit);
+
+	size_t slot_count = ctx->slot_count == 0 ? 16 : ctx->slot_count;
+	while (slot_count < count)
+	{
+		slot_count *= 2;
+	}
+	ctx->variables = realloc(ctx->variables, slot_count * sizeof(struct variable));
+	ctx->procedures = realloc(ctx->procedures, slot_count * sizeof(struct procedure));
+	memset(ctx->variables + ctx->slot_count, 0, (slot_count - ctx->slot_count) * sizeof(struct variable));
+	memset(ctx->procedures + ctx->slot_count, 0, (slot_count - ctx->slot_count) * sizeof(struct procedure));
+	ctx->slot_count = slot_count;
+}
+
+/**
+ * Get the variable slot of a symbol
+ *
+ * @param ctx the execution context
+ * @param symbol the index of the name of the variable
+ *
+ * @return the slot of the variable, which may not be defined yet
+ */
+struct variable *context_variable(struct context *ctx, size_t symbol)
+{
+	if (ctx->stats != NULL)
+	{
+		ctx->stats->lookups++;
+	}
+	if (symbol >= ctx->slot_count)
+	{
+		context_reserve(ctx);
+	}
+	return &ctx->variables[symbol];
+}
+
+/**
+ * Get the procedure slot of a symbol
+ *
+ * @param ctx the execution context
+ * @param symbol the index of the name of the procedure
+ *
+ * @return the slot of the procedure, which may not be defined yet
+ */
+struct procedure *context_procedure(struct context *ctx, size_t symbol)
+{
+	if (ctx->stats != NULL)
+	{
+		ctx->stats->lookups++;
+	}
+	if (symbol >= ctx->slot_count)
+	{
+		context_reserve(ctx);
+	}
+	return &ctx->procedures[symbol];
 }
 
 /**
@@ -550,26 +851,9 @@ void ast_destroy(struct ast *self)
 */
 void new_variable(char *name, double value, struct context *ctx)
 {
-	// Memory allocation for variable
-	struct variable *new_node = calloc(1, sizeof(struct variable));
-	new_node->name = name;
-	new_node->value = value;
-	new_node->next = NULL;
-
-	// Adding the variable to the list of variables
-	if (ctx->var_list == NULL)
-	{
-		ctx->var_list = new_node;
-	}
-	else
-	{
-		struct variable *current_node = ctx->var_list;
-		while (current_node->next != NULL)
-		{
-			current_node = current_node->next;
-		}
-		current_node->next = new_node;
-	}
+	struct variable *var = context_variable(ctx, symbol_intern(ctx->symbols, name));
+	var->value = value;
+	var->defined = true;
 }
 
 /**
@@ -582,41 +866,23 @@ void new_variable(char *name, double value, struct context *ctx)
  */
 bool does_variable_exist(char *name, struct context *ctx)
 {
-	// Browse the list of variables
-	struct variable *current_node = ctx->var_list;
-	while (current_node != NULL)
-	{
-		if (strcmp(current_node->name, name) == 0)
-		{
-			return true;
-		}
-		current_node = current_node->next;
-	}
-	return false;
+	size_t symbol = symbol_find(ctx->symbols, name);
+	return symbol != SYMBOL_NONE && context_variable(ctx, symbol)->defined;
 }
 
 /**
- * Find the value of a variable with a given name in the execution context's variables list.
+ * Find the value of a variable with a given name in the execution context's variables.
  *
  * @param name the name of the variable to find
- * @param ctx the execution context containing the variable list
+ * @param ctx the execution context containing the variables
  *
  * @return the value of the variable,
  *		  0 otherwise (this never happens, because this function is called only if the variable exists)
  */
 double find_variable(char *name, struct context *ctx)
 {
-	// Parcours de la liste de variables
-	struct variable *current_node = ctx->var_list;
-	while (current_node != NULL)
-	{
-		if (strcmp(current_node->name, name) == 0)
-		{
-			return current_node->value;
-		}
-		current_node = current_node->next;
-	}
-	return 0;
+	size_t symbol = symbol_find(ctx->symbols, name);
+	return symbol != SYMBOL_NONE ? context_variable(ctx, symbol)->value : 0;
 }
 
 /**
@@ -626,91 +892,252 @@ double find_variable(char *name, struct context *ctx)
  * @param node_child the ast node representing all the commandes of the procedure
  * @param ctx the execution context in which to add the procedure
  */
-void new_procedure(char *name, struct ast_node *node_child, struct context *ctx)
+void new_procedure(char *name, const struct ast_node *node_child, struct context *ctx)
 {
-	// Memory allocation for the procedure
-	struct procedure *new_node = calloc(1, sizeof(struct procedure));
-	new_node->name = name;
-	new_node->nodes = node_child;
-	new_node->next = NULL;
+	context_procedure(ctx, symbol_intern(ctx->symbols, name))->nodes = node_child;
+}
 
-	// Adding the procedure to the existing list
-	if (ctx->proc_list == NULL)
+/**
+ * Search for a procedure with the given name in the execution context's procedures
+ *
+ * @param name the name of the procedure to find
+ * @param ctx the execution context containing the procedures in which we search for the procedure
+ *
+ * @return the root node of the procedure commands's ast node if found, otherwise NULL
+ */
+const struct ast_node *does_procedure_exist(char *name, struct context *ctx)
+{
+	size_t symbol = symbol_find(ctx->symbols, name);
+	return symbol != SYMBOL_NONE ? context_procedure(ctx, symbol)->nodes : NULL;
+}
+
+/**
+ * Initializes a new execution context with default values and pre-defined variables
+ *
+ * @param self the execution context to be initialized
+ * @param symbols the symbol table of the program, the pre-defined variables are added to it
+ * @param out the output where the primitives are written
+ */
+void context_create(struct context *self, struct symbol_table *symbols, struct output *out)
+{
+	self->x = 0;
+	self->y = 0;
+	self->quarter_turns = malloc((2 * CONTEXT_QUARTER_TURNS_MAX + 1) * sizeof(struct direction));
+	for (size_t i = 0; i < 2 * CONTEXT_QUARTER_TURNS_MAX + 1; i++)
 	{
-		ctx->proc_list = new_node;
+		self->quarter_turns[i].dx = NAN;
 	}
-	else
+	context_turn(self, 0);
+	self->up = false;
+	self->symbols = symbols;
+	self->out = out;
+	self->stats = NULL;
+	self->memoize = true;
+	self->rigid = false;
+	self->recording = NULL;
+	self->trap = NULL;
+	random_seed(&self->random, random_entropy());
+	self->variables = NULL;
+	self->procedures = NULL;
+	self->slot_count = 0;
+	new_variable("PI", PI, self);
+	new_variable("SQRT2", SQRT2, self);
+	new_variable("SQRT3", SQRT3, self);
+}
+
+/**
+ * Find the components of a color given by its name
+ *
+ * @param name the name of the color
+ * @param r the red component found
+ * @param g the green component found
+ * @param b the blue component found
+ *
+ * @return true if the color exists, false otherwise
+ */
+bool color_from_name(const char *name, double *r, double *g, double *b)
+{
+	static const struct
 	{
-		struct procedure *current_node = ctx->proc_list;
-		while (current_node->next != NULL)
+		const char *name;
+		double r, g, b;
+	} colors[] = {
+		{"red", 1.0, 0.0, 0.0},
+		{"green", 0.0, 1.0, 0.0},
+		{"blue", 0.0, 0.0, 1.0},
+		{"cyan", 0.0, 1.0, 1.0},
+		{"magenta", 1.0, 0.0, 1.0},
+		{"yellow", 1.0, 1.0, 0.0},
+		{"black", 0.0, 0.0, 0.0},
+		{"gray", 0.5, 0.5, 0.5},
+		{"white", 1.0, 1.0, 1.0},
+	};
+
+	for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); i++)
+	{
+		if (strcmp(colors[i].name, name) == 0)
 		{
-			current_node = current_node->next;
+			*r = colors[i].r;
+			*g = colors[i].g;
+			*b = colors[i].b;
+			return true;
 		}
-		current_node->next = new_node;
 	}
+	return false;
 }
 
 /**
- * Search for a procedure with the given name in the execution context's procedure list
+ * Compute the direction of an angle, the same way the turtle always did
  *
- * @param name the name of the procedure to find
- * @param ctx the execution context containing the procedure list in which we search for the procedure
+ * @param angle the angle in degrees, 0 is up
+ * @param dir the direction found
+ */
+static void context_direction(double angle, struct direction *dir)
+{
+	dir->dx = cos((angle - 90) * (PI / 180));
+	dir->dy = sin((angle - 90) * (PI / 180));
+}
+
+/**
+ * Change the angle of the turtle and update its direction. The directions
+ * of the multiples of 90° are only computed the first time they are needed.
  *
- * @return the root node of the procedure commands's ast node if found, otherwise NULL
+ * @param ctx the execution context
+ * @param angle the new angle in degrees
  */
-struct ast_node *does_procedure_exist(char *name, struct context *ctx)
+void context_turn(struct context *ctx, double angle)
 {
-	// Browse the list of procedures
-	struct procedure *current_node = ctx->proc_list;
-	while (current_node != NULL)
+	ctx->angle = angle;
+
+	double quarters = angle / 90;
+	if (quarters >= -CONTEXT_QUARTER_TURNS_MAX && quarters <= CONTEXT_QUARTER_TURNS_MAX)
 	{
-		if (strcmp(current_node->name, name) == 0)
+		int k = (int)quarters;
+		if (k * 90.0 == angle)
 		{
-			return current_node->nodes;
+			struct direction *dir = &ctx->quarter_turns[k + CONTEXT_QUARTER_TURNS_MAX];
+			if (isnan(dir->dx))
+			{
+				context_direction(angle, dir);
+			}
+			ctx->direction = *dir;
+			return;
 		}
-		current_node = current_node->next;
 	}
-	return NULL;
+	context_direction(angle, &ctx->direction);
 }
 
 /**
- * Initializes a new execution context with default values and pre-defined variables
+ * Move the turtle along its heading and emit the matching primitive
  *
- * @param self the execution context to be initialized
+ * @param ctx the execution context
+ * @param distance the distance to move (negative to move backward)
  */
-void context_create(struct context *self)
+void context_move(struct context *ctx, double distance)
 {
-	self->x = 0;
-	self->y = 0;
-	self->angle = 0;
-	self->up = false;
-	self->var_list = NULL;
-	new_variable("PI", PI, self);
-	new_variable("SQRT2", SQRT2, self);
-	new_variable("SQRT3", SQRT3, self);
-	self->proc_list = NULL;
+	double dx = distance * ctx->direction.dx;
+	double dy = distance * ctx->direction.dy;
+	ctx->x = ctx->x + dx;
+	ctx->y = ctx->y + dy;
+	if (ctx->recording != NULL)
+	{
+		memo_record_move(ctx, dx, dy, !ctx->up);
+	}
+	if (ctx->up)
+	{
+		output_move_to(ctx->out, ctx->x, ctx->y);
+	}
+	else
+	{
+		output_line_to(ctx->out, ctx->x, ctx->y);
+	}
 }
 
 /**
- * Evaluate the value of a node that represents a string
+ * Move the turtle to an absolute position and emit the matching primitive
  *
- * @param node the ast node to be evaluated
- * @param ctx the execution context in which the node is evaluated
+ * @param ctx the execution context
+ * @param x the new abscissa
+ * @param y the new ordinate
+ */
+void context_position(struct context *ctx, double x, double y)
+{
+	ctx->x = x;
+	ctx->y = y;
+	output_move_to(ctx->out, ctx->x, ctx->y);
+}
+
+/**
+ * Emit a color change
  *
- * @return the value of the node if it's contain a name, an empty string otherwise
+ * @param ctx the execution context
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
  */
+void context_color(struct context *ctx, double r, double g, double b)
+{
+	if (ctx->recording != NULL)
+	{
+		memo_record_color(ctx, r, g, b);
+	}
+	output_color(ctx->out, r, g, b);
+}
 
-char *ast_node_char_eval(const struct ast_node *node, struct context *ctx)
+/**
+ * Stop the evaluation with an error message, after writing the pending
+ * primitives. When the context has a trap, the message is kept in it and
+ * the evaluation jumps back to it instead, the primitives stay in the output.
+ *
+ * @param ctx the execution context
+ * @param format the message, as for printf
+ */
+void context_error(struct context *ctx, const char *format, ...)
 {
-	if (node->kind == KIND_EXPR_NAME)
+	va_list args;
+	if (ctx->trap != NULL)
 	{
-		return node->u.name;
+		va_start(args, format);
+		vsnprintf(ctx->trap->message, CONTEXT_ERROR_MAX, format, args);
+		va_end(args);
+		longjmp(ctx->trap->jump, 1);
 	}
-	return "";
+
+	output_flush(ctx->out);
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(2);
+}
+
+/**
+ * Print an expression between the primitives
+ *
+ * @param ctx the execution context
+ * @param expr the expression to print
+ */
+void context_print(struct context *ctx, const struct ast_node *expr)
+{
+	output_string(ctx->out, "\n");
+	ast_node_print(expr, ctx->out);
 }
 
 /**
- * Evaluate an ast node
+ * Bring the turtle back to its initial state
+ *
+ * @param ctx the execution context
+ */
+void context_home(struct context *ctx)
+{
+	ctx->x = 0;
+	ctx->y = 0;
+	context_turn(ctx, 0);
+	ctx->up = false;
+}
+
+/**
+ * Evaluate an ast node, without the nodes that follow it in its sequence
  *
  * @param node the ast node to evaluate
  * @param ctx the execution context
@@ -724,18 +1151,27 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 		return 0;
 	}
 
+	if (ctx->stats != NULL)
+	{
+		ctx->stats->kinds[node->kind]++;
+		if (node->kind == KIND_CMD_SIMPLE)
+		{
+			ctx->stats->cmds[node->u.cmd]++;
+		}
+	}
+
 	if (node->children_count == 0)
 	{
 		switch (node->kind)
 		{
 		case KIND_EXPR_NAME:
 		{
-			if (!does_variable_exist(node->u.name, ctx))
+			const struct variable *var = context_variable(ctx, node->symbol);
+			if (!var->defined)
 			{
-				fprintf(stderr, "Error ! Variable does not exist.");
-				exit(2);
+				context_error(ctx, "Error ! Variable does not exist.");
 			}
-			return find_variable(node->u.name, ctx);
+			return var->value;
 		}
 		break;
 		case KIND_EXPR_VALUE:
@@ -745,10 +1181,7 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			switch (node->u.cmd)
 			{
 			case CMD_HOME:
-				ctx->x = 0;
-				ctx->y = 0;
-				ctx->angle = 0;
-				ctx->up = false;
+				context_home(ctx);
 				break;
 			case CMD_UP:
 				ctx->up = true;
@@ -763,8 +1196,6 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 		default:
 			break;
 		}
-
-		ast_node_eval(node->next, ctx);
 	}
 
 	else if (node->children_count == 1)
@@ -775,7 +1206,7 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 		case KIND_EXPR_BLOCK:
 			return ast_node_eval(node->children[0], ctx);
 		case KIND_CMD_BLOCK:
-			return ast_node_eval(node->children[0], ctx);
+			ast_cmds_eval(node->children[0], ctx);
 			break;
 		case KIND_EXPR_UNOP:
 			return -ast_node_eval(node->children[0], ctx);
@@ -784,9 +1215,8 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			switch (node->u.cmd)
 			{
 			case CMD_POSITION:
-				ctx->x = ast_node_eval(node->children[0]->children[0], ctx);
-				ctx->y = ast_node_eval(node->children[0]->children[1], ctx);
-				fprintf(stdout, "\nMoveTo %f %f", ctx->x, ctx->y);
+				ctx->x = ast_node_eval(ast_node_child(node->children[0], 0), ctx);
+				context_position(ctx, ctx->x, ast_node_eval(ast_node_child(node->children[0], 1), ctx));
 				break;
 			case CMD_COLOR:
 				{
@@ -795,154 +1225,66 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 				// If the color was given by name
 				if (child->children_count == 0)
 				{
-					char *the_color = child->u.name;
-					double c1 = 0.0;
-					double c2 = 0.0;
-					double c3 = 0.0;
-
-					if (strcmp(the_color, "red") == 0)
-					{
-						c1 = 1.0;
-						c2 = 0.0;
-						c3 = 0.0;
-					}
-					else if (strcmp(the_color, "green") == 0)
-					{
-						c1 = 0.0;
-						c2 = 1.0;
-						c3 = 0.0;
-					}
-					else if (strcmp(the_color, "blue") == 0)
-					{
-						c1 = 0.0;
-						c2 = 0.0;
-						c3 = 1.0;
-					}
-					else if (strcmp(the_color, "cyan") == 0)
-					{
-						c1 = 0.0;
-						c2 = 1.0;
-						c3 = 1.0;
-					}
-					else if (strcmp(the_color, "magenta") == 0)
-					{
-						c1 = 1.0;
-						c2 = 0.0;
-						c3 = 1.0;
-					}
-					else if (strcmp(the_color, "yellow") == 0)
-					{
-						c1 = 1.0;
-						c2 = 1.0;
-						c3 = 0.0;
-					}
-					else if (strcmp(the_color, "black") == 0)
-					{
-						c1 = 0.0;
-						c2 = 0.0;
-						c3 = 0.0;
-					}
-					else if (strcmp(the_color, "gray") == 0)
-					{
-						c1 = 0.5;
-						c2 = 0.5;
-						c3 = 0.5;
-					}
-					else if (strcmp(the_color, "white") == 0)
-					{
-						c1 = 1.0;
-						c2 = 1.0;
-						c3 = 1.0;
-					}
-					else
+					double c1, c2, c3;
+					if (!color_from_name(child->u.name, &c1, &c2, &c3))
 					{
-						fprintf(stderr, "Error ! The color does not exist.");
-						exit(2);
+						context_error(ctx, "Error ! The color does not exist.");
 					}
-					fprintf(stdout, "\nColor %f %f %f", c1, c2, c3);
+					context_color(ctx, c1, c2, c3);
 				}
 				// If the color was given by three doubles
 				else
 				{
-					double firstcolor = ast_node_eval(child->children[0]->children[0], ctx);
-					double secondcolor = ast_node_eval(child->children[0]->children[1], ctx);
-					double thirdcolor = ast_node_eval(child->children[1], ctx);
+					double firstcolor = ast_node_eval(ast_node_child(child->children[0], 0), ctx);
+					double secondcolor = ast_node_eval(ast_node_child(child->children[0], 1), ctx);
+					double thirdcolor = ast_node_eval(ast_node_child(child, 1), ctx);
 					if (firstcolor < 0 || firstcolor > 1 ||
 					secondcolor < 0 || secondcolor > 1 ||
 					thirdcolor < 0 || thirdcolor > 1) {
-						fprintf(stderr, "Error ! Color values must be in the range [0, 1].\n");
-						exit(2);
+						context_error(ctx, "Error ! Color values must be in the range [0, 1].\n");
 					}
-					fprintf(stdout, "\nColor %f %f %f", firstcolor, secondcolor, thirdcolor);
+					context_color(ctx, firstcolor, secondcolor, thirdcolor);
 				}
 				}
 				break;
 			case CMD_FORWARD:
-			{
-				double distance_forward = ast_node_eval(node->children[0], ctx);
-				ctx->x = ctx->x + distance_forward * cos((ctx->angle - 90) * (PI / 180));
-				ctx->y = ctx->y + distance_forward * sin((ctx->angle - 90) * (PI / 180));
-				if (ctx->up)
-				{
-					fprintf(stdout, "\nMoveTo %f %f", ctx->x, ctx->y);
-				}
-				else
-				{
-					fprintf(stdout, "\nLineTo %f %f", ctx->x, ctx->y);
-				}
-			}
-			break;
+				context_move(ctx, ast_node_eval(node->children[0], ctx));
+				break;
 			case CMD_BACKWARD:
-			{
-				double distance = ast_node_eval(node->children[0], ctx);
-				ctx->x = ctx->x - distance * cos((ctx->angle - 90) * (PI / 180));
-				ctx->y = ctx->y - distance * sin((ctx->angle - 90) * (PI / 180));
-				if (ctx->up)
-				{
-					fprintf(stdout, "\nMoveTo %f %f", ctx->x, ctx->y);
-				}
-				else
-				{
-					fprintf(stdout, "\nLineTo %f %f", ctx->x, ctx->y);
-				}
-			}
-			break;
+				context_move(ctx, -ast_node_eval(node->children[0], ctx));
+				break;
 			case CMD_RIGHT:
 				if (node->children[0]->u.value < 360 && node->children[0]->u.value > -360)
 				{
-					ctx->angle += ast_node_eval(node->children[0], ctx);
+					context_turn(ctx, ctx->angle + ast_node_eval(node->children[0], ctx));
 				}
 				else
 				{
-					fprintf(stderr, "Error ! The angle to go right must be between -360° and 360°\n");
-					exit(2);
+					context_error(ctx, "Error ! The angle to go right must be between -360° and 360°\n");
 				}
 				break;
 			case CMD_LEFT:
 				if (node->children[0]->u.value < 360 && node->children[0]->u.value > -360)
 				{
-					ctx->angle -= ast_node_eval(node->children[0], ctx);
+					context_turn(ctx, ctx->angle - ast_node_eval(node->children[0], ctx));
 				}
 				else
 				{
-					fprintf(stderr, "Error ! The angle to go left must be between -360° and 360°\n");
-					exit(2);
+					context_error(ctx, "Error ! The angle to go left must be between -360° and 360°\n");
 				}
 				break;
 			case CMD_HEADING:
 				if (node->children[0]->u.value < 360 && node->children[0]->u.value > -360)
 				{
-					ctx->angle = ast_node_eval(node->children[0], ctx);
+					context_turn(ctx, ast_node_eval(node->children[0], ctx));
 				}
 				else
 				{
-					fprintf(stderr, "Error ! The absolute angle must be between -360° and 360°\n");
-					exit(2);
+					context_error(ctx, "Error ! The absolute angle must be between -360° and 360°\n");
 				}
 				break;
 			case CMD_PRINT:
-				fprintf(stdout, "\n");
-				ast_node_print(node->children[0]);
+				context_print(ctx, node->children[0]);
 				break;
 			default:
 				break;
@@ -953,14 +1295,21 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 		case KIND_CMD_CALL:
 		{
 			struct ast_node *name_proc = node->children[0];
-			struct ast_node *proc = does_procedure_exist(name_proc->u.name, ctx);
+			const struct ast_node *proc = context_procedure(ctx, name_proc->symbol)->nodes;
 			if (proc == NULL)
 			{
-				fprintf(stderr, "Error ! Procedure %s does not exist.\n", name_proc->u.name);
-				exit(2);
+				context_error(ctx, "Error ! Procedure %s does not exist.\n", name_proc->u.name);
 			}
-			ast_node_eval(proc, ctx);
-			return ast_node_eval(node->next, ctx);
+			enum memo_call call = memo_call(ctx, name_proc->symbol);
+			if (call != MEMO_CALL_REPLAYED)
+			{
+				ast_cmds_eval(proc, ctx);
+				if (call == MEMO_CALL_RECORD)
+				{
+					memo_record_end(ctx);
+				}
+			}
+			return 0;
 		}
 		break;
 		case KIND_EXPR_FUNC:
@@ -973,8 +1322,7 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 				}
 				else
 				{
-					fprintf(stderr, "Error ! The sqrt function only takes positive or null numbers.\n");
-					exit(2);
+					context_error(ctx, "Error ! The sqrt function only takes positive or null numbers.\n");
 				}
 				break;
 			case FUNC_SIN:
@@ -984,8 +1332,7 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 				}
 				else
 				{
-					fprintf(stderr, "Error! The sin function only takes angles between 0° and 90°\n");
-					exit(2);
+					context_error(ctx, "Error! The sin function only takes angles between 0° and 90°\n");
 				}
 				break;
 			case FUNC_COS:
@@ -995,8 +1342,7 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 				}
 				else
 				{
-					fprintf(stderr, "Error! The cos function only takes angles between 0° and 180°\n");
-					exit(2);
+					context_error(ctx, "Error! The cos function only takes angles between 0° and 180°\n");
 				}
 				break;
 			case FUNC_TAN:
@@ -1005,15 +1351,13 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			case FUNC_RANDOM:
 			{
 				struct ast_node *parenthese = node->children[0];
-				struct ast_node *virgule = parenthese->children[0];
-				int min = ast_node_eval(virgule->children[0], ctx);
-				int max = ast_node_eval(virgule->children[1], ctx);
+				const struct ast_node *virgule = ast_node_child(parenthese, 0);
+				int min = ast_node_eval(ast_node_child(virgule, 0), ctx);
+				int max = ast_node_eval(ast_node_child(virgule, 1), ctx);
 				if(min>max){
-					fprintf(stderr, "Error ! The first bound of the random is greater than the second.\n");
-					exit(2);
+					context_error(ctx, "Error ! The first bound of the random is greater than the second.\n");
 				}
-				int random = min + rand() % (max + 1 - min);
-				return random;
+				return random_range(&ctx->random, min, max);
 			}
 			break;
 
@@ -1022,8 +1366,6 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			}
 			break;
 		}
-
-		ast_node_eval(node->next, ctx);
 	}
 
 	else if (node->children_count == 2)
@@ -1035,23 +1377,35 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			{
 			struct ast_node* name_var = node->children[0];
 			struct ast_node* value = node->children[1];
-			if(does_variable_exist(name_var->u.name, ctx)){
-				fprintf(stderr, "Error ! The variable already exists.\n");
-				exit(2);
+			if(context_variable(ctx, name_var->symbol)->defined){
+				context_error(ctx, "Error ! The variable already exists.\n");
 			}
-			new_variable(ast_node_char_eval(name_var, ctx), ast_node_eval(value, ctx), ctx);
+			double result = ast_node_eval(value, ctx);
+			struct variable *var = context_variable(ctx, name_var->symbol);
+			var->value = result;
+			var->defined = true;
 			}
 			break;
 		case KIND_CMD_REPEAT:
 		{
 			int nb_repeat = ast_node_eval(node->children[0], ctx);
 			if(nb_repeat<0){
-				fprintf(stderr, "Error ! Cannot repeat a command a negative number of times.\n");
-				exit(2);
+				context_error(ctx, "Error ! Cannot repeat a command a negative number of times.\n");
 			}
-			for (int i = 0; i < nb_repeat; i++)
+			int first = 0;
+			struct memo_trace trace;
+			if (memo_repeat_begin(ctx, node->children[1], nb_repeat, &trace))
 			{
-				ast_node_eval(node->children[1], ctx);
+				ast_cmds_eval(node->children[1], ctx);
+				if (memo_repeat_end(ctx, &trace, nb_repeat - 1))
+				{
+					return 0;
+				}
+				first = 1;
+			}
+			for (int i = first; i < nb_repeat; i++)
+			{
+				ast_cmds_eval(node->children[1], ctx);
 			}
 		}
 		break;
@@ -1059,11 +1413,11 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 			{
 			struct ast_node* name_proc = node->children[0];
 			struct ast_node* commands = node->children[1];
-			if(does_procedure_exist(name_proc->u.name, ctx)){
-				fprintf(stderr, "Error ! The procedure already exists.\n");
-				exit(2);
+			struct procedure *proc = context_procedure(ctx, name_proc->symbol);
+			if(proc->nodes != NULL){
+				context_error(ctx, "Error ! The procedure already exists.\n");
 			}
-			new_procedure(ast_node_char_eval(name_proc, ctx), commands, ctx);
+			proc->nodes = commands;
 			}
 			break;
 		case KIND_EXPR_BINOP:
@@ -1091,12 +1445,122 @@ double ast_node_eval(const struct ast_node *node, struct context *ctx)
 		default:
 			break;
 		}
-
-		ast_node_eval(node->next, ctx);
 	}
 	return 0;
 }
 
+/**
+ * Evaluate a sequence of commands one after the other, without growing the stack
+ *
+ * @param node the first command of the sequence
+ * @param ctx the execution context
+ */
+void ast_cmds_eval(const struct ast_node *node, struct context *ctx)
+{
+	for (; node != NULL; node = node->next)
+	{
+		ast_node_eval(node, ctx);
+	}
+}
+
+/**
+ * Read a monotonic clock
+ *
+ * @return the time in nanoseconds
+ */
+static long long ast_stream_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Check whether a command defines a procedure, anywhere in its blocks
+ *
+ * @param node the command
+ *
+ * @return true if the command or one of its children is a proc
+ */
+static bool ast_node_defines_proc(const struct ast_node *node)
+{
+	for (; node != NULL; node = node->next)
+	{
+		if (node->kind == KIND_CMD_PROC)
+		{
+			return true;
+		}
+		for (size_t i = 0; i < node->children_count; i++)
+		{
+			if (ast_node_defines_proc(node->children[i]))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * Start running a program while it is parsed
+ *
+ * @param self the state of the run
+ * @param tree the tree filled by the parser, its top-level commands are not kept
+ * @param ctx the execution context
+ */
+void ast_stream_create(struct ast_stream *self, struct ast *tree, struct context *ctx)
+{
+	self->ctx = ctx;
+	arena_save(&tree->arena, &self->mark);
+	self->commands = 0;
+	self->kept = 0;
+	self->flushed_ns = ast_stream_now();
+	tree->stream = self;
+}
+
+/**
+ * Run a top-level command that was just parsed. Its nodes are released
+ * afterwards, unless it defines a procedure that may be called later.
+ * The output is flushed regularly so that the viewer can start drawing.
+ *
+ * @param self the tree being parsed
+ * @param cmd the command
+ */
+void ast_stream_command(struct ast *self, struct ast_node *cmd)
+{
+	struct ast_stream *stream = self->stream;
+	ast_node_eval(cmd, stream->ctx);
+	stream->commands++;
+
+	if (ast_node_defines_proc(cmd))
+	{
+		stream->kept++;
+		arena_save(&self->arena, &stream->mark);
+	}
+	else
+	{
+		arena_rewind(&self->arena, &stream->mark);
+	}
+
+	long long now = ast_stream_now();
+	if (now - stream->flushed_ns >= AST_STREAM_FLUSH_NS)
+	{
+		output_flush(stream->ctx->out);
+		stream->flushed_ns = now;
+	}
+}
+
+/**
+ * End the run of a streamed program, like ast_eval does
+ *
+ * @param self the state of the run
+ */
+void ast_stream_finish(struct ast_stream *self)
+{
+	output_text(self->ctx->out, "\n", 1);
+	output_flush(self->ctx->out);
+}
+
 /**
  * Evaluate all ast node and the ast
  *
@@ -1110,44 +1574,210 @@ void ast_eval(const struct ast *self, struct context *ctx)
 	{
 		return;
 	}
-	ast_node_eval(self->unit, ctx);
-	fprintf(stdout, "\n");
+	ast_cmds_eval(ast_program(self), ctx);
+	output_text(ctx->out, "\n", 1);
+	output_flush(ctx->out);
+}
+
+// items of the printer stack kept on the C stack, enough for most expressions
+#define PRINT_STACK_LOCAL 64
+
+// a pending step of the printer: a sequence of nodes or a piece of text
+struct print_item
+{
+	const struct ast_node *node; // the first node of a sequence, NULL for a text
+	const char *text;			 // the text written when node is NULL
+};
+
+// the steps left to the printer, the next one on top
+struct print_stack
+{
+	struct print_item *items; // the local storage until it is too small
+	size_t count;
+	size_t capacity;
+	struct print_item local[PRINT_STACK_LOCAL];
+};
+
+/**
+ * Push a step on the printer stack
+ *
+ * @param stack the printer stack
+ * @param node the sequence of nodes to print, NULL for a text
+ * @param text the text to write if there is no node
+ */
+static void print_push(struct print_stack *stack, const struct ast_node *node, const char *text)
+{
+	if (node == NULL && text == NULL)
+	{
+		return;
+	}
+	if (stack->count == stack->capacity)
+	{
+		stack->capacity *= 2;
+		if (stack->items == stack->local)
+		{
+			stack->items = malloc(stack->capacity * sizeof(struct print_item));
+			memcpy(stack->items, stack->local, sizeof(stack->local));
+		}
+		else
+		{
+			stack->items = realloc(stack->items, stack->capacity * sizeof(struct print_item));
+		}
+	}
+	stack->items[stack->count].node = node;
+	stack->items[stack->count].text = text;
+	stack->count++;
 }
 
 /**
+ * Print the parts of a node: the prefix is written right away, the rest is
+ * pushed in reverse order so that it is printed before what was on the stack
+ *
+ * @param stack the printer stack
+ * @param out the output where the node is printed
+ * @param prefix the text before the first child, may be NULL
+ * @param first the first child, may be NULL
+ * @param infix the text between the children, may be NULL
+ * @param second the second child, may be NULL
+ * @param suffix the text after the children, may be NULL
+ */
+static void print_parts(struct print_stack *stack, struct output *out, const char *prefix, const struct ast_node *first, const char *infix, const struct ast_node *second, const char *suffix)
+{
+	if (prefix != NULL)
+	{
+		output_string(out, prefix);
+	}
+	print_push(stack, NULL, suffix);
+	print_push(stack, second, NULL);
+	print_push(stack, NULL, infix);
+	print_push(stack, first, NULL);
+}
+
+/**
+ * Get the keyword of a simple command with an argument
  *
- * Print recursively the contents of an ast node to stdout
+ * @param cmd the command
  *
- * @param node the ast node to print
+ * @return the keyword followed by a space, NULL if the command has no argument
  */
-void ast_node_print(const struct ast_node *node)
+static const char *print_cmd_keyword(enum ast_cmd cmd)
 {
-	if (node == NULL)
+	switch (cmd)
 	{
-		return;
+	case CMD_POSITION:
+		return "pos ";
+	case CMD_COLOR:
+		return "color ";
+	case CMD_FORWARD:
+		return "fw ";
+	case CMD_BACKWARD:
+		return "bw ";
+	case CMD_RIGHT:
+		return "right ";
+	case CMD_LEFT:
+		return "left ";
+	case CMD_HEADING:
+		return "hd ";
+	case CMD_PRINT:
+		return "print ";
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Get the name of a function
+ *
+ * @param func the function
+ *
+ * @return the name followed by a space
+ */
+static const char *print_func_keyword(enum ast_func func)
+{
+	switch (func)
+	{
+	case FUNC_SQRT:
+		return "sqrt ";
+	case FUNC_SIN:
+		return "sin ";
+	case FUNC_COS:
+		return "cos ";
+	case FUNC_TAN:
+		return "tan ";
+	case FUNC_RANDOM:
+		return "random ";
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Get an operator as it is printed
+ *
+ * @param op the operator
+ *
+ * @return the operator followed by a space, NULL for an unknown operator
+ */
+static const char *print_operator(char op)
+{
+	switch (op)
+	{
+	case '+':
+		return "+ ";
+	case '-':
+		return "- ";
+	case '*':
+		return "* ";
+	case '/':
+		return "/ ";
+	case '^':
+		return "^ ";
+	case ',':
+		return ", ";
+	default:
+		return NULL;
 	}
+}
+
+/**
+ *
+ * Print the contents of an ast node, without the nodes that follow it. The
+ * leaves are written right away, the children are left on the printer stack.
+ *
+ * @param node the ast node to print
+ * @param out the output where the node is printed
+ * @param stack the printer stack
+ */
+static void ast_node_print_one(const struct ast_node *node, struct output *out, struct print_stack *stack)
+{
 
 	if (node->children_count == 0)
 	{
 		switch (node->kind)
 		{
 		case KIND_EXPR_VALUE:
-			fprintf(stdout, "%.2f ", node->u.value);
+		{
+			char buf[512];
+			char *end = output_format_double(buf, node->u.value, 2);
+			*end++ = ' ';
+			output_text(out, buf, end - buf);
+		}
 			break;
 		case KIND_EXPR_NAME:
-			fprintf(stdout, "%s ", node->u.name);
+			output_string(out, node->u.name);
+			output_string(out, " ");
 			break;
 		case KIND_CMD_SIMPLE:
 			switch (node->u.cmd)
 			{
 			case CMD_HOME:
-				fprintf(stdout, "home ");
+				output_string(out, "home ");
 				break;
 			case CMD_UP:
-				fprintf(stdout, "up ");
+				output_string(out, "up ");
 				break;
 			case CMD_DOWN:
-				fprintf(stdout, "down ");
+				output_string(out, "down ");
 				break;
 			default:
 				break;
@@ -1155,193 +1785,123 @@ void ast_node_print(const struct ast_node *node)
 		default:
 			break;
 		}
-		if (node->next != NULL)
-		{
-			fprintf(stdout, "\n");
-		}
-
-		ast_node_print(node->next);
 	}
 
 	else if (node->children_count == 1)
 	{
+		const struct ast_node *child = node->children[0];
+		const char *keyword;
 		switch (node->kind)
 		{
 		case KIND_EXPR_BLOCK:
-			fprintf(stdout, "(");
-			ast_node_print(node->children[0]);
-			fprintf(stdout, ")");
+			print_parts(stack, out, "(", child, NULL, NULL, ")");
 			break;
 		case KIND_CMD_BLOCK:
-			fprintf(stdout, "{\n");
-			ast_node_print(node->children[0]);
-			fprintf(stdout, "\n}");
+			print_parts(stack, out, "{\n", child, NULL, NULL, "\n}");
 			break;
 		case KIND_EXPR_UNOP:
-			fprintf(stdout, "-");
-			ast_node_print(node->children[0]);
+			print_parts(stack, out, "-", child, NULL, NULL, NULL);
 			break;
 		case KIND_CMD_SIMPLE:
-			switch (node->u.cmd)
+			keyword = print_cmd_keyword(node->u.cmd);
+			if (keyword != NULL)
 			{
-			case CMD_POSITION:
-				fprintf(stdout, "pos ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_COLOR:
-				fprintf(stdout, "color ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_FORWARD:
-				fprintf(stdout, "fw ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_BACKWARD:
-				fprintf(stdout, "bw ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_RIGHT:
-				fprintf(stdout, "right ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_LEFT:
-				fprintf(stdout, "left ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_HEADING:
-				fprintf(stdout, "hd ");
-				ast_node_print(node->children[0]);
-				break;
-			case CMD_PRINT:
-				fprintf(stdout, "print ");
-				ast_node_print(node->children[0]);
-				break;
-			default:
-				break;
+				print_parts(stack, out, keyword, child, NULL, NULL, NULL);
 			}
 			break;
 		case KIND_CMD_CALL:
-			fprintf(stdout, "call ");
-			ast_node_print(node->children[0]);
+			print_parts(stack, out, "call ", child, NULL, NULL, NULL);
 			break;
 		case KIND_EXPR_FUNC:
-			switch (node->u.func)
+			keyword = print_func_keyword(node->u.func);
+			if (keyword != NULL)
 			{
-			case FUNC_SQRT:
-				fprintf(stdout, "sqrt ");
-				ast_node_print(node->children[0]);
-				break;
-			case FUNC_SIN:
-				fprintf(stdout, "sin ");
-				ast_node_print(node->children[0]);
-				break;
-			case FUNC_COS:
-				fprintf(stdout, "cos ");
-				ast_node_print(node->children[0]);
-				break;
-			case FUNC_TAN:
-				fprintf(stdout, "tan ");
-				ast_node_print(node->children[0]);
-				break;
-			case FUNC_RANDOM:
-				fprintf(stdout, "random ");
-				ast_node_print(node->children[0]);
-				break;
-			default:
-				break;
+				print_parts(stack, out, keyword, child, NULL, NULL, NULL);
 			}
 			break;
 		default:
 			break;
 		}
 
-		if (node->next != NULL)
-		{
-			fprintf(stdout, "\n");
-		}
-		ast_node_print(node->next);
 	}
 
 	else if (node->children_count == 2)
 	{
-
+		const char *op;
 		switch (node->kind)
 		{
-
 		case KIND_CMD_SET:
-			fprintf(stdout, "set ");
-			ast_node_print(node->children[0]);
-			ast_node_print(node->children[1]);
+			print_parts(stack, out, "set ", node->children[0], NULL, node->children[1], NULL);
 			break;
 		case KIND_CMD_REPEAT:
-			fprintf(stdout, "repeat ");
-			ast_node_print(node->children[0]);
-			ast_node_print(node->children[1]);
+			print_parts(stack, out, "repeat ", node->children[0], NULL, node->children[1], NULL);
 			break;
 		case KIND_CMD_PROC:
-			fprintf(stdout, "proc ");
-			ast_node_print(node->children[0]);
-			ast_node_print(node->children[1]);
+			print_parts(stack, out, "proc ", node->children[0], NULL, node->children[1], NULL);
 			break;
 		case KIND_EXPR_BINOP:
-			switch (node->u.op)
+			op = print_operator(node->u.op);
+			if (op != NULL)
 			{
-			case '+':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, "+ ");
-				ast_node_print(node->children[1]);
-				break;
-			case '-':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, "- ");
-				ast_node_print(node->children[1]);
-				break;
-			case '*':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, "* ");
-				ast_node_print(node->children[1]);
-				break;
-			case '/':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, "/ ");
-				ast_node_print(node->children[1]);
-				break;
-			case '^':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, "^ ");
-				ast_node_print(node->children[1]);
-				break;
-			case ',':
-				ast_node_print(node->children[0]);
-				fprintf(stdout, ", ");
-				ast_node_print(node->children[1]);
-				break;
-			default:
-				break;
+				print_parts(stack, out, NULL, node->children[0], op, node->children[1], NULL);
 			}
 			break;
 		default:
 			break;
 		}
-		if (node->next != NULL)
+	}
+}
+
+/**
+ *
+ * Print the contents of an ast node and of the nodes that follow it, with an
+ * explicit stack so that deep programs do not exhaust the C stack
+ *
+ * @param node the first ast node to print
+ * @param out the output where the nodes are printed
+ */
+void ast_node_print(const struct ast_node *node, struct output *out)
+{
+	struct print_stack stack;
+	stack.items = stack.local;
+	stack.count = 0;
+	stack.capacity = PRINT_STACK_LOCAL;
+
+	print_push(&stack, node, NULL);
+	while (stack.count > 0)
+	{
+		struct print_item item = stack.items[--stack.count];
+		if (item.node == NULL)
+		{
+			output_string(out, item.text);
+			continue;
+		}
+		if (item.node->next != NULL)
 		{
-			fprintf(stdout, "\n");
+			print_push(&stack, item.node->next, NULL);
+			print_push(&stack, NULL, "\n");
 		}
-		ast_node_print(node->next);
+		ast_node_print_one(item.node, out, &stack);
+	}
+
+	if (stack.items != stack.local)
+	{
+		free(stack.items);
 	}
 }
 
 /**
- * Print an abstract syntax tree and its nodes to stdout
+ * Print an abstract syntax tree and its nodes
  *
  * @param self the root node of the abstract syntax tree to print
+ * @param out the output where the tree is printed
  */
-void ast_print(const struct ast *self)
+void ast_print(const struct ast *self, struct output *out)
 {
 	if (self == NULL)
 	{
 		return;
 	}
-	ast_node_print(self->unit);
-	fprintf(stdout, "\n");
+	ast_node_print(self->unit, out);
+	output_string(out, "\n");
 }
\ No newline at end of file
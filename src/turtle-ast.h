@@ -2,9 +2,17 @@
 #ifndef TURTLE_AST_H
 #define TURTLE_AST_H
 
+#include <setjmp.h>
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "turtle-arena.h"
+#include "turtle-random.h"
+
+struct output;
+struct memo;
+struct memo_trace;
+
 // simple commands
 enum ast_cmd
 {
@@ -21,6 +29,8 @@ enum ast_cmd
 	CMD_PRINT,
 };
 
+#define AST_CMD_COUNT (CMD_PRINT + 1)
+
 // internal functions
 enum ast_func
 {
@@ -49,8 +59,35 @@ enum ast_kind
 	KIND_EXPR_NAME,
 };
 
+#define AST_KIND_COUNT (KIND_EXPR_NAME + 1)
+
 #define AST_CHILDREN_MAX 3
 
+// values of the builtin variables
+#define PI 3.14159265358979323846
+#define SQRT2 1.41421356237309504880
+#define SQRT3 1.7320508075688772935
+
+#define SYMBOL_NONE ((size_t)-1)
+
+// the names of a program, each name is interned once and indexed by a hash table
+struct symbol_table
+{
+	struct arena *arena;  // where the names are copied
+	char **names;		 // names[symbol] is the interned name of the symbol
+	size_t *hashes;		 // hashes[symbol] is the hash of its name
+	size_t count;		 // the number of symbols
+	size_t capacity;	 // the allocated size of names and hashes
+	size_t *buckets;	 // open addressing table of symbol + 1, 0 for an empty bucket
+	size_t bucket_count; // a power of two
+};
+
+void symbol_table_create(struct symbol_table *self, struct arena *arena);
+void symbol_table_destroy(struct symbol_table *self);
+size_t symbol_intern(struct symbol_table *self, const char *name);
+size_t symbol_intern_view(struct symbol_table *self, const char *name, size_t size);
+size_t symbol_find(const struct symbol_table *self, const char *name);
+
 // a node in the abstract syntax tree
 struct ast_node
 {
@@ -65,69 +102,128 @@ struct ast_node
 		enum ast_func func; // kind == KIND_EXPR_FUNC, a function
 	} u;
 
-	size_t children_count;						 // the number of children of the node
-	struct ast_node *children[AST_CHILDREN_MAX]; // the children of the node (arguments of commands, etc)
-	struct ast_node *next;						 // the next node in the sequence
+	size_t symbol; // kind == KIND_EXPR_NAME, the index of the name in the symbol table
+
+	struct ast_node *next;		 // the next node in the sequence
+	size_t children_count;		 // the number of children of the node, at most AST_CHILDREN_MAX
+	struct ast_node *children[]; // the children of the node (arguments of commands, etc), allocated with the node
 };
 
+// a sequence of commands being built by the parser
+struct ast_node_list
+{
+	struct ast_node *first; // the first command of the sequence
+	struct ast_node *last;	// the last command, where the next one is appended
+};
+
+// a node with room for its children, zeroed
+struct ast_node *ast_node_alloc(struct arena *arena, size_t children_count);
+
 // Expressions
-struct ast_node *make_expr_value(double value);
-struct ast_node *make_expr_name(char* name);
-struct ast_node *make_expr_parentheses(struct ast_node *expr);
-struct ast_node *make_expr_sqrt(struct ast_node *expr);
-struct ast_node *make_expr_sin(struct ast_node *expr);
-struct ast_node *make_expr_cos(struct ast_node *expr);
-struct ast_node *make_expr_tan(struct ast_node *expr);
-struct ast_node *make_expr_random(struct ast_node *expr);
-struct ast_node *make_expr_virgule(struct ast_node *expr1, struct ast_node *expr2);
+struct ast_node *make_expr_value(struct arena *arena, double value);
+struct ast_node *make_expr_name(struct arena *arena, const struct symbol_table *symbols, size_t symbol);
+struct ast_node *make_expr_parentheses(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_sqrt(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_sin(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_cos(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_tan(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_random(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_expr_virgule(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2);
 
 // Operators
-struct ast_node *make_op_uminus(struct ast_node *node);
-struct ast_node *make_binary_op(struct ast_node *left_node, struct ast_node *right_node, char operator);
+struct ast_node *make_op_uminus(struct arena *arena, struct ast_node *node);
+struct ast_node *make_binary_op(struct arena *arena, struct ast_node *left_node, struct ast_node *right_node, char operator);
 
 // Commandes
-struct ast_node *make_cmd_print(struct ast_node *expr);
-struct ast_node *make_cmd_up();
-struct ast_node *make_cmd_down();
-struct ast_node *make_cmd_forward(struct ast_node *expr);
-struct ast_node *make_cmd_backward(struct ast_node *expr);
-struct ast_node *make_cmd_position(struct ast_node *expr);
-struct ast_node *make_cmd_right(struct ast_node *expr);
-struct ast_node *make_cmd_left(struct ast_node *expr);
-struct ast_node *make_cmd_heading(struct ast_node *expr);
-struct ast_node *make_cmd_color(struct ast_node *expr);
-struct ast_node *make_cmd_home();
-struct ast_node *make_cmd_repeat(struct ast_node *expr1, struct ast_node *expr2);
-struct ast_node *make_cmd_set(struct ast_node *expr1, struct ast_node *expr2);
-struct ast_node *make_block_cmds(struct ast_node *cmds);
-struct ast_node *make_cmd_proc(struct ast_node *expr1, struct ast_node *expr2);
-struct ast_node *make_cmd_call(struct ast_node *expr);
+struct ast_node *make_cmd_print(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_up(struct arena *arena);
+struct ast_node *make_cmd_down(struct arena *arena);
+struct ast_node *make_cmd_forward(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_backward(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_position(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_right(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_left(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_heading(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_color(struct arena *arena, struct ast_node *expr);
+struct ast_node *make_cmd_home(struct arena *arena);
+struct ast_node *make_cmd_repeat(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2);
+struct ast_node *make_cmd_set(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2);
+struct ast_node *make_block_cmds(struct arena *arena, struct ast_node *cmds);
+struct ast_node *make_cmd_proc(struct arena *arena, struct ast_node *expr1, struct ast_node *expr2);
+struct ast_node *make_cmd_call(struct arena *arena, struct ast_node *expr);
+
+struct ast_stream;
+struct scan;
 
 // root of the abstract syntax tree
 struct ast
 {
-	struct ast_node *unit;
+	struct arena arena;			 // where the nodes are allocated, in parse order
+	struct arena names;			 // where the names are copied, they outlive the commands run while parsing
+	struct ast_node *unit;		 // the program as it was parsed
+	struct ast_node *optimized;	 // the program run by the evaluators, NULL if it was not optimized
+	struct symbol_table symbols; // the names used in the program
+	struct ast_stream *stream;	 // when not NULL, the top-level commands are run as soon as they are parsed
+	const char *source;			 // the name of the program in the messages, NULL when it is read on the standard input
+	struct scan *scan;			 // when not NULL, the tokens are read from it instead of the Flex scanner
 };
 
+void ast_create(struct ast *self);
+void ast_error(const struct ast *self, const char *format, ...);
+const struct ast_node *ast_program(const struct ast *self);
+
+// a child of a node, NULL if there is no such child
+const struct ast_node *ast_node_child(const struct ast_node *node, size_t index);
+
+// a copy of a node sharing its children
+struct ast_node *ast_node_copy(struct arena *arena, const struct ast_node *node);
+
 // memory release
-void ast_node_destroy(struct ast_node *self);
 void ast_destroy(struct ast *self);
 
 
 // the variable
 struct variable
 {
-	char* name;
 	double value;
-	struct variable* next;
+	bool defined;
 };
 
 // the procedure
 struct procedure
 {
-	char* name;
-	struct ast_node* nodes;
-	struct procedure* next;
+	const struct ast_node *nodes; // NULL while the procedure is not defined
+	struct memo *memo;			  // what is known of its calls, NULL until it is called
+};
+
+// headings whose direction is kept once computed, the multiples of 90° in [-90 * max, 90 * max]
+#define CONTEXT_QUARTER_TURNS_MAX 1024
+
+// a unit vector giving the direction of the turtle
+struct direction
+{
+	double dx;
+	double dy;
+};
+
+// what the evaluators did, counted only when the statistics are requested
+struct eval_stats
+{
+	size_t kinds[AST_KIND_COUNT]; // nodes evaluated by kind, or the instructions they were compiled to
+	size_t cmds[AST_CMD_COUNT];	  // simple commands run by command
+	size_t lookups;				  // variables and procedures looked up by their symbol
+	size_t replayed;			  // calls replayed from a recorded run
+	size_t generated;			  // loop iterations generated from the first one
+};
+
+// the longest error message kept by a trap
+#define CONTEXT_ERROR_MAX 1024
+
+// where an evaluation run on a thread goes back on an error, instead of exiting
+struct context_trap
+{
+	jmp_buf jump;					 // context_error jumps back here
+	char message[CONTEXT_ERROR_MAX]; // the message of the error
 };
 
 // the execution context
@@ -136,30 +232,75 @@ struct context
 	double x;
 	double y;
 	double angle;
+	struct direction direction;		 // the direction of the angle, updated each time the angle changes
+	struct direction *quarter_turns; // the directions of the multiples of 90°, NaN until computed
 	bool up;
-	struct variable* var_list;
-	struct procedure* proc_list;
+	struct symbol_table *symbols;  // the names of the program
+	struct variable *variables;	   // variables[symbol] is the variable named by the symbol
+	struct procedure *procedures;  // procedures[symbol] is the procedure named by the symbol
+	size_t slot_count;			   // the allocated size of variables and procedures
+	struct output *out;			   // where the primitives are written
+	struct eval_stats *stats;	   // where the work of the evaluators is counted, NULL to count nothing
+	bool memoize;				   // replay the calls of the procedures without side effects
+	bool rigid;					   // replay them rotated from other headings, and generate the rigid loops in closed form
+	struct memo_trace *recording;  // the call being recorded, NULL if none
+	struct context_trap *trap;	   // where the errors go, NULL to exit with the message
+	struct random random;		   // the generator of the random numbers, seeded at every run unless it is seeded again
 };
 
+// slots of the symbols
+void context_reserve(struct context *ctx);
+struct variable *context_variable(struct context *ctx, size_t symbol);
+struct procedure *context_procedure(struct context *ctx, size_t symbol);
+
 //variables management
 void new_variable(char* name, double value, struct context *ctx);
 bool does_variable_exist(char* name, struct context *ctx);
 double find_variable(char* name, struct context *ctx);
 
 //procedures management
-void new_procedure(char *name, struct ast_node *node_child, struct context *ctx);
-struct ast_node* does_procedure_exist(char* name, struct context *ctx);
+void new_procedure(char *name, const struct ast_node *node_child, struct context *ctx);
+const struct ast_node *does_procedure_exist(char* name, struct context *ctx);
 
 // create an initial context
-void context_create(struct context *self);
+void context_create(struct context *self, struct symbol_table *symbols, struct output *out);
 void context_destroy(struct context *self);
 
+// turtle primitives shared by the evaluators
+bool color_from_name(const char *name, double *r, double *g, double *b);
+void context_turn(struct context *ctx, double angle);
+void context_move(struct context *ctx, double distance);
+void context_position(struct context *ctx, double x, double y);
+void context_color(struct context *ctx, double r, double g, double b);
+void context_home(struct context *ctx);
+void context_print(struct context *ctx, const struct ast_node *expr);
+void context_error(struct context *ctx, const char *format, ...);
+
 // print the tree as if it was a Turtle program
-void ast_node_print(const struct ast_node *node);
-void ast_print(const struct ast *self);
+void ast_node_print(const struct ast_node *node, struct output *out);
+void ast_print(const struct ast *self, struct output *out);
 
 // evaluate the tree and generate some basic primitives
 double ast_node_eval(const struct ast_node *node, struct context *ctx);
+void ast_cmds_eval(const struct ast_node *node, struct context *ctx);
 void ast_eval(const struct ast *self, struct context *ctx);
 
+// how often the output of a streamed program is handed to its stream, in nanoseconds
+#define AST_STREAM_FLUSH_NS 50000000LL
+
+// a program run while it is parsed: each top-level command is evaluated as
+// soon as it is reduced, then its nodes are released unless it defines a procedure
+struct ast_stream
+{
+	struct context *ctx;	// where the commands are run
+	struct arena_mark mark; // the start of the next command in the arena of the tree
+	size_t commands;		// the top-level commands run
+	size_t kept;			// the commands kept in memory because they define procedures
+	long long flushed_ns;	// when the output was last flushed
+};
+
+void ast_stream_create(struct ast_stream *self, struct ast *tree, struct context *ctx);
+void ast_stream_command(struct ast *self, struct ast_node *cmd);
+void ast_stream_finish(struct ast_stream *self);
+
 #endif /* TURTLE_AST_H */
\ No newline at end of file
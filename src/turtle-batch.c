@@ -0,0 +1,668 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-batch.h"
+#include "turtle-image.h"
+#include "turtle-optimize.h"
+#include "turtle-scan.h"
+#include "turtle-vm.h"
+// the declarations of the scanner use the types of the parser
+#include "turtle-parser.h"
+#include "turtle-lexer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// no program
+#define BATCH_NONE SIZE_MAX
+
+// the programs dealt to a thread: the thread runs them from the front, the
+// other threads steal them from the back
+struct batch_deque
+{
+	pthread_mutex_t mutex; // protects front and back
+	size_t *jobs;		   // the indices of the programs
+	size_t front;		   // the next program run by the thread
+	size_t back;		   // one past the last program left
+};
+
+// the state of a run of a batch
+struct batch_pool
+{
+	struct batch *batch;
+	const struct batch_settings *settings;
+	struct batch_deque *deques; // deques[thread] are the programs dealt to the thread
+	size_t threads;
+};
+
+// a thread of the pool
+struct batch_worker
+{
+	struct batch_pool *pool;
+	size_t index; // its deque
+	pthread_t thread;
+};
+
+/**
+ * Get the current time
+ *
+ * @return a monotonic time in nanoseconds
+ */
+static long long batch_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Initialize an empty batch
+ *
+ * @param self the batch
+ * @param output_dir where the drawings are written, NULL to write each one next to its program
+ * @param format the format of the drawings, which gives their extension
+ */
+void batch_create(struct batch *self, const char *output_dir, enum output_format format)
+{
+	self->jobs = NULL;
+	self->count = 0;
+	self->capacity = 0;
+	self->output_dir = output_dir;
+	self->extension = format == OUTPUT_TEXT ? BATCH_TEXT_EXTENSION : BATCH_BINARY_EXTENSION;
+	self->threads = 0;
+	self->run_ns = 0;
+}
+
+/**
+ * Free the memory allocated for a batch
+ *
+ * @param self the batch
+ */
+void batch_destroy(struct batch *self)
+{
+	for (size_t i = 0; i < self->count; i++)
+	{
+		free(self->jobs[i].input);
+		free(self->jobs[i].output);
+	}
+	free(self->jobs);
+}
+
+/**
+ * Build the path of the drawing of a program: its name, without the
+ * extension of the programs, followed by the extension of the drawings
+ *
+ * @param self the batch
+ * @param input the path of the program
+ *
+ * @return the path, to free
+ */
+static char *batch_output_path(const struct batch *self, const char *input)
+{
+	const char *output_dir = self->output_dir;
+	const char *extension = self->extension;
+	const char *name = input;
+	size_t dir_size = 0;
+	if (output_dir != NULL)
+	{
+		const char *slash = strrchr(input, '/');
+		name = slash != NULL ? slash + 1 : input;
+		dir_size = strlen(output_dir) + 1;
+	}
+	size_t name_size = strlen(name);
+	size_t source_size = strlen(BATCH_SOURCE_EXTENSION);
+	if (name_size > source_size && strcmp(name + name_size - source_size, BATCH_SOURCE_EXTENSION) == 0)
+	{
+		name_size -= source_size;
+	}
+
+	char *path = malloc(dir_size + name_size + strlen(extension) + 1);
+	char *p = path;
+	if (output_dir != NULL)
+	{
+		p = stpcpy(p, output_dir);
+		*p++ = '/';
+	}
+	memcpy(p, name, name_size);
+	strcpy(p + name_size, extension);
+	return path;
+}
+
+/**
+ * Add a program to a batch
+ *
+ * @param self the batch
+ * @param path the path of the program
+ * @param size its size
+ */
+static void batch_add_job(struct batch *self, const char *path, long long size)
+{
+	if (self->count == self->capacity)
+	{
+		self->capacity = self->capacity == 0 ? 16 : 2 * self->capacity;
+		self->jobs = realloc(self->jobs, self->capacity * sizeof(struct batch_job));
+	}
+	struct batch_job *job = &self->jobs[self->count++];
+	memset(job, 0, sizeof(struct batch_job));
+	job->input = strdup(path);
+	job->output = batch_output_path(self, path);
+	job->size = size;
+}
+
+/**
+ * Compare two names, to sort the programs of a directory
+ *
+ * @param a a pointer on the first name
+ * @param b a pointer on the second name
+ *
+ * @return the order of the names
+ */
+static int batch_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Add the programs of a directory to a batch, in the order of their names
+ *
+ * @param self the batch
+ * @param path the path of the directory
+ *
+ * @return false if the directory cannot be read
+ */
+static bool batch_add_directory(struct batch *self, const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+	{
+		return false;
+	}
+
+	char **names = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	size_t extension_size = strlen(BATCH_SOURCE_EXTENSION);
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		size_t size = strlen(entry->d_name);
+		if (size <= extension_size || strcmp(entry->d_name + size - extension_size, BATCH_SOURCE_EXTENSION) != 0)
+		{
+			continue;
+		}
+		if (count == capacity)
+		{
+			capacity = capacity == 0 ? 16 : 2 * capacity;
+			names = realloc(names, capacity * sizeof(char *));
+		}
+		names[count++] = strdup(entry->d_name);
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(char *), batch_compare_names);
+	for (size_t i = 0; i < count; i++)
+	{
+		char *file = malloc(strlen(path) + strlen(names[i]) + 2);
+		sprintf(file, "%s/%s", path, names[i]);
+		struct stat info;
+		if (stat(file, &info) == 0 && S_ISREG(info.st_mode))
+		{
+			batch_add_job(self, file, info.st_size);
+		}
+		free(file);
+		free(names[i]);
+	}
+	free(names);
+	return true;
+}
+
+/**
+ * Add a program to a batch, or all the programs of a directory
+ *
+ * @param self the batch
+ * @param path the path of the program or of the directory
+ *
+ * @return false if there is no such file or directory
+ */
+bool batch_add(struct batch *self, const char *path)
+{
+	struct stat info;
+	if (stat(path, &info) != 0)
+	{
+		return false;
+	}
+	if (S_ISDIR(info.st_mode))
+	{
+		return batch_add_directory(self, path);
+	}
+	batch_add_job(self, path, info.st_size);
+	return true;
+}
+
+/**
+ * Record why a program failed
+ *
+ * @param job the program
+ * @param status how it ended
+ * @param format the format of the message, as for printf
+ */
+static void batch_fail(struct batch_job *job, enum batch_status status, const char *format, ...)
+{
+	job->status = status;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(job->message, CONTEXT_ERROR_MAX, format, args);
+	va_end(args);
+}
+
+/**
+ * Record that a file of a program cannot be used
+ *
+ * @param job the program
+ * @param action what cannot be done
+ * @param path the file
+ * @param error the error number
+ */
+static void batch_fail_io(struct batch_job *job, const char *action, const char *path, int error)
+{
+	char reason[256];
+	if (strerror_r(error, reason, sizeof(reason)) != 0)
+	{
+		snprintf(reason, sizeof(reason), "error %d", error);
+	}
+	batch_fail(job, BATCH_IO, "cannot %s %s: %s", action, path, reason);
+	fprintf(stderr, "%s\n", job->message);
+}
+
+/**
+ * Parse, optimize and run a program. The errors jump back here through the
+ * trap of the context, so the state of the run is owned by the caller
+ *
+ * @param job the program
+ * @param settings how it is run
+ * @param root its tree
+ * @param ctx its context, with a trap
+ * @param scanner the scanner reading it
+ * @param stream the state of the run when the program is streamed
+ * @param image the image of the program in the cache, NULL without cache
+ * @param key the key of its source
+ */
+static void batch_eval(struct batch_job *job, const struct batch_settings *settings, struct ast *root, struct context *ctx, yyscan_t scanner,
+					   struct ast_stream *stream, const char *image, const struct image_key *key)
+{
+	if (setjmp(ctx->trap->jump) != 0)
+	{
+		// keep the message on a single line
+		size_t size = strlen(ctx->trap->message);
+		while (size > 0 && ctx->trap->message[size - 1] == '\n')
+		{
+			ctx->trap->message[--size] = '\0';
+		}
+		batch_fail(job, BATCH_FAILED, "%s", ctx->trap->message);
+		return;
+	}
+
+	// a streamed program is run during this phase
+	long long start = batch_now();
+	job->loaded = image != NULL && image_load(root, image, key, settings->optimize);
+	int ret = job->loaded ? 0 : yyparse(root, scanner);
+	job->parse_ns = batch_now() - start;
+	if (ret != 0)
+	{
+		job->status = BATCH_SYNTAX;
+		return;
+	}
+
+	start = batch_now();
+	if (settings->optimize && !job->loaded)
+	{
+		struct optimize_stats optimized;
+		ast_optimize(root, &optimized);
+	}
+	// a program whose image cannot be saved is parsed again by the next batch
+	if (image != NULL && !job->loaded)
+	{
+		image_save(root, image, key);
+	}
+	job->optimize_ns = batch_now() - start;
+
+	start = batch_now();
+	if (settings->stream)
+	{
+		ast_stream_finish(stream);
+	}
+	else if (settings->tree_walk)
+	{
+		ast_eval(root, ctx);
+	}
+	else
+	{
+		vm_eval(root, ctx);
+	}
+	job->eval_ns = batch_now() - start;
+}
+
+/**
+ * Run a program of a batch and write its drawing
+ *
+ * @param job the program
+ * @param settings how it is run
+ */
+static void batch_run_job(struct batch_job *job, const struct batch_settings *settings)
+{
+	// the program is read where it is mapped, or by Flex from a stream
+	struct scan scan;
+	FILE *input = NULL;
+	bool opened = settings->flex ? (input = fopen(job->input, "r")) != NULL : scan_map(&scan, job->input);
+	if (!opened)
+	{
+		batch_fail_io(job, "read", job->input, errno);
+		return;
+	}
+	FILE *drawing = fopen(job->output, "w");
+	if (drawing == NULL)
+	{
+		batch_fail_io(job, "write", job->output, errno);
+		if (input != NULL)
+		{
+			fclose(input);
+		}
+		else
+		{
+			scan_destroy(&scan);
+		}
+		return;
+	}
+
+	struct ast root;
+	ast_create(&root);
+	root.source = job->input;
+	if (input == NULL)
+	{
+		root.scan = &scan;
+	}
+
+	struct output out;
+	output_create(&out, drawing, settings->format, settings->precision);
+	if (settings->simplify >= 0)
+	{
+		output_simplify(&out, settings->simplify);
+	}
+
+	struct context_trap trap;
+	struct context ctx;
+	context_create(&ctx, &root.symbols, &out);
+	ctx.memoize = settings->memoize;
+	ctx.rigid = settings->rigid;
+	ctx.trap = &trap;
+	ctx.random = job->random;
+
+	struct ast_stream stream;
+	if (settings->stream)
+	{
+		ast_stream_create(&stream, &root, &ctx);
+	}
+
+	// the images are keyed by the sources mapped in memory
+	struct image_key key;
+	char image[PATH_MAX];
+	bool cached = false;
+	if (settings->cache_dir != NULL && input == NULL)
+	{
+		image_key(&key, scan.text, scan.end - scan.text);
+		cached = image_path(image, sizeof(image), settings->cache_dir, &key);
+	}
+
+	yyscan_t scanner;
+	yylex_init(&scanner);
+	if (input != NULL)
+	{
+		yyset_in(input, scanner);
+	}
+	batch_eval(job, settings, &root, &ctx, scanner, &stream, cached ? image : NULL, &key);
+	yylex_destroy(scanner);
+	if (input != NULL)
+	{
+		fclose(input);
+	}
+	else
+	{
+		scan_destroy(&scan);
+	}
+
+	// the drawing of a program that stopped on an error is kept up to the error, as on the standard output
+	if (job->status == BATCH_FAILED)
+	{
+		output_abort(&out);
+	}
+	else
+	{
+		output_destroy(&out);
+	}
+	job->write_ns = out.write_ns;
+	job->primitives = out.primitives;
+	job->bytes = out.written;
+	if (fclose(drawing) != 0 && job->status == BATCH_DONE)
+	{
+		batch_fail_io(job, "write", job->output, errno);
+	}
+
+	if (job->status == BATCH_FAILED)
+	{
+		ast_error(&root, "%s", job->message);
+	}
+	ast_destroy(&root);
+	context_destroy(&ctx);
+}
+
+/**
+ * Take the next program of a thread, or steal one from another thread
+ *
+ * @param pool the state of the run
+ * @param index the deque of the thread
+ * @param stolen set to true if the program was stolen
+ *
+ * @return the index of the program, BATCH_NONE when there is none left
+ */
+static size_t batch_next(struct batch_pool *pool, size_t index, bool *stolen)
+{
+	struct batch_deque *own = &pool->deques[index];
+	pthread_mutex_lock(&own->mutex);
+	size_t job = own->front < own->back ? own->jobs[own->front++] : BATCH_NONE;
+	pthread_mutex_unlock(&own->mutex);
+	*stolen = false;
+
+	// no program is ever added, so a thread that finds all the deques empty is done
+	for (size_t i = 1; job == BATCH_NONE && i < pool->threads; i++)
+	{
+		struct batch_deque *victim = &pool->deques[(index + i) % pool->threads];
+		pthread_mutex_lock(&victim->mutex);
+		if (victim->front < victim->back)
+		{
+			job = victim->jobs[--victim->back];
+			*stolen = true;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+	}
+	return job;
+}
+
+/**
+ * Run programs until there is none left
+ *
+ * @param arg the thread
+ *
+ * @return nothing
+ */
+static void *batch_worker(void *arg)
+{
+	struct batch_worker *self = arg;
+	struct batch_pool *pool = self->pool;
+	bool stolen;
+	size_t index;
+	while ((index = batch_next(pool, self->index, &stolen)) != BATCH_NONE)
+	{
+		struct batch_job *job = &pool->batch->jobs[index];
+		job->thread = self->index;
+		job->stolen = stolen;
+		batch_run_job(job, pool->settings);
+	}
+	return NULL;
+}
+
+/**
+ * Compare the sizes of two programs, to run the largest ones first
+ *
+ * @param a a pointer on the first program
+ * @param b a pointer on the second program
+ *
+ * @return the order of the programs
+ */
+static int batch_compare_sizes(const void *a, const void *b)
+{
+	const struct batch_job *x = *(struct batch_job *const *)a;
+	const struct batch_job *y = *(struct batch_job *const *)b;
+	if (x->size != y->size)
+	{
+		return x->size > y->size ? -1 : 1;
+	}
+	// keep the order of the batch between programs of the same size
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Run the programs of a batch on a pool of threads
+ *
+ * @param self the batch
+ * @param settings how the programs are run
+ * @param threads the number of threads, the calling thread included
+ *
+ * @return the exit status of the process: 0 when every program ran to its
+ * end, 1 when a program does not parse or a file cannot be used, 2 when a
+ * program stopped on an error
+ */
+int batch_run(struct batch *self, const struct batch_settings *settings, size_t threads)
+{
+	long long start = batch_now();
+	if (threads > self->count)
+	{
+		threads = self->count > 0 ? self->count : 1;
+	}
+	self->threads = threads;
+
+	// deal the programs in turn, from the largest one
+	struct batch_job **sorted = malloc(self->count * sizeof(struct batch_job *));
+	for (size_t i = 0; i < self->count; i++)
+	{
+		sorted[i] = &self->jobs[i];
+	}
+	qsort(sorted, self->count, sizeof(struct batch_job *), batch_compare_sizes);
+
+	// the streams are split in the order of the programs, so that a seed gives the same drawings on any number of threads
+	struct random seeds;
+	random_seed(&seeds, settings->seed);
+	for (size_t i = 0; i < self->count; i++)
+	{
+		random_split(&seeds, &self->jobs[i].random);
+	}
+
+	struct batch_pool pool = {self, settings, malloc(threads * sizeof(struct batch_deque)), threads};
+	for (size_t t = 0; t < threads; t++)
+	{
+		struct batch_deque *deque = &pool.deques[t];
+		pthread_mutex_init(&deque->mutex, NULL);
+		deque->jobs = malloc((self->count / threads + 1) * sizeof(size_t));
+		deque->front = 0;
+		deque->back = 0;
+	}
+	for (size_t i = 0; i < self->count; i++)
+	{
+		struct batch_deque *deque = &pool.deques[i % threads];
+		deque->jobs[deque->back++] = sorted[i] - self->jobs;
+	}
+	free(sorted);
+
+	// the calling thread is the first thread of the pool
+	struct batch_worker *workers = malloc(threads * sizeof(struct batch_worker));
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers[t].pool = &pool;
+		workers[t].index = t;
+		if (t > 0)
+		{
+			pthread_create(&workers[t].thread, NULL, batch_worker, &workers[t]);
+		}
+	}
+	batch_worker(&workers[0]);
+	for (size_t t = 1; t < threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+	}
+	free(workers);
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		pthread_mutex_destroy(&pool.deques[t].mutex);
+		free(pool.deques[t].jobs);
+	}
+	free(pool.deques);
+	self->run_ns = batch_now() - start;
+
+	int status = 0;
+	for (size_t i = 0; i < self->count; i++)
+	{
+		int job_status = self->jobs[i].status == BATCH_FAILED ? 2 : self->jobs[i].status != BATCH_DONE ? 1 : 0;
+		if (job_status > status)
+		{
+			status = job_status;
+		}
+	}
+	return status;
+}
+
+/**
+ * Print what the run of each program did, in the order of the batch, then a summary
+ *
+ * @param self the batch, once run
+ * @param stream where the report is printed
+ */
+void batch_report(const struct batch *self, FILE *stream)
+{
+	size_t failed = 0;
+	size_t stolen = 0;
+	size_t loaded = 0;
+	for (size_t i = 0; i < self->count; i++)
+	{
+		const struct batch_job *job = &self->jobs[i];
+		stolen += job->stolen;
+		char thread[64];
+		loaded += job->loaded;
+		snprintf(thread, sizeof(thread), "thread %zu%s%s", job->thread, job->stolen ? ", stolen" : "", job->loaded ? ", image" : "");
+		switch (job->status)
+		{
+		case BATCH_DONE:
+			fprintf(stream, "%s -> %s (%s): parse %.3f ms, optimize %.3f ms, eval %.3f ms (write %.3f ms), %zu primitives, %zu bytes\n",
+					job->input, job->output, thread, job->parse_ns / 1e6, job->optimize_ns / 1e6, job->eval_ns / 1e6, job->write_ns / 1e6,
+					job->primitives, job->bytes);
+			break;
+		case BATCH_SYNTAX:
+			failed++;
+			fprintf(stream, "%s (%s): syntax error\n", job->input, thread);
+			break;
+		case BATCH_FAILED:
+		case BATCH_IO:
+			failed++;
+			fprintf(stream, "%s (%s): %s\n", job->input, thread, job->message);
+			break;
+		}
+	}
+	fprintf(stream, "batch: %zu programs, %zu failed, %zu loaded from their images, %.3f ms on %zu threads, %zu stolen\n",
+			self->count, failed, loaded, self->run_ns / 1e6, self->threads, stolen);
+}
@@ -0,0 +1,102 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_BATCH_H
+#define TURTLE_BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-ast.h"
+#include "turtle-output.h"
+
+/*
+ * Batch mode
+ *
+ * Many programs are run by a single process: each one is read from its file
+ * and its drawing is written to another file. Each program is mapped in
+ * memory and has its own scanner, tree, arena, context and output, so that
+ * several programs are parsed and run at the same time by a pool of threads.
+ *
+ * The programs are sorted by decreasing size and dealt in turn to the
+ * threads. Each thread runs its own programs from the largest one. A thread
+ * left without programs steals the smallest program left to another thread,
+ * so that the threads finish at about the same time even when the sizes do
+ * not reflect the work.
+ */
+
+// the extension of the programs found in a directory, replaced by the one of the drawing
+#define BATCH_SOURCE_EXTENSION ".turtle"
+#define BATCH_TEXT_EXTENSION ".txt"
+#define BATCH_BINARY_EXTENSION ".trt"
+
+// how the programs are run, given by the command line
+struct batch_settings
+{
+	enum output_format format; // how the primitives are encoded
+	int precision;			   // number of decimals of the numbers, for the text format
+	double simplify;		   // how far the simplified lines may stray, negative to write the primitives as they come
+	bool tree_walk;			   // evaluate with the tree walker instead of the virtual machine
+	bool optimize;			   // run the optimized programs instead of the parsed ones
+	bool memoize;			   // replay the calls of the procedures without side effects
+	bool rigid;				   // replay the calls rotated from any heading, and generate the rigid loops in closed form
+	bool stream;			   // run each top-level command as soon as it is parsed, with the tree walker
+	bool flex;				   // read the programs with the Flex scanner instead of mapping them
+	const char *cache_dir;	   // where the images of the parsed programs are kept, NULL to parse every program
+	uint64_t seed;			   // the seed of the random numbers, split into a stream per program
+};
+
+// how a program ended
+enum batch_status
+{
+	BATCH_DONE,	  // it ran to its end
+	BATCH_SYNTAX, // it does not parse
+	BATCH_FAILED, // it stopped on an error
+	BATCH_IO,	  // its file could not be read, or its drawing written
+};
+
+// a program of a batch and what its run did
+struct batch_job
+{
+	char *input;					 // the path of the program
+	char *output;					 // the path of its drawing
+	long long size;					 // the size of the program, in bytes
+	enum batch_status status;		 // how it ended
+	char message[CONTEXT_ERROR_MAX]; // why it failed, empty for a syntax error whose message was printed by the parser
+	size_t thread;					 // the thread that ran it
+	bool stolen;					 // it was run by another thread than the one it was dealt to
+	bool loaded;					 // it was loaded from its image in the cache instead of being parsed
+	struct random random;			 // the stream of its random numbers, the same whatever the thread that runs it
+	long long parse_ns;				 // time spent parsing or loading the image, and running a streamed program
+	long long optimize_ns;			 // time spent in the optimizer
+	long long eval_ns;				 // time spent running the program, writes included
+	long long write_ns;				 // time spent writing the drawing
+	size_t primitives;				 // moves and colors written
+	size_t bytes;					 // bytes written
+};
+
+// the programs of a batch
+struct batch
+{
+	struct batch_job *jobs;
+	size_t count;
+	size_t capacity;
+	const char *output_dir; // where the drawings are written, NULL to write each one next to its program
+	const char *extension;	// the extension of the drawings
+	size_t threads;			// the threads that ran the programs
+	long long run_ns;		// the wall time of the run
+};
+
+void batch_create(struct batch *self, const char *output_dir, enum output_format format);
+void batch_destroy(struct batch *self);
+
+// add a program, or the programs of a directory
+bool batch_add(struct batch *self, const char *path);
+
+// run the programs on a pool of threads, returns the exit status of the process
+int batch_run(struct batch *self, const struct batch_settings *settings, size_t threads);
+
+// print a line per program and a summary
+void batch_report(const struct batch *self, FILE *stream);
+
+#endif /* TURTLE_BATCH_H */
@@ -0,0 +1,788 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "turtle-ast.h"
+#include "turtle-optimize.h"
+#include "turtle-output.h"
+#include "turtle-random.h"
+#include "turtle-scan.h"
+#include "turtle-transform.h"
+#include "turtle-vm.h"
+// the declarations of the scanner use the types of the parser
+#include "turtle-parser.h"
+#include "turtle-lexer.h"
+
+/*
+ * Benchmark of the interpreter on generated programs
+ *
+ * Each case generates a program, then times its phases one after the other:
+ *   - parse: lexer and parser, up to the tree;
+ *   - optimize: the constant folding;
+ *   - compile: the translation of the tree into bytecode;
+ *   - eval: the virtual machine, the primitives are kept in memory in the binary64 format;
+ *   - output: the same primitives written as text to /dev/null.
+ * Every case runs in its own process, so that its peak memory is its own.
+ * The results are printed on stdout as one JSON object per line.
+ *
+ * With --transform, the kernels placing the replayed runs in the world are
+ * timed instead, against a turn then a move for each point as the commands
+ * right and forward do.
+ *
+ * With --lexer, the program of each case is only split into tokens, once by
+ * the Flex scanner reading it from a stream and once by the hand-written
+ * scanner reading it in place, and both must give the same tokens.
+ *
+ * With --random, the generator of the random numbers is timed against
+ * rand() reduced modulo the size of the range, on ranges like the ones of
+ * the programs, and the bias of the modulo is measured on a wide range.
+ */
+
+#define BENCH_SCALE_DEFAULT 1000000
+
+// allocations made by the interpreter, counted by wrapping the allocator at link time
+static size_t bench_allocations = 0;
+static size_t bench_allocated_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	bench_allocations++;
+	bench_allocated_bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	bench_allocations++;
+	bench_allocated_bytes += count * size;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	bench_allocations++;
+	bench_allocated_bytes += size;
+	return __real_realloc(ptr, size);
+}
+
+// a generator of a program of a given size
+struct bench_case
+{
+	const char *name;
+	void (*generate)(FILE *out, long scale);
+};
+
+/**
+ * Generate repeats nested as deep as possible, that move scale times in total
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_nested(FILE *out, long scale)
+{
+	int depth = 0;
+	for (long n = scale; n >= 10; n /= 10)
+	{
+		depth++;
+	}
+	for (int i = 0; i < depth; i++)
+	{
+		fprintf(out, "repeat 10 {\n");
+	}
+	fprintf(out, "fw 1 right 7\n");
+	for (int i = 0; i < depth; i++)
+	{
+		fprintf(out, "}\n");
+	}
+}
+
+/**
+ * Generate a long list of commands without any loop
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_flat(FILE *out, long scale)
+{
+	for (long i = 0; i < scale; i++)
+	{
+		fprintf(out, "fw %ld\nright 7\n", i % 10 + 1);
+	}
+}
+
+/**
+ * Generate many variables and procedures, each procedure is called once
+ *
+ * @param out where the program is written
+ * @param scale the number of definitions
+ */
+static void generate_defs(FILE *out, long scale)
+{
+	for (long i = 0; i < scale / 2; i++)
+	{
+		fprintf(out, "set V%ld %ld\nproc P%ld { fw V%ld right 7 }\n", i, i % 10, i, i);
+	}
+	for (long i = 0; i < scale / 2; i++)
+	{
+		fprintf(out, "call P%ld\n", i);
+	}
+}
+
+/**
+ * Generate a loop computing expressions that cannot be folded
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_arith(FILE *out, long scale)
+{
+	fprintf(out, "set X random (1, 1)\nset Y random (2, 2)\n");
+	fprintf(out, "repeat %ld {\n", scale);
+	fprintf(out, "fw (X + Y * 3 - X / Y) ^ 2 / (Y ^ 3 + sqrt(X * 16)) + sin(X) * cos(Y)\n");
+	fprintf(out, "right tan(X / 4) * 10 - -Y\n");
+	fprintf(out, "}\n");
+}
+
+/**
+ * Generate a long list of moves written with every form of number
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_literals(FILE *out, long scale)
+{
+	for (long i = 0; i < scale / 5; i++)
+	{
+		fprintf(out, "fw %ld right %ld.%03ld\n", i, i % 360, i % 1000);
+		fprintf(out, "fw .%ld left %lde-1 fw %ld.5E+2\n", i % 100, i % 10, i % 10);
+	}
+}
+
+/**
+ * Generate a loop drawing random moves, turns and colors
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_random(FILE *out, long scale)
+{
+	fprintf(out, "repeat %ld {\n", scale);
+	fprintf(out, "color random(0, 1), random(0, 1), random(0, 1)\n");
+	fprintf(out, "fw random(1, 20) right random(0, 359)\n");
+	fprintf(out, "}\n");
+}
+
+/**
+ * Generate a loop switching the color at every move
+ *
+ * @param out where the program is written
+ * @param scale the number of moves
+ */
+static void generate_colors(FILE *out, long scale)
+{
+	fprintf(out, "repeat %ld {\n", scale / 2);
+	fprintf(out, "color red fw 1 right 7\n");
+	fprintf(out, "color 0.5, 0.25, 1 fw 1 right 7\n");
+	fprintf(out, "}\n");
+}
+
+static const struct bench_case bench_cases[] = {
+	{"nested", generate_nested},
+	{"flat", generate_flat},
+	{"defs", generate_defs},
+	{"arith", generate_arith},
+	{"colors", generate_colors},
+	{"literals", generate_literals},
+	{"random", generate_random},
+};
+
+#define BENCH_CASE_COUNT (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+/**
+ * Read a monotonic clock
+ *
+ * @return the time in nanoseconds
+ */
+static int64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Read a little endian 64 bits float
+ *
+ * @param p the bytes of the number
+ *
+ * @return the number
+ */
+static double bench_read_double(const unsigned char *p)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		bits |= (uint64_t)p[i] << (8 * i);
+	}
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/**
+ * Write the primitives of a binary64 stream again through a text output
+ *
+ * @param data the binary stream
+ * @param size the size of the stream
+ * @param out the text output
+ *
+ * @return the number of primitives
+ */
+static size_t bench_replay(const unsigned char *data, size_t size, struct output *out)
+{
+	size_t primitives = 0;
+	const unsigned char *p = data + OUTPUT_HEADER_SIZE;
+	const unsigned char *end = data + size;
+	while (p < end && *p != OUTPUT_RECORD_END)
+	{
+		switch (*p++)
+		{
+		case OUTPUT_RECORD_COLOR:
+			output_color(out, bench_read_double(p), bench_read_double(p + 8), bench_read_double(p + 16));
+			p += 24;
+			primitives++;
+			break;
+		case OUTPUT_RECORD_MOVE_TO:
+			output_move_to(out, bench_read_double(p), bench_read_double(p + 8));
+			p += 16;
+			primitives++;
+			break;
+		case OUTPUT_RECORD_LINE_TO:
+			output_line_to(out, bench_read_double(p), bench_read_double(p + 8));
+			p += 16;
+			primitives++;
+			break;
+		case OUTPUT_RECORD_TEXT:
+		{
+			uint32_t length = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+			output_text(out, (const char *)p + 4, length);
+			p += 4 + length;
+		}
+		break;
+		default:
+			return primitives;
+		}
+	}
+	return primitives;
+}
+
+/**
+ * Generate and run one case, then print its results
+ *
+ * @param bench the case
+ * @param scale the size of the program
+ */
+static void bench_run(const struct bench_case *bench, long scale)
+{
+	char *source = NULL;
+	size_t source_size = 0;
+	FILE *program = open_memstream(&source, &source_size);
+	bench->generate(program, scale);
+	fclose(program);
+
+	size_t allocations_before = bench_allocations;
+	size_t allocated_before = bench_allocated_bytes;
+
+	// parse
+	int64_t start = bench_now();
+	FILE *input = fmemopen(source, source_size, "r");
+	yyscan_t scanner;
+	yylex_init(&scanner);
+	yyset_in(input, scanner);
+	struct ast root;
+	ast_create(&root);
+	if (yyparse(&root, scanner) != 0)
+	{
+		fprintf(stderr, "%s: the generated program does not parse\n", bench->name);
+		exit(1);
+	}
+	yylex_destroy(scanner);
+	fclose(input);
+	int64_t parse_ns = bench_now() - start;
+
+	// optimize
+	start = bench_now();
+	struct optimize_stats optimized;
+	ast_optimize(&root, &optimized);
+	int64_t optimize_ns = bench_now() - start;
+
+	// compile
+	start = bench_now();
+	struct vm_program code;
+	vm_program_compile(&code, &root);
+	int64_t compile_ns = bench_now() - start;
+
+	// eval, the primitives are kept in memory
+	char *primitives = NULL;
+	size_t primitives_size = 0;
+	FILE *memory = open_memstream(&primitives, &primitives_size);
+	struct output binary;
+	output_create(&binary, memory, OUTPUT_BINARY64, OUTPUT_PRECISION_DEFAULT);
+	struct context ctx;
+	context_create(&ctx, &root.symbols, &binary);
+
+	start = bench_now();
+	struct vm vm;
+	vm_create(&vm, &code, &ctx);
+	vm_run(&vm, &ctx);
+	vm_destroy(&vm);
+	output_destroy(&binary);
+	fclose(memory);
+	int64_t eval_ns = bench_now() - start;
+
+	// output
+	FILE *null = fopen("/dev/null", "w");
+	struct output text;
+	output_create(&text, null, OUTPUT_TEXT, OUTPUT_PRECISION_DEFAULT);
+	start = bench_now();
+	size_t primitive_count = bench_replay((const unsigned char *)primitives, primitives_size, &text);
+	output_destroy(&text);
+	fflush(null);
+	int64_t output_ns = bench_now() - start;
+	size_t text_size = text.written;
+	fclose(null);
+
+	size_t allocations = bench_allocations - allocations_before;
+	size_t allocated_bytes = bench_allocated_bytes - allocated_before;
+	size_t tree_bytes = root.arena.allocated + root.names.allocated;
+
+	context_destroy(&ctx);
+	vm_program_destroy(&code);
+	ast_destroy(&root);
+	free(primitives);
+	free(source);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double eval_s = eval_ns / 1e9;
+	printf("{\"case\":\"%s\",\"scale\":%ld,\"source_bytes\":%zu,"
+		   "\"parse_ns\":%lld,\"optimize_ns\":%lld,\"compile_ns\":%lld,\"eval_ns\":%lld,\"output_ns\":%lld,"
+		   "\"primitives\":%zu,\"primitives_per_sec\":%.0f,\"bytecode_size\":%zu,\"output_bytes\":%zu,"
+		   "\"tree_bytes\":%zu,\"allocations\":%zu,\"allocated_bytes\":%zu,\"peak_rss_kb\":%ld}\n",
+		   bench->name, scale, source_size,
+		   (long long)parse_ns, (long long)optimize_ns, (long long)compile_ns, (long long)eval_ns, (long long)output_ns,
+		   primitive_count, eval_s > 0 ? primitive_count / eval_s : 0.0, code.code_count, text_size,
+		   tree_bytes, allocations, allocated_bytes, usage.ru_maxrss);
+	fflush(stdout);
+}
+
+/**
+ * Split a program into tokens with the Flex scanner
+ *
+ * @param source the program
+ * @param size its size
+ *
+ * @return the number of tokens
+ */
+static size_t bench_flex_tokens(char *source, size_t size)
+{
+	struct ast root;
+	ast_create(&root);
+	FILE *input = fmemopen(source, size, "r");
+	yyscan_t scanner;
+	yylex_init(&scanner);
+	yyset_in(input, scanner);
+	YYSTYPE value;
+	size_t count = 0;
+	while (lexer_next(&value, &root, scanner) > 0)
+	{
+		count++;
+	}
+	yylex_destroy(scanner);
+	fclose(input);
+	ast_destroy(&root);
+	return count;
+}
+
+/**
+ * Split a program into tokens with the hand-written scanner
+ *
+ * @param source the program
+ * @param size its size
+ *
+ * @return the number of tokens
+ */
+static size_t bench_scan_tokens(const char *source, size_t size)
+{
+	struct ast root;
+	ast_create(&root);
+	struct scan scan;
+	scan_create(&scan, source, size);
+	YYSTYPE value;
+	size_t count = 0;
+	while (scan_next(&scan, &value, &root) > 0)
+	{
+		count++;
+	}
+	scan_destroy(&scan);
+	ast_destroy(&root);
+	return count;
+}
+
+/**
+ * Check that both scanners give the same tokens, the same numbers to the bit
+ * and the same names
+ *
+ * @param source the program
+ * @param size its size
+ *
+ * @return true if the tokens are the same
+ */
+static bool bench_same_tokens(char *source, size_t size)
+{
+	struct ast flex_root;
+	ast_create(&flex_root);
+	FILE *input = fmemopen(source, size, "r");
+	yyscan_t scanner;
+	yylex_init(&scanner);
+	yyset_in(input, scanner);
+
+	struct ast scan_root;
+	ast_create(&scan_root);
+	struct scan scan;
+	scan_create(&scan, source, size);
+
+	bool same = true;
+	int token;
+	do
+	{
+		YYSTYPE flex_value;
+		YYSTYPE scan_value;
+		token = lexer_next(&flex_value, &flex_root, scanner);
+		same = scan_next(&scan, &scan_value, &scan_root) == token;
+		if (same && token == VALUE)
+		{
+			same = memcmp(&flex_value.value, &scan_value.value, sizeof(double)) == 0;
+		}
+		else if (same && token == NAME)
+		{
+			// both tables intern the names in the same order
+			same = flex_value.symbol == scan_value.symbol;
+		}
+	} while (same && token > 0);
+
+	scan_destroy(&scan);
+	ast_destroy(&scan_root);
+	yylex_destroy(scanner);
+	fclose(input);
+	ast_destroy(&flex_root);
+	return same;
+}
+
+/**
+ * Generate the program of one case, split it into tokens with both scanners
+ * and print their times
+ *
+ * @param bench the case
+ * @param scale the size of the program
+ */
+static void bench_lexer(const struct bench_case *bench, long scale)
+{
+	char *source = NULL;
+	size_t source_size = 0;
+	FILE *program = open_memstream(&source, &source_size);
+	bench->generate(program, scale);
+	fclose(program);
+
+	if (!bench_same_tokens(source, source_size))
+	{
+		fprintf(stderr, "%s: the scanners do not give the same tokens\n", bench->name);
+		exit(1);
+	}
+
+	int64_t start = bench_now();
+	size_t tokens = bench_flex_tokens(source, source_size);
+	int64_t flex_ns = bench_now() - start;
+
+	start = bench_now();
+	bench_scan_tokens(source, source_size);
+	int64_t scan_ns = bench_now() - start;
+
+	printf("{\"case\":\"%s\",\"scale\":%ld,\"source_bytes\":%zu,\"tokens\":%zu,"
+		   "\"flex_ns\":%lld,\"scan_ns\":%lld,\"flex_mb_per_sec\":%.1f,\"scan_mb_per_sec\":%.1f}\n",
+		   bench->name, scale, source_size, tokens, (long long)flex_ns, (long long)scan_ns,
+		   flex_ns > 0 ? source_size * 1e3 / flex_ns : 0.0, scan_ns > 0 ? source_size * 1e3 / scan_ns : 0.0);
+	fflush(stdout);
+	free(source);
+}
+
+/**
+ * Time the placement of the points of a circle, one turn and one move at a
+ * time as the commands do, then rotated and translated as a block by each
+ * kernel supported by the processor, and print the results
+ *
+ * @param scale the number of points
+ */
+static void bench_transform(long scale)
+{
+	size_t count = scale;
+	double *pxs = malloc(count * sizeof(double));
+	double *pys = malloc(count * sizeof(double));
+	double *xs = malloc(count * sizeof(double));
+	double *ys = malloc(count * sizeof(double));
+	double *ref_xs = malloc(count * sizeof(double));
+	double *ref_ys = malloc(count * sizeof(double));
+
+	// the commands: right 0.1 then forward 1, for each point
+	struct ast root;
+	ast_create(&root);
+	FILE *null = fopen("/dev/null", "w");
+	struct output out;
+	output_create(&out, null, OUTPUT_BINARY64, OUTPUT_PRECISION_DEFAULT);
+	struct context ctx;
+	context_create(&ctx, &root.symbols, &out);
+
+	int64_t start = bench_now();
+	double x = 0;
+	double y = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		context_turn(&ctx, ctx.angle + 0.1);
+		x = x + 1 * ctx.direction.dx;
+		y = y + 1 * ctx.direction.dy;
+		pxs[i] = x;
+		pys[i] = y;
+	}
+	int64_t commands_ns = bench_now() - start;
+
+	context_destroy(&ctx);
+	output_destroy(&out);
+	fclose(null);
+	ast_destroy(&root);
+
+	// the same points, as a run replayed rotated from another heading
+	double c = cos(PI / 7);
+	double s = sin(PI / 7);
+	printf("{\"case\":\"transform\",\"points\":%zu,\"commands_ns\":%lld", count, (long long)commands_ns);
+	for (int kernel = 0; kernel < TRANSFORM_KERNEL_COUNT; kernel++)
+	{
+		if (!transform_kernel_supported(kernel))
+		{
+			printf(",\"%s_ns\":null", transform_kernel_name(kernel));
+			continue;
+		}
+		// once before it is timed, so that the pages of the points are mapped
+		transform_points_with(kernel, pxs, pys, count, 100, -50, c, s, xs, ys);
+		start = bench_now();
+		transform_points_with(kernel, pxs, pys, count, 100, -50, c, s, xs, ys);
+		int64_t kernel_ns = bench_now() - start;
+		printf(",\"%s_ns\":%lld", transform_kernel_name(kernel), (long long)kernel_ns);
+
+		// all the kernels must place the points at exactly the same place
+		if (kernel == TRANSFORM_SCALAR)
+		{
+			memcpy(ref_xs, xs, count * sizeof(double));
+			memcpy(ref_ys, ys, count * sizeof(double));
+		}
+		else if (memcmp(ref_xs, xs, count * sizeof(double)) != 0 || memcmp(ref_ys, ys, count * sizeof(double)) != 0)
+		{
+			fprintf(stderr, "transform: the %s kernel does not match the scalar one\n", transform_kernel_name(kernel));
+			exit(1);
+		}
+	}
+	printf("}\n");
+	fflush(stdout);
+
+	free(pxs);
+	free(pys);
+	free(xs);
+	free(ys);
+	free(ref_xs);
+	free(ref_ys);
+}
+
+/**
+ * Time the draws of random numbers between bounds with rand() reduced
+ * modulo the size of the range, as the evaluators used to, and with the
+ * generator of the contexts, then print the results
+ *
+ * @param scale the number of numbers drawn for each range
+ */
+static void bench_random(long scale)
+{
+	static const int bounds[][2] = {{0, 1}, {0, 255}, {0, 359}, {1, 1000000}};
+	size_t range_count = sizeof(bounds) / sizeof(bounds[0]);
+	printf("{\"case\":\"random\",\"draws\":%ld", scale);
+
+	// the sums keep the draws from being optimized away
+	long long sum = 0;
+	srand(1);
+	int64_t start = bench_now();
+	for (size_t r = 0; r < range_count; r++)
+	{
+		int min = bounds[r][0];
+		int max = bounds[r][1];
+		for (long i = 0; i < scale; i++)
+		{
+			sum += min + rand() % (max + 1 - min);
+		}
+	}
+	int64_t rand_ns = bench_now() - start;
+
+	struct random generator;
+	random_seed(&generator, 1);
+	start = bench_now();
+	for (size_t r = 0; r < range_count; r++)
+	{
+		for (long i = 0; i < scale; i++)
+		{
+			sum += random_range(&generator, bounds[r][0], bounds[r][1]);
+		}
+	}
+	int64_t random_ns = bench_now() - start;
+
+	// on a range of two thirds of RAND_MAX, the modulo draws the lower half twice as often as the upper half
+	long long range = RAND_MAX / 3 * 2;
+	size_t rand_low = 0;
+	size_t random_low = 0;
+	for (long i = 0; i < scale; i++)
+	{
+		rand_low += rand() % range < range / 2;
+		random_low += random_range(&generator, 0, range - 1) < range / 2;
+	}
+
+	printf(",\"ranges\":%zu,\"rand_ns\":%lld,\"random_ns\":%lld,\"rand_ns_per_draw\":%.2f,\"random_ns_per_draw\":%.2f,"
+		   "\"rand_low_half\":%.4f,\"random_low_half\":%.4f,\"sum\":%lld}\n",
+		   range_count, (long long)rand_ns, (long long)random_ns, (double)rand_ns / (scale * range_count),
+		   (double)random_ns / (scale * range_count), (double)rand_low / scale, (double)random_low / scale, sum);
+	fflush(stdout);
+}
+
+/**
+ * Print how to use the benchmark
+ *
+ * @param program the name of the executable
+ */
+static void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [--scale N] [--case NAME]... [--transform] [--lexer] [--random]\n", program);
+	fprintf(stderr, "Cases:");
+	for (size_t i = 0; i < BENCH_CASE_COUNT; i++)
+	{
+		fprintf(stderr, " %s", bench_cases[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long scale = BENCH_SCALE_DEFAULT;
+	bool selected[BENCH_CASE_COUNT] = {false};
+	bool any_selected = false;
+	bool transform = false;
+	bool lexer = false;
+	bool random = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+		{
+			char *end;
+			scale = strtol(argv[++i], &end, 10);
+			if (*end != '\0' || scale <= 0)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--case") == 0 && i + 1 < argc)
+		{
+			const char *name = argv[++i];
+			size_t c = 0;
+			while (c < BENCH_CASE_COUNT && strcmp(bench_cases[c].name, name) != 0)
+			{
+				c++;
+			}
+			if (c == BENCH_CASE_COUNT)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			selected[c] = true;
+			any_selected = true;
+		}
+		else if (strcmp(argv[i], "--transform") == 0)
+		{
+			transform = true;
+		}
+		else if (strcmp(argv[i], "--lexer") == 0)
+		{
+			lexer = true;
+		}
+		else if (strcmp(argv[i], "--random") == 0)
+		{
+			random = true;
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (transform)
+	{
+		bench_transform(scale);
+		return 0;
+	}
+	if (random)
+	{
+		bench_random(scale);
+		return 0;
+	}
+
+	for (size_t c = 0; c < BENCH_CASE_COUNT; c++)
+	{
+		if (any_selected && !selected[c])
+		{
+			continue;
+		}
+
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			if (lexer)
+			{
+				bench_lexer(&bench_cases[c], scale);
+			}
+			else
+			{
+				bench_run(&bench_cases[c], scale);
+			}
+			exit(0);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, "%s: the benchmark failed\n", bench_cases[c].name);
+			return 1;
+		}
+	}
+	return 0;
+}
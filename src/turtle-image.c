@@ -0,0 +1,712 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-image.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "TURTLEIM"
+
+// written as a number by the machine that saved the image, tells its byte order
+#define IMAGE_ORDER 0x01020304u
+
+// the image holds an optimized program
+#define IMAGE_OPTIMIZED 1u
+
+// the multipliers of the hash of the sources
+#define IMAGE_HASH_SEED 0x9E3779B97F4A7C15ull
+#define IMAGE_HASH_MULTIPLIER 0xC2B2AE3D27D4EB4Full
+
+// the first size of the buffers of the writer and of the reader, a power of two
+#define IMAGE_SLOTS_MIN 1024
+
+// the codes of the entries past the kinds of the nodes
+#define IMAGE_INTEGER AST_KIND_COUNT	   // a value node holding an integer, written as a varint
+#define IMAGE_REFERENCE (AST_KIND_COUNT + 1) // a node already read, by its index
+
+// the bits of the first byte of an entry
+#define IMAGE_CODE_MASK 0x0Fu
+#define IMAGE_CHILDREN_SHIFT 4
+#define IMAGE_CHILDREN_MASK 0x03u
+#define IMAGE_NEXT 0x40u
+
+// the largest integer written as a varint, every integer up to it is a double
+#define IMAGE_INTEGER_MAX 9007199254740992.0
+
+// the number of functions, written on a byte
+#define IMAGE_FUNC_COUNT (FUNC_TAN + 1)
+
+// the start of an image
+struct image_header
+{
+	char magic[8];		  // IMAGE_MAGIC
+	uint32_t version;	  // IMAGE_VERSION
+	uint32_t order;		  // IMAGE_ORDER
+	uint64_t source_hash; // the key of the source
+	uint64_t source_size;
+	uint32_t flags;		   // IMAGE_OPTIMIZED
+	uint32_t reserved;	   // 0
+	uint64_t checksum;	   // the hash of the rest of the image, a damaged image is ignored as a whole
+	uint64_t symbol_count; // the names that follow the header, in the order of their symbols
+	uint64_t names_size;   // the size of the names, each one ends with a nul
+	uint64_t node_count;   // the nodes of the entries that follow the names
+	uint64_t nodes_size;   // the size of the entries, up to the end of the image
+	uint64_t unit;		   // the index of the first command of the parsed program plus one, 0 stands for NULL
+	uint64_t optimized;	   // the index of the first command of the optimized program plus one
+};
+
+// a node whose next node and children are being written before it
+struct image_frame
+{
+	const struct ast_node *node;
+	size_t stage; // 0 for its next node, i + 1 for its child i
+};
+
+// the entries of a tree, the nodes shared by both programs are written once
+struct image_writer
+{
+	unsigned char *data; // the names then the entries written
+	size_t size;
+	size_t capacity;
+	const struct ast_node **nodes; // the nodes written, in the order of their entries
+	size_t count;
+	size_t capacity_nodes;
+	uint32_t *slots;   // open addressing table of the indexes of the written nodes plus one, 0 for an empty slot
+	size_t slot_count; // a power of two
+	struct image_frame *frames;
+	size_t frame_count;
+	size_t frame_capacity;
+	bool valid; // false if a child is missing
+};
+
+/**
+ * Mix the bits of a word
+ *
+ * @param word the word
+ *
+ * @return the mixed word, every bit depends on all the bits of the word
+ */
+static uint64_t image_mix(uint64_t word)
+{
+	word ^= word >> 33;
+	word *= 0xFF51AFD7ED558CCDull;
+	word ^= word >> 33;
+	word *= 0xC4CEB9FE1A85EC53ull;
+	word ^= word >> 33;
+	return word;
+}
+
+/**
+ * Compute the key of the source of a program, 8 bytes at a time
+ *
+ * @param self the key
+ * @param text the source
+ * @param size its size in bytes
+ */
+void image_key(struct image_key *self, const char *text, size_t size)
+{
+	uint64_t hash = IMAGE_HASH_SEED ^ size;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, text + i, sizeof(word));
+		hash ^= image_mix(word);
+		hash = ((hash << 27) | (hash >> 37)) * IMAGE_HASH_MULTIPLIER;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, text + i, size - i);
+	self->hash = image_mix(hash ^ image_mix(tail ^ IMAGE_HASH_SEED));
+	self->size = size;
+}
+
+/**
+ * Build the path of the image of a program in a cache directory
+ *
+ * @param path where the path is written
+ * @param size the size of path
+ * @param dir the cache directory
+ * @param key the key of the source of the program
+ *
+ * @return false if the path does not fit in size
+ */
+bool image_path(char *path, size_t size, const char *dir, const struct image_key *key)
+{
+	int length = snprintf(path, size, "%s/%016llx-%llx" IMAGE_EXTENSION, dir, (unsigned long long)key->hash, (unsigned long long)key->size);
+	return length >= 0 && (size_t)length < size;
+}
+
+/**
+ * Create the cache directory if it does not exist yet
+ *
+ * @param dir the cache directory
+ *
+ * @return false if it cannot be created, errno tells why
+ */
+bool image_cache_create(const char *dir)
+{
+	return mkdir(dir, 0777) == 0 || errno == EEXIST;
+}
+
+
+/**
+ * Make room for bytes at the end of the entries
+ *
+ * @param self the writer
+ * @param size the number of bytes
+ *
+ * @return where the bytes are written
+ */
+static unsigned char *image_reserve(struct image_writer *self, size_t size)
+{
+	if (self->size + size > self->capacity)
+	{
+		while (self->size + size > self->capacity)
+		{
+			self->capacity *= 2;
+		}
+		self->data = realloc(self->data, self->capacity);
+	}
+	unsigned char *p = self->data + self->size;
+	self->size += size;
+	return p;
+}
+
+/**
+ * Write a number on as few bytes as it needs, seven bits per byte, the last
+ * byte without its high bit
+ *
+ * @param self the writer
+ * @param number the number
+ */
+static void image_put_varint(struct image_writer *self, uint64_t number)
+{
+	unsigned char bytes[10];
+	size_t size = 0;
+	while (number >= 0x80)
+	{
+		bytes[size++] = (unsigned char)(number | 0x80);
+		number >>= 7;
+	}
+	bytes[size++] = (unsigned char)number;
+	memcpy(image_reserve(self, size), bytes, size);
+}
+
+/**
+ * Find the slot of a node in the table of the written nodes. The nodes
+ * close in the arena get close slots, as the nodes are written in about the
+ * order they were allocated
+ *
+ * @param self the writer
+ * @param node the node
+ *
+ * @return its slot, or the empty slot where it would be
+ */
+static uint32_t *image_slot(const struct image_writer *self, const struct ast_node *node)
+{
+	size_t mask = self->slot_count - 1;
+	size_t slot = ((uintptr_t)node / ARENA_ALIGNMENT) & mask;
+	while (self->slots[slot] != 0 && self->nodes[self->slots[slot] - 1] != node)
+	{
+		slot = (slot + 1) & mask;
+	}
+	return &self->slots[slot];
+}
+
+/**
+ * Double the size of the table of the written nodes
+ *
+ * @param self the writer
+ */
+static void image_writer_grow(struct image_writer *self)
+{
+	free(self->slots);
+	self->slot_count *= 2;
+	self->slots = calloc(self->slot_count, sizeof(uint32_t));
+	for (size_t i = 0; i < self->count; i++)
+	{
+		*image_slot(self, self->nodes[i]) = i + 1;
+	}
+}
+
+/**
+ * Write the entry of a node, once its next node and its children are written
+ *
+ * @param self the writer
+ * @param node the node
+ */
+static void image_put_node(struct image_writer *self, const struct ast_node *node)
+{
+	unsigned code = node->kind;
+	double value = node->u.value;
+	bool integer = node->kind == KIND_EXPR_VALUE && value > -IMAGE_INTEGER_MAX && value < IMAGE_INTEGER_MAX &&
+				   value == (double)(int64_t)value && !(value == 0 && signbit(value));
+	if (integer)
+	{
+		code = IMAGE_INTEGER;
+	}
+	*image_reserve(self, 1) = (unsigned char)(code | node->children_count << IMAGE_CHILDREN_SHIFT | (node->next != NULL ? IMAGE_NEXT : 0));
+
+	switch (node->kind)
+	{
+	case KIND_CMD_SIMPLE:
+		*image_reserve(self, 1) = (unsigned char)node->u.cmd;
+		break;
+	case KIND_EXPR_FUNC:
+		*image_reserve(self, 1) = (unsigned char)node->u.func;
+		break;
+	case KIND_EXPR_UNOP:
+	case KIND_EXPR_BINOP:
+		*image_reserve(self, 1) = (unsigned char)node->u.op;
+		break;
+	case KIND_EXPR_VALUE:
+		if (integer)
+		{
+			// zigzag, so that the small negative integers are short too
+			int64_t number = (int64_t)value;
+			image_put_varint(self, ((uint64_t)number << 1) ^ (uint64_t)(number >> 63));
+		}
+		else
+		{
+			memcpy(image_reserve(self, sizeof(value)), &value, sizeof(value));
+		}
+		break;
+	case KIND_EXPR_NAME:
+		image_put_varint(self, node->symbol);
+		break;
+	default:
+		break;
+	}
+
+	if (self->count == self->capacity_nodes)
+	{
+		self->capacity_nodes *= 2;
+		self->nodes = realloc(self->nodes, self->capacity_nodes * sizeof(struct ast_node *));
+	}
+	*image_slot(self, node) = self->count + 1;
+	self->nodes[self->count++] = node;
+	if (2 * self->count > self->slot_count)
+	{
+		image_writer_grow(self);
+	}
+}
+
+/**
+ * Write a node after the nodes it points to, in postorder: its next node,
+ * then its children, then itself. A node already written is written again
+ * as a reference to its index. The nodes are visited with a stack of their
+ * own, the sequences being as long as the programs
+ *
+ * @param self the writer
+ * @param root the node, or NULL
+ *
+ * @return the index of the node plus one, 0 for NULL
+ */
+static uint64_t image_put_tree(struct image_writer *self, const struct ast_node *root)
+{
+	if (root == NULL)
+	{
+		return 0;
+	}
+	uint32_t *slot = image_slot(self, root);
+	if (*slot != 0)
+	{
+		return *slot;
+	}
+
+	self->frame_count = 0;
+	self->frames[self->frame_count++] = (struct image_frame){root, 0};
+	while (self->frame_count > 0)
+	{
+		struct image_frame *frame = &self->frames[self->frame_count - 1];
+		const struct ast_node *node = frame->node;
+		const struct ast_node *child = NULL;
+		while (child == NULL && frame->stage <= node->children_count)
+		{
+			child = frame->stage == 0 ? node->next : node->children[frame->stage - 1];
+			if (child == NULL && frame->stage > 0)
+			{
+				self->valid = false;
+			}
+			frame->stage++;
+			if (child != NULL && *(slot = image_slot(self, child)) != 0)
+			{
+				*image_reserve(self, 1) = IMAGE_REFERENCE;
+				image_put_varint(self, *slot - 1);
+				child = NULL;
+			}
+		}
+
+		if (child == NULL)
+		{
+			image_put_node(self, node);
+			self->frame_count--;
+			continue;
+		}
+		if (self->frame_count == self->frame_capacity)
+		{
+			self->frame_capacity *= 2;
+			self->frames = realloc(self->frames, self->frame_capacity * sizeof(struct image_frame));
+		}
+		self->frames[self->frame_count++] = (struct image_frame){child, 0};
+	}
+	return *image_slot(self, root);
+}
+
+/**
+ * Save the parsed program of a tree, and its optimized program if it has
+ * one, as an image. The image is written next to its path then renamed, so
+ * that the runs reading it at the same time see it whole or not at all
+ *
+ * @param self the tree
+ * @param path the path of the image
+ * @param key the key of the source of the program
+ *
+ * @return false if the image cannot be written
+ */
+bool image_save(const struct ast *self, const char *path, const struct image_key *key)
+{
+	struct image_writer writer;
+	writer.capacity = IMAGE_SLOTS_MIN;
+	writer.data = malloc(writer.capacity);
+	writer.size = 0;
+	writer.capacity_nodes = IMAGE_SLOTS_MIN;
+	writer.nodes = calloc(writer.capacity_nodes, sizeof(struct ast_node *));
+	writer.count = 0;
+	// every node takes at least sizeof(struct ast_node) in the arena, so the table does not grow
+	writer.slot_count = IMAGE_SLOTS_MIN;
+	while (writer.slot_count < 2 * (self->arena.allocated / sizeof(struct ast_node)))
+	{
+		writer.slot_count *= 2;
+	}
+	writer.slots = calloc(writer.slot_count, sizeof(uint32_t));
+	writer.frame_capacity = IMAGE_SLOTS_MIN;
+	writer.frames = malloc(writer.frame_capacity * sizeof(struct image_frame));
+	writer.frame_count = 0;
+	writer.valid = true;
+
+	struct image_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+	header.version = IMAGE_VERSION;
+	header.order = IMAGE_ORDER;
+	header.source_hash = key->hash;
+	header.source_size = key->size;
+	header.flags = self->optimized != NULL ? IMAGE_OPTIMIZED : 0;
+	header.symbol_count = self->symbols.count;
+	for (size_t i = 0; i < self->symbols.count; i++)
+	{
+		size_t size = strlen(self->symbols.names[i]) + 1;
+		memcpy(image_reserve(&writer, size), self->symbols.names[i], size);
+	}
+	header.names_size = writer.size;
+	header.unit = image_put_tree(&writer, self->unit);
+	header.optimized = image_put_tree(&writer, self->optimized);
+	header.node_count = writer.count;
+	header.nodes_size = writer.size - header.names_size;
+	struct image_key checksum;
+	image_key(&checksum, (const char *)writer.data, writer.size);
+	header.checksum = checksum.hash;
+	free(writer.nodes);
+	free(writer.slots);
+	free(writer.frames);
+
+	size_t path_size = strlen(path);
+	char *temporary = malloc(path_size + sizeof(".XXXXXX"));
+	memcpy(temporary, path, path_size);
+	memcpy(temporary + path_size, ".XXXXXX", sizeof(".XXXXXX"));
+	int fd = writer.valid ? mkstemp(temporary) : -1;
+	FILE *stream = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (stream == NULL)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(temporary);
+		}
+		free(temporary);
+		free(writer.data);
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, stream) == 1;
+	written = written && (writer.size == 0 || fwrite(writer.data, writer.size, 1, stream) == 1);
+	written = fclose(stream) == 0 && written;
+	written = written && rename(temporary, path) == 0;
+	if (!written)
+	{
+		unlink(temporary);
+	}
+	free(temporary);
+	free(writer.data);
+	return written;
+}
+
+/**
+ * Check the header and the names of an image before a tree is built from it
+ *
+ * @param data the image
+ * @param size its size
+ * @param key the key of the source of the program
+ * @param optimized the image must hold an optimized program
+ *
+ * @return true if they are valid and the image is whole, the entries are checked as they are read
+ */
+static bool image_check(const char *data, size_t size, const struct image_key *key, bool optimized)
+{
+	const struct image_header *header = (const struct image_header *)data;
+	if (size < sizeof(*header) || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != IMAGE_VERSION || header->order != IMAGE_ORDER ||
+		header->source_hash != key->hash || header->source_size != key->size ||
+		(optimized && (header->flags & IMAGE_OPTIMIZED) == 0))
+	{
+		return false;
+	}
+	// every node takes at least a byte
+	size_t rest = size - sizeof(*header);
+	if (header->names_size > rest || header->nodes_size != rest - header->names_size ||
+		header->symbol_count > header->names_size || header->node_count > header->nodes_size ||
+		header->unit > header->node_count || header->optimized > header->node_count)
+	{
+		return false;
+	}
+	struct image_key checksum;
+	image_key(&checksum, data + sizeof(*header), rest);
+	if (checksum.hash != header->checksum)
+	{
+		return false;
+	}
+
+	// each name ends with a nul, the last one at the end of the names
+	const char *names = data + sizeof(*header);
+	size_t nuls = 0;
+	for (const char *p = names; (p = memchr(p, '\0', names + header->names_size - p)) != NULL; p++)
+	{
+		nuls++;
+	}
+	return nuls == header->symbol_count && (header->names_size == 0 || names[header->names_size - 1] == '\0');
+}
+
+/**
+ * Read a number written by image_put_varint
+ *
+ * @param p where the number starts, moved past it
+ * @param end the end of the entries
+ * @param number where the number is set
+ *
+ * @return false if the number is cut or too large
+ */
+static bool image_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *number)
+{
+	uint64_t result = 0;
+	for (unsigned shift = 0; *p < end && shift < 64; shift += 7)
+	{
+		unsigned char byte = *(*p)++;
+		result |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			*number = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Read the payload of a node, after the first byte of its entry
+ *
+ * @param self the tree
+ * @param node the node, its kind already set
+ * @param code the code of the entry
+ * @param p where the payload starts, moved past it
+ * @param end the end of the entries
+ *
+ * @return false if the payload is not valid
+ */
+static bool image_get_payload(struct ast *self, struct ast_node *node, unsigned code, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t number;
+	switch (node->kind)
+	{
+	case KIND_CMD_SIMPLE:
+		if (*p == end || **p >= AST_CMD_COUNT)
+		{
+			return false;
+		}
+		node->u.cmd = *(*p)++;
+		return true;
+	case KIND_EXPR_FUNC:
+		if (*p == end || **p >= IMAGE_FUNC_COUNT)
+		{
+			return false;
+		}
+		node->u.func = *(*p)++;
+		return true;
+	case KIND_EXPR_UNOP:
+	case KIND_EXPR_BINOP:
+		if (*p == end)
+		{
+			return false;
+		}
+		node->u.op = (char)*(*p)++;
+		return true;
+	case KIND_EXPR_VALUE:
+		if (code == IMAGE_INTEGER)
+		{
+			if (!image_get_varint(p, end, &number))
+			{
+				return false;
+			}
+			node->u.value = (double)(int64_t)((number >> 1) ^ -(number & 1));
+			return true;
+		}
+		if ((size_t)(end - *p) < sizeof(node->u.value))
+		{
+			return false;
+		}
+		memcpy(&node->u.value, *p, sizeof(node->u.value));
+		*p += sizeof(node->u.value);
+		return true;
+	case KIND_EXPR_NAME:
+		if (!image_get_varint(p, end, &number) || number >= self->symbols.count)
+		{
+			return false;
+		}
+		node->symbol = number;
+		node->u.name = self->symbols.names[number];
+		return true;
+	default:
+		return true;
+	}
+}
+
+/**
+ * Build the nodes of a tree from the entries of an image, in the arena of
+ * the tree. The nodes read wait on a stack until the node they belong to
+ * takes them, and are kept by index for the references
+ *
+ * @param self the tree, its names already interned
+ * @param header the header of the image, already checked
+ * @param p the first entry
+ * @param end the end of the entries
+ * @param optimized the optimized program is loaded too
+ *
+ * @return false if the entries are not valid
+ */
+static bool image_build(struct ast *self, const struct image_header *header, const unsigned char *p, const unsigned char *end, bool optimized)
+{
+	struct ast_node **nodes = malloc((header->node_count + 1) * sizeof(struct ast_node *));
+	size_t count = 0;
+	size_t stack_capacity = IMAGE_SLOTS_MIN;
+	struct ast_node **stack = malloc(stack_capacity * sizeof(struct ast_node *));
+	size_t depth = 0;
+
+	bool valid = true;
+	while (valid && p < end)
+	{
+		unsigned byte = *p++;
+		unsigned code = byte & IMAGE_CODE_MASK;
+		if (depth == stack_capacity)
+		{
+			stack_capacity *= 2;
+			stack = realloc(stack, stack_capacity * sizeof(struct ast_node *));
+		}
+		if (code == IMAGE_REFERENCE)
+		{
+			uint64_t index;
+			valid = byte == IMAGE_REFERENCE && image_get_varint(&p, end, &index) && index < count;
+			if (valid)
+			{
+				stack[depth++] = nodes[index];
+			}
+			continue;
+		}
+
+		size_t children_count = byte >> IMAGE_CHILDREN_SHIFT & IMAGE_CHILDREN_MASK;
+		size_t taken = children_count + ((byte & IMAGE_NEXT) != 0);
+		valid = code <= IMAGE_INTEGER && (byte & ~(IMAGE_CODE_MASK | IMAGE_CHILDREN_MASK << IMAGE_CHILDREN_SHIFT | IMAGE_NEXT)) == 0 &&
+				children_count <= AST_CHILDREN_MAX && taken <= depth && count < header->node_count;
+		if (!valid)
+		{
+			break;
+		}
+		struct ast_node *node = ast_node_alloc(&self->arena, children_count);
+		node->kind = code == IMAGE_INTEGER ? KIND_EXPR_VALUE : code;
+		valid = image_get_payload(self, node, code, &p, end);
+		for (size_t i = children_count; i > 0; i--)
+		{
+			node->children[i - 1] = stack[--depth];
+		}
+		if (byte & IMAGE_NEXT)
+		{
+			node->next = stack[--depth];
+		}
+		nodes[count++] = node;
+		stack[depth++] = node;
+	}
+
+	// the index 0 stands for NULL
+	valid = valid && count == header->node_count;
+	if (valid)
+	{
+		self->unit = header->unit != 0 ? nodes[header->unit - 1] : NULL;
+		self->optimized = optimized && header->optimized != 0 ? nodes[header->optimized - 1] : NULL;
+	}
+	free(nodes);
+	free(stack);
+	return valid;
+}
+
+/**
+ * Load the image of a program into an empty tree: its names are interned
+ * and its nodes are built in the arena of the tree. A corrupted image may
+ * leave names in the symbol table and nodes in the arena, the parser then
+ * interns the names of the program after them
+ *
+ * @param self the tree
+ * @param path the path of the image
+ * @param key the key of the source of the program
+ * @param optimized the optimized program is needed too
+ *
+ * @return false if there is no image of the program, or if it is not valid
+ */
+bool image_load(struct ast *self, const char *path, const struct image_key *key, bool optimized)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct image_header))
+	{
+		close(fd);
+		return false;
+	}
+	char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+
+	bool valid = image_check(data, info.st_size, key, optimized);
+	const struct image_header *header = (const struct image_header *)data;
+	const char *name = data + sizeof(*header);
+	for (size_t i = 0; valid && i < header->symbol_count; i++)
+	{
+		size_t size = strlen(name);
+		valid = symbol_intern_view(&self->symbols, name, size) == i;
+		name += size + 1;
+	}
+	valid = valid && image_build(self, header, (const unsigned char *)name, (const unsigned char *)data + info.st_size, optimized);
+	munmap(data, info.st_size);
+	return valid;
+}
@@ -0,0 +1,58 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_IMAGE_H
+#define TURTLE_IMAGE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "turtle-ast.h"
+
+/*
+ * Images of parsed programs
+ *
+ * A parsed program, and its optimized version when there is one, is saved
+ * as an image: the names of its symbols, then one entry per node in
+ * postorder, each node after its next node and its children. An entry is a
+ * byte holding the kind of the node, its number of children and whether it
+ * has a next node, then its operator, command or function on a byte, its
+ * symbol or its integer value as a varint, or its other values as a double.
+ * The nodes shared by both programs are written once, then as references to
+ * the index of their entry. An image does not depend on where it is loaded:
+ * it is mapped in memory and its nodes are rebuilt in one pass in the arena
+ * of the tree, without the scanner nor the parser.
+ *
+ * The images are kept in a cache directory, named after a hash of the
+ * source of the program and its size. An image whose header does not match
+ * the source, the format or the byte order of the machine, or whose content
+ * does not match the checksum of its header, is ignored and replaced by the
+ * next run. IMAGE_VERSION changes whenever the format, the
+ * parser or the optimizer change what an image holds.
+ */
+
+#define IMAGE_VERSION 1
+
+// the extension of the images in the cache
+#define IMAGE_EXTENSION ".tim"
+
+// what identifies the source of a program
+struct image_key
+{
+	uint64_t hash; // the hash of its bytes
+	uint64_t size; // its size in bytes
+};
+
+void image_key(struct image_key *self, const char *text, size_t size);
+
+// the path of the image of a program in a cache directory, false if it does not fit
+bool image_path(char *path, size_t size, const char *dir, const struct image_key *key);
+
+// create the cache directory if it does not exist yet
+bool image_cache_create(const char *dir);
+
+bool image_save(const struct ast *self, const char *path, const struct image_key *key);
+
+// load into an empty tree, false if there is no valid image
+bool image_load(struct ast *self, const char *path, const struct image_key *key, bool optimized);
+
+#endif /* TURTLE_IMAGE_H */
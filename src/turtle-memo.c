@@ -0,0 +1,524 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-memo.h"
+#include "turtle-output.h"
+#include "turtle-transform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Check whether an expression always gives the same value
+ *
+ * @param node the expression
+ *
+ * @return false if the expression draws a random number
+ */
+static bool memo_expr_pure(const struct ast_node *node)
+{
+	if (node == NULL)
+	{
+		return true;
+	}
+	if (node->kind == KIND_EXPR_FUNC && node->u.func == FUNC_RANDOM)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < node->children_count; i++)
+	{
+		if (!memo_expr_pure(node->children[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check whether a sequence of commands draws the same thing each time it
+ * runs from the same heading and pen, and changes nothing but the turtle.
+ * When the runs are replayed rotated, the heading must not be set either.
+ *
+ * @param node the first command of the sequence
+ * @param ctx the execution context, where the called procedures are found
+ * @param depth the number of calls followed to get there
+ *
+ * @return true if the commands have no side effect
+ */
+static struct memo *memo_analyze(struct procedure *proc, struct context *ctx, size_t depth);
+
+static bool memo_cmds_pure(const struct ast_node *node, struct context *ctx, size_t depth)
+{
+	for (; node != NULL; node = node->next)
+	{
+		switch (node->kind)
+		{
+		case KIND_CMD_SIMPLE:
+			if (node->u.cmd == CMD_POSITION || node->u.cmd == CMD_HOME || node->u.cmd == CMD_PRINT)
+			{
+				return false;
+			}
+			// an absolute heading does not turn with the rest of a rotated run
+			if (node->u.cmd == CMD_HEADING && ctx->rigid)
+			{
+				return false;
+			}
+			if (node->children_count > 0 && !memo_expr_pure(node->children[0]))
+			{
+				return false;
+			}
+			break;
+		case KIND_CMD_BLOCK:
+			if (!memo_cmds_pure(node->children[0], ctx, depth))
+			{
+				return false;
+			}
+			break;
+		case KIND_CMD_REPEAT:
+			if (!memo_expr_pure(node->children[0]) || !memo_cmds_pure(node->children[1], ctx, depth))
+			{
+				return false;
+			}
+			break;
+		case KIND_CMD_CALL:
+		{
+			// the procedures cannot be defined twice, the callee is known for good
+			struct procedure *callee = context_procedure(ctx, node->children[0]->symbol);
+			if (callee->nodes == NULL || depth == MEMO_DEPTH_MAX || memo_analyze(callee, ctx, depth + 1)->purity != MEMO_PURE)
+			{
+				return false;
+			}
+		}
+		break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Get what is known of the calls of a defined procedure, and decide whether
+ * it has side effects the first time. A procedure calling itself while it
+ * is analyzed is found to have some, its calls would never end anyway.
+ *
+ * @param proc the procedure
+ * @param ctx the execution context
+ * @param depth the number of calls followed to get there
+ *
+ * @return what is known of its calls
+ */
+static struct memo *memo_analyze(struct procedure *proc, struct context *ctx, size_t depth)
+{
+	if (proc->memo == NULL)
+	{
+		// MEMO_UNKNOWN while the body is analyzed
+		proc->memo = calloc(1, sizeof(struct memo));
+		proc->memo->purity = memo_cmds_pure(proc->nodes, ctx, depth) ? MEMO_PURE : MEMO_IMPURE;
+	}
+	return proc->memo;
+}
+
+/**
+ * Free the primitives of a recorded run
+ *
+ * @param trace the recorded run
+ */
+static void memo_trace_free(struct memo_trace *trace)
+{
+	free(trace->ops);
+	free(trace->dxs);
+	free(trace->dys);
+	free(trace->colors);
+	free(trace->pxs);
+	free(trace->pys);
+	trace->ops = NULL;
+	trace->dxs = NULL;
+	trace->dys = NULL;
+	trace->colors = NULL;
+	trace->pxs = NULL;
+	trace->pys = NULL;
+	trace->step_count = 0;
+	trace->step_capacity = 0;
+	trace->color_count = 0;
+	trace->color_capacity = 0;
+}
+
+/**
+ * Compute the positions of a recorded run relative to its start, the first
+ * time it is replayed rotated
+ *
+ * @param trace the recorded run
+ */
+static void memo_trace_positions(struct memo_trace *trace)
+{
+	if (trace->pxs != NULL || trace->step_count == 0)
+	{
+		return;
+	}
+	trace->pxs = malloc(trace->step_count * sizeof(double));
+	trace->pys = malloc(trace->step_count * sizeof(double));
+	double x = 0;
+	double y = 0;
+	for (size_t i = 0; i < trace->step_count; i++)
+	{
+		x = x + trace->dxs[i];
+		y = y + trace->dys[i];
+		trace->pxs[i] = x;
+		trace->pys[i] = y;
+	}
+}
+
+/**
+ * Replay a recorded run from the current position, rotated by a given
+ * rotation. The points are placed in the world by blocks, then emitted.
+ *
+ * @param ctx the execution context
+ * @param trace the recorded run
+ * @param c the cosine of the rotation
+ * @param s its sine
+ */
+static void memo_replay_rotated(struct context *ctx, struct memo_trace *trace, double c, double s)
+{
+	memo_trace_positions(trace);
+
+	double xs[TRANSFORM_BLOCK];
+	double ys[TRANSFORM_BLOCK];
+	double start_x = ctx->x;
+	double start_y = ctx->y;
+	size_t color = 0;
+	for (size_t first = 0; first < trace->step_count; first += TRANSFORM_BLOCK)
+	{
+		size_t count = trace->step_count - first < TRANSFORM_BLOCK ? trace->step_count - first : TRANSFORM_BLOCK;
+		transform_points(trace->pxs + first, trace->pys + first, count, start_x, start_y, c, s, xs, ys);
+		for (size_t i = 0; i < count; i++)
+		{
+			const unsigned char op = trace->ops[first + i];
+			if (op == MEMO_COLOR)
+			{
+				const struct memo_color *rgb = &trace->colors[color++];
+				context_color(ctx, rgb->r, rgb->g, rgb->b);
+				continue;
+			}
+			if (ctx->recording != NULL)
+			{
+				memo_record_move(ctx, xs[i] - ctx->x, ys[i] - ctx->y, op == MEMO_LINE);
+			}
+			ctx->x = xs[i];
+			ctx->y = ys[i];
+			if (op == MEMO_LINE)
+			{
+				output_line_to(ctx->out, ctx->x, ctx->y);
+			}
+			else
+			{
+				output_move_to(ctx->out, ctx->x, ctx->y);
+			}
+		}
+	}
+}
+
+/**
+ * Replay a recorded run from the current position. If the turtle does not
+ * have the heading the run was recorded from, the run is rotated from the
+ * recorded direction to the current one.
+ *
+ * @param ctx the execution context
+ * @param trace the recorded run
+ */
+static void memo_replay(struct context *ctx, struct memo_trace *trace)
+{
+	if (ctx->angle != trace->angle)
+	{
+		double c = trace->direction.dx * ctx->direction.dx + trace->direction.dy * ctx->direction.dy;
+		double s = trace->direction.dx * ctx->direction.dy - trace->direction.dy * ctx->direction.dx;
+		double end_angle = ctx->angle + (trace->end_angle - trace->angle);
+		memo_replay_rotated(ctx, trace, c, s);
+		context_turn(ctx, end_angle);
+		ctx->up = trace->end_up;
+		return;
+	}
+
+	size_t color = 0;
+	for (size_t i = 0; i < trace->step_count; i++)
+	{
+		const unsigned char op = trace->ops[i];
+		if (op == MEMO_COLOR)
+		{
+			const struct memo_color *rgb = &trace->colors[color++];
+			context_color(ctx, rgb->r, rgb->g, rgb->b);
+			continue;
+		}
+		ctx->x = ctx->x + trace->dxs[i];
+		ctx->y = ctx->y + trace->dys[i];
+		if (ctx->recording != NULL)
+		{
+			memo_record_move(ctx, trace->dxs[i], trace->dys[i], op == MEMO_LINE);
+		}
+		if (op == MEMO_LINE)
+		{
+			output_line_to(ctx->out, ctx->x, ctx->y);
+		}
+		else
+		{
+			output_move_to(ctx->out, ctx->x, ctx->y);
+		}
+	}
+	ctx->angle = trace->end_angle;
+	ctx->direction = trace->end_direction;
+	ctx->up = trace->end_up;
+}
+
+/**
+ * Decide what to do for a call: replay a recorded run, record this run, or
+ * simply run the body. Only one run is recorded at a time, the procedures
+ * called during it are part of it.
+ *
+ * @param ctx the execution context
+ * @param symbol the name of the procedure
+ *
+ * @return what the evaluator has to do
+ */
+enum memo_call memo_call(struct context *ctx, size_t symbol)
+{
+	if (!ctx->memoize)
+	{
+		return MEMO_CALL_RUN;
+	}
+
+	struct procedure *proc = context_procedure(ctx, symbol);
+	if (proc->nodes == NULL)
+	{
+		return MEMO_CALL_RUN;
+	}
+	struct memo *memo = memo_analyze(proc, ctx, 0);
+	if (memo->purity != MEMO_PURE)
+	{
+		return MEMO_CALL_RUN;
+	}
+
+	for (size_t i = 0; i < memo->trace_count; i++)
+	{
+		struct memo_trace *trace = &memo->traces[i];
+		if ((trace->angle == ctx->angle || ctx->rigid) && trace->up == ctx->up)
+		{
+			if (!trace->complete)
+			{
+				return MEMO_CALL_RUN;
+			}
+			memo_replay(ctx, trace);
+			if (ctx->stats != NULL)
+			{
+				ctx->stats->replayed++;
+			}
+			return MEMO_CALL_REPLAYED;
+		}
+	}
+
+	if (ctx->recording != NULL || memo->trace_count == MEMO_TRACES_MAX)
+	{
+		return MEMO_CALL_RUN;
+	}
+
+	struct memo_trace *trace = &memo->traces[memo->trace_count++];
+	trace->angle = ctx->angle;
+	trace->direction = ctx->direction;
+	trace->up = ctx->up;
+	ctx->recording = trace;
+	return MEMO_CALL_RECORD;
+}
+
+/**
+ * End the recording of a run, once the body of the procedure ran
+ *
+ * @param ctx the execution context
+ */
+void memo_record_end(struct context *ctx)
+{
+	struct memo_trace *trace = ctx->recording;
+	ctx->recording = NULL;
+	trace->end_angle = ctx->angle;
+	trace->end_direction = ctx->direction;
+	trace->end_up = ctx->up;
+	trace->complete = !trace->overflow;
+}
+
+/**
+ * Append a primitive to the run being recorded
+ *
+ * @param ctx the execution context
+ * @param op the kind of the primitive
+ * @param dx the increment of the abscissa
+ * @param dy the increment of the ordinate
+ *
+ * @return false if the run is too long to be recorded
+ */
+static bool memo_record_step(struct context *ctx, enum memo_op op, double dx, double dy)
+{
+	struct memo_trace *trace = ctx->recording;
+	if (trace->overflow)
+	{
+		return false;
+	}
+	if (trace->step_count == MEMO_STEPS_MAX)
+	{
+		trace->overflow = true;
+		memo_trace_free(trace);
+		return false;
+	}
+	if (trace->step_count == trace->step_capacity)
+	{
+		trace->step_capacity = trace->step_capacity == 0 ? 64 : trace->step_capacity * 2;
+		trace->ops = realloc(trace->ops, trace->step_capacity * sizeof(unsigned char));
+		trace->dxs = realloc(trace->dxs, trace->step_capacity * sizeof(double));
+		trace->dys = realloc(trace->dys, trace->step_capacity * sizeof(double));
+	}
+	trace->ops[trace->step_count] = op;
+	trace->dxs[trace->step_count] = dx;
+	trace->dys[trace->step_count] = dy;
+	trace->step_count++;
+	return true;
+}
+
+/**
+ * Record a move of the turtle
+ *
+ * @param ctx the execution context
+ * @param dx the increment of the abscissa
+ * @param dy the increment of the ordinate
+ * @param line true if the pen was down
+ */
+void memo_record_move(struct context *ctx, double dx, double dy, bool line)
+{
+	memo_record_step(ctx, line ? MEMO_LINE : MEMO_MOVE, dx, dy);
+}
+
+/**
+ * Record a color change
+ *
+ * @param ctx the execution context
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+void memo_record_color(struct context *ctx, double r, double g, double b)
+{
+	if (!memo_record_step(ctx, MEMO_COLOR, 0, 0))
+	{
+		return;
+	}
+	struct memo_trace *trace = ctx->recording;
+	if (trace->color_count == trace->color_capacity)
+	{
+		trace->color_capacity = trace->color_capacity == 0 ? 16 : trace->color_capacity * 2;
+		trace->colors = realloc(trace->colors, trace->color_capacity * sizeof(struct memo_color));
+	}
+	trace->colors[trace->color_count].r = r;
+	trace->colors[trace->color_count].g = g;
+	trace->colors[trace->color_count].b = b;
+	trace->color_count++;
+}
+
+/**
+ * Start a loop: when its body has no side effect and the output may differ
+ * by rounding, its first iteration is recorded to generate the next ones
+ *
+ * @param ctx the execution context
+ * @param body the body of the loop
+ * @param count the number of iterations
+ * @param trace where the first iteration is recorded
+ *
+ * @return true if the first iteration is recorded, then memo_repeat_end
+ * must be called once it ran
+ */
+bool memo_repeat_begin(struct context *ctx, const struct ast_node *body, int count, struct memo_trace *trace)
+{
+	if (!ctx->rigid || count < MEMO_REPEAT_MIN || ctx->recording != NULL || !memo_cmds_pure(body, ctx, 0))
+	{
+		return false;
+	}
+	memset(trace, 0, sizeof(struct memo_trace));
+	trace->angle = ctx->angle;
+	trace->direction = ctx->direction;
+	trace->up = ctx->up;
+	ctx->recording = trace;
+	return true;
+}
+
+/**
+ * Generate the iterations that follow the recorded one: iteration i is the
+ * recorded one turned i times by its net turn. The rotations are composed
+ * from one iteration to the next, and computed again from the heading every
+ * MEMO_REPEAT_ANCHOR iterations so that the rounding errors do not pile up.
+ *
+ * @param ctx the execution context
+ * @param trace the first iteration
+ * @param remaining the number of iterations to generate
+ */
+static void memo_repeat_generate(struct context *ctx, struct memo_trace *trace, int remaining)
+{
+	const struct direction *from = &trace->direction;
+	const struct direction *to = &trace->end_direction;
+	double turn_c = from->dx * to->dx + from->dy * to->dy;
+	double turn_s = from->dx * to->dy - from->dy * to->dx;
+	double turn = trace->end_angle - trace->angle;
+
+	double angle = trace->end_angle;
+	double c = turn_c;
+	double s = turn_s;
+	for (int i = 1; i <= remaining; i++)
+	{
+		if (i % MEMO_REPEAT_ANCHOR == 0)
+		{
+			context_turn(ctx, angle);
+			c = from->dx * ctx->direction.dx + from->dy * ctx->direction.dy;
+			s = from->dx * ctx->direction.dy - from->dy * ctx->direction.dx;
+		}
+		memo_replay_rotated(ctx, trace, c, s);
+		angle = angle + turn;
+		double next_c = c * turn_c - s * turn_s;
+		s = s * turn_c + c * turn_s;
+		c = next_c;
+	}
+	context_turn(ctx, angle);
+}
+
+/**
+ * End the first iteration of a loop started by memo_repeat_begin, and
+ * generate the next ones if it can be repeated as it is: it was not too
+ * long, and it leaves the pen as it found it
+ *
+ * @param ctx the execution context
+ * @param trace the first iteration
+ * @param remaining the number of iterations after the first one
+ *
+ * @return true if the iterations were generated, false if they must be run
+ */
+bool memo_repeat_end(struct context *ctx, struct memo_trace *trace, int remaining)
+{
+	memo_record_end(ctx);
+	bool generated = trace->complete && trace->end_up == trace->up;
+	if (generated)
+	{
+		memo_repeat_generate(ctx, trace, remaining);
+		if (ctx->stats != NULL)
+		{
+			ctx->stats->generated += remaining;
+		}
+	}
+	memo_trace_free(trace);
+	return generated;
+}
+
+/**
+ * Free the recorded runs of a procedure
+ *
+ * @param self what is known of the calls of the procedure
+ */
+void memo_destroy(struct memo *self)
+{
+	for (size_t i = 0; i < self->trace_count; i++)
+	{
+		memo_trace_free(&self->traces[i]);
+	}
+	free(self);
+}
@@ -0,0 +1,131 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_MEMO_H
+#define TURTLE_MEMO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "turtle-ast.h"
+
+/*
+ * Memoized procedure calls
+ *
+ * A procedure without side effects (no random, no set, no proc, no print,
+ * no position nor home, and only calls to such procedures) always draws
+ * the same thing from the same heading and pen. Its first call from a
+ * given heading and pen is recorded as the increments of the position of
+ * each move, and the next calls from the same heading and pen replay them
+ * from wherever the turtle is. Adding the recorded increments performs the
+ * very same operations as running the body, so the output does not change.
+ *
+ * With rigid, a run is also replayed from other headings: its increments
+ * are rotated from the recorded direction to the current one. The output
+ * then only differs by rounding, and setting the heading counts as a side
+ * effect since it does not rotate with the rest of the run.
+ *
+ * A loop whose body has no side effect is a rigid transform repeated: each
+ * iteration draws the first one turned by the net turn of the body. With
+ * rigid, only the first iteration is run and recorded, the next ones are
+ * generated by rotating its increments.
+ */
+
+// recorded runs kept for each procedure, from different headings and pens
+#define MEMO_TRACES_MAX 4
+
+// primitives of a recorded run, longer runs are not recorded
+#define MEMO_STEPS_MAX (1 << 20)
+
+// nested calls followed to decide whether a procedure has side effects
+#define MEMO_DEPTH_MAX 64
+
+// iterations a loop needs to be generated from its first one
+#define MEMO_REPEAT_MIN 4
+
+// generated iterations between two exact computations of their rotation
+#define MEMO_REPEAT_ANCHOR 64
+
+// kind of a recorded primitive
+enum memo_op
+{
+	MEMO_MOVE,	// a move with the pen up
+	MEMO_LINE,	// a move with the pen down
+	MEMO_COLOR, // a color change
+};
+
+// a recorded color
+struct memo_color
+{
+	double r;
+	double g;
+	double b;
+};
+
+// a run of a procedure from a heading and a pen
+struct memo_trace
+{
+	double angle;				 // the heading at the start of the run
+	struct direction direction; // its direction
+	bool up;					 // the pen at the start of the run
+
+	double end_angle;				 // the heading at the end of the run
+	struct direction end_direction;	 // its direction
+	bool end_up;					 // the pen at the end of the run
+
+	// the primitives, as one array per field: ops[i] is the kind of the
+	// i-th one, dxs[i] and dys[i] the increments of the position, zero for
+	// a color, and the colors are taken in their order from colors
+	unsigned char *ops;
+	double *dxs;
+	double *dys;
+	size_t step_count;
+	size_t step_capacity;
+	struct memo_color *colors;
+	size_t color_count;
+	size_t color_capacity;
+
+	// the positions after each primitive relative to the start, summed
+	// from the increments the first time the run is replayed rotated
+	double *pxs;
+	double *pys;
+
+	bool complete; // false while the run is recorded, or when it was too long
+	bool overflow; // the run had more than MEMO_STEPS_MAX primitives
+};
+
+// whether a procedure can be memoized
+enum memo_purity
+{
+	MEMO_UNKNOWN, // not analyzed yet
+	MEMO_PURE,	  // no side effect
+	MEMO_IMPURE,  // some side effect, always run
+};
+
+// what is known of the calls of a procedure
+struct memo
+{
+	enum memo_purity purity;
+	struct memo_trace traces[MEMO_TRACES_MAX];
+	size_t trace_count;
+};
+
+// what a call has to do
+enum memo_call
+{
+	MEMO_CALL_RUN,		// run the body
+	MEMO_CALL_RECORD,	// run the body, then call memo_record_end
+	MEMO_CALL_REPLAYED, // nothing, the call was replayed
+};
+
+enum memo_call memo_call(struct context *ctx, size_t symbol);
+void memo_record_end(struct context *ctx);
+void memo_destroy(struct memo *self);
+
+// loops generated from their first iteration
+bool memo_repeat_begin(struct context *ctx, const struct ast_node *body, int count, struct memo_trace *trace);
+bool memo_repeat_end(struct context *ctx, struct memo_trace *trace, int remaining);
+
+// primitives of the run being recorded
+void memo_record_move(struct context *ctx, double dx, double dy, bool line);
+void memo_record_color(struct context *ctx, double r, double g, double b);
+
+#endif /* TURTLE_MEMO_H */
@@ -0,0 +1,527 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-optimize.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * The optimizer never changes what the program draws or prints:
+ *   - the range of the arguments of right, left, heading, sqrt, sin and cos
+ *     is only checked for literals, so an argument that becomes a literal
+ *     is kept between parentheses;
+ *   - the arguments of position, color and random are looked up by their
+ *     shape, so only their operands are optimized;
+ *   - print shows its expression, which is left as it was written;
+ *   - a variable is replaced by its value only after the one set command
+ *     of the program that defines it, when this command is run exactly once.
+ * The nodes that change are copied, the parsed program is left untouched
+ * so that it can still be printed.
+ */
+
+// the state of the optimizer
+struct optimizer
+{
+	struct arena *arena;	   // where the new nodes are allocated
+	size_t symbol_count;	   // the number of symbols of the program
+	size_t *set_counts;		   // set_counts[symbol] is the number of set commands of the symbol
+	bool *known;			   // known[symbol] tells whether the variable has a known value
+	double *values;			   // values[symbol] is the value of a known variable
+	struct optimize_stats *stats;
+};
+
+static struct ast_node *optimizer_expr(struct optimizer *self, struct ast_node *node);
+static struct ast_node *optimizer_cmds(struct optimizer *self, struct ast_node *node, bool once);
+
+/**
+ * Count the set commands of each symbol in a sequence of commands and in their bodies
+ *
+ * @param self the optimizer
+ * @param node the first command of the sequence
+ */
+static void optimizer_count_sets(struct optimizer *self, const struct ast_node *node)
+{
+	for (; node != NULL; node = node->next)
+	{
+		switch (node->kind)
+		{
+		case KIND_CMD_SET:
+			// the evaluators use the symbol of the target whatever its kind
+			if (node->children[0]->symbol < self->symbol_count)
+			{
+				self->set_counts[node->children[0]->symbol]++;
+			}
+			break;
+		case KIND_CMD_REPEAT:
+		case KIND_CMD_PROC:
+			optimizer_count_sets(self, node->children[1]);
+			break;
+		case KIND_CMD_BLOCK:
+			optimizer_count_sets(self, node->children[0]);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * Give a node new children, the node is copied only if one of them changed
+ *
+ * @param self the optimizer
+ * @param node the node
+ * @param children the new children, as many as the node has
+ *
+ * @return the node or its copy
+ */
+static struct ast_node *optimizer_rebuild(struct optimizer *self, struct ast_node *node, struct ast_node **children)
+{
+	if (memcmp(node->children, children, node->children_count * sizeof(struct ast_node *)) == 0)
+	{
+		return node;
+	}
+	struct ast_node *copy = ast_node_copy(self->arena, node);
+	memcpy(copy->children, children, node->children_count * sizeof(struct ast_node *));
+	return copy;
+}
+
+/**
+ * Create a literal holding the value of a folded expression
+ *
+ * @param self the optimizer
+ * @param value the value of the expression
+ *
+ * @return the new literal
+ */
+static struct ast_node *optimizer_value(struct optimizer *self, double value)
+{
+	self->stats->folded++;
+	return make_expr_value(self->arena, value);
+}
+
+/**
+ * Tell whether a node is a literal with a given value
+ *
+ * @param node the node
+ * @param value the value
+ *
+ * @return true if the node is a literal holding exactly this value, with the same sign
+ */
+static bool optimizer_is(const struct ast_node *node, double value)
+{
+	return node->kind == KIND_EXPR_VALUE && node->u.value == value && signbit(node->u.value) == signbit(value);
+}
+
+/**
+ * Optimize the operands of a node whose shape is used by the evaluators,
+ * the node itself is kept
+ *
+ * @param self the optimizer
+ * @param node the node, may be NULL
+ *
+ * @return the node or its copy with optimized operands
+ */
+static struct ast_node *optimizer_operands(struct optimizer *self, struct ast_node *node)
+{
+	if (node == NULL || node->children_count == 0)
+	{
+		return node;
+	}
+	struct ast_node *children[AST_CHILDREN_MAX];
+	for (size_t i = 0; i < node->children_count; i++)
+	{
+		children[i] = optimizer_expr(self, node->children[i]);
+	}
+	return optimizer_rebuild(self, node, children);
+}
+
+/**
+ * Optimize an argument whose range is checked when it is a literal, an
+ * argument that was not a literal must not become one
+ *
+ * @param self the optimizer
+ * @param node the argument
+ *
+ * @return the optimized argument
+ */
+static struct ast_node *optimizer_checked(struct optimizer *self, struct ast_node *node)
+{
+	struct ast_node *result = optimizer_expr(self, node);
+	if (result != NULL && result->kind == KIND_EXPR_VALUE && node->kind != KIND_EXPR_VALUE)
+	{
+		if (node->kind == KIND_EXPR_BLOCK && node->children[0] == result)
+		{
+			self->stats->parentheses--;
+			return node;
+		}
+		return make_expr_parentheses(self->arena, result);
+	}
+	return result;
+}
+
+/**
+ * Optimize a binary operation
+ *
+ * @param self the optimizer
+ * @param node the operation
+ *
+ * @return the optimized operation
+ */
+static struct ast_node *optimizer_binop(struct optimizer *self, struct ast_node *node)
+{
+	// the comma is only meaningful as an argument of position, color and random, elsewhere it is 0
+	if (node->u.op == ',')
+	{
+		return optimizer_value(self, 0);
+	}
+
+	struct ast_node *children[2] = {
+		optimizer_expr(self, node->children[0]),
+		optimizer_expr(self, node->children[1]),
+	};
+	struct ast_node *left = children[0];
+	struct ast_node *right = children[1];
+
+	if (left->kind == KIND_EXPR_VALUE && right->kind == KIND_EXPR_VALUE)
+	{
+		double a = left->u.value;
+		double b = right->u.value;
+		switch (node->u.op)
+		{
+		case '+':
+			return optimizer_value(self, a + b);
+		case '-':
+			return optimizer_value(self, a - b);
+		case '*':
+			return optimizer_value(self, a * b);
+		case '/':
+			return optimizer_value(self, a / b);
+		case '^':
+			return optimizer_value(self, pow(a, b));
+		default:
+			return optimizer_value(self, 0);
+		}
+	}
+
+	// identities that give the exact same double, whatever the other operand is
+	struct ast_node *operand = NULL;
+	switch (node->u.op)
+	{
+	case '-':
+		operand = optimizer_is(right, 0) ? left : NULL;
+		break;
+	case '*':
+		operand = optimizer_is(right, 1) ? left : optimizer_is(left, 1) ? right : NULL;
+		break;
+	case '/':
+	case '^':
+		operand = optimizer_is(right, 1) ? left : NULL;
+		break;
+	default:
+		break;
+	}
+	if (operand != NULL)
+	{
+		self->stats->reduced++;
+		return operand;
+	}
+
+	return optimizer_rebuild(self, node, children);
+}
+
+/**
+ * Optimize a call of a function
+ *
+ * @param self the optimizer
+ * @param node the call
+ *
+ * @return the optimized call
+ */
+static struct ast_node *optimizer_func(struct optimizer *self, struct ast_node *node)
+{
+	if (node->u.func == FUNC_RANDOM)
+	{
+		// random (min, max): only the bounds are optimized
+		struct ast_node *parenthese = node->children[0];
+		if (parenthese == NULL || parenthese->children_count == 0)
+		{
+			return node;
+		}
+		struct ast_node *virgule = optimizer_operands(self, parenthese->children[0]);
+		struct ast_node *children[1] = {optimizer_rebuild(self, parenthese, &virgule)};
+		return optimizer_rebuild(self, node, children);
+	}
+
+	struct ast_node *arg = node->children[0];
+	struct ast_node *result = optimizer_expr(self, arg);
+	if (result->kind != KIND_EXPR_VALUE)
+	{
+		return optimizer_rebuild(self, node, &result);
+	}
+
+	double value = result->u.value;
+	switch (node->u.func)
+	{
+	case FUNC_SQRT:
+		if (arg->kind == KIND_EXPR_VALUE && !(value >= 0))
+		{
+			return node;
+		}
+		return optimizer_value(self, sqrt(value));
+	case FUNC_SIN:
+		if (arg->kind == KIND_EXPR_VALUE && !(value >= 0 && value <= 90))
+		{
+			return node;
+		}
+		return optimizer_value(self, sin(value));
+	case FUNC_COS:
+		if (arg->kind == KIND_EXPR_VALUE && !(value >= 0 && value <= 180))
+		{
+			return node;
+		}
+		return optimizer_value(self, cos(value));
+	case FUNC_TAN:
+		return optimizer_value(self, tan(value));
+	default:
+		return node;
+	}
+}
+
+/**
+ * Optimize an expression
+ *
+ * @param self the optimizer
+ * @param node the expression, may be NULL
+ *
+ * @return the optimized expression, the same node if nothing changed
+ */
+static struct ast_node *optimizer_expr(struct optimizer *self, struct ast_node *node)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	switch (node->kind)
+	{
+	case KIND_EXPR_NAME:
+		if (node->symbol < self->symbol_count && self->known[node->symbol])
+		{
+			return optimizer_value(self, self->values[node->symbol]);
+		}
+		return node;
+	case KIND_EXPR_BLOCK:
+		self->stats->parentheses++;
+		return optimizer_expr(self, node->children[0]);
+	case KIND_EXPR_UNOP:
+	{
+		struct ast_node *child = optimizer_expr(self, node->children[0]);
+		if (child->kind == KIND_EXPR_VALUE)
+		{
+			return optimizer_value(self, -child->u.value);
+		}
+		return optimizer_rebuild(self, node, &child);
+	}
+	case KIND_EXPR_BINOP:
+		return optimizer_binop(self, node);
+	case KIND_EXPR_FUNC:
+		return optimizer_func(self, node);
+	default:
+		return node;
+	}
+}
+
+/**
+ * Optimize a simple command
+ *
+ * @param self the optimizer
+ * @param node the command
+ *
+ * @return the optimized command
+ */
+static struct ast_node *optimizer_simple(struct optimizer *self, struct ast_node *node)
+{
+	struct ast_node *arg;
+	switch (node->u.cmd)
+	{
+	case CMD_FORWARD:
+	case CMD_BACKWARD:
+		arg = optimizer_expr(self, node->children[0]);
+		break;
+	case CMD_RIGHT:
+	case CMD_LEFT:
+	case CMD_HEADING:
+		arg = optimizer_checked(self, node->children[0]);
+		break;
+	case CMD_POSITION:
+		arg = optimizer_operands(self, node->children[0]);
+		break;
+	case CMD_COLOR:
+	{
+		// color r, g, b: the first two components are the operands of the first child
+		struct ast_node *child = node->children[0];
+		if (child->children_count == 0)
+		{
+			return node;
+		}
+		struct ast_node *children[AST_CHILDREN_MAX];
+		children[0] = optimizer_operands(self, child->children[0]);
+		for (size_t i = 1; i < child->children_count; i++)
+		{
+			children[i] = optimizer_expr(self, child->children[i]);
+		}
+		arg = optimizer_rebuild(self, child, children);
+	}
+	break;
+	default:
+		return node;
+	}
+	return optimizer_rebuild(self, node, &arg);
+}
+
+/**
+ * Optimize a single command, without the commands that follow it
+ *
+ * @param self the optimizer
+ * @param node the command
+ * @param once true if the command is run exactly once, each time the program is run
+ *
+ * @return the optimized command, the same node if nothing changed
+ */
+static struct ast_node *optimizer_cmd(struct optimizer *self, struct ast_node *node, bool once)
+{
+	struct ast_node *children[2];
+	switch (node->kind)
+	{
+	case KIND_CMD_SIMPLE:
+		return optimizer_simple(self, node);
+	case KIND_CMD_BLOCK:
+		children[0] = optimizer_cmds(self, node->children[0], once);
+		return optimizer_rebuild(self, node, children);
+	case KIND_CMD_REPEAT:
+		children[0] = optimizer_expr(self, node->children[0]);
+		children[1] = optimizer_cmds(self, node->children[1], false);
+		return optimizer_rebuild(self, node, children);
+	case KIND_CMD_PROC:
+		children[0] = node->children[0];
+		children[1] = optimizer_cmds(self, node->children[1], false);
+		return optimizer_rebuild(self, node, children);
+	case KIND_CMD_SET:
+	{
+		children[0] = node->children[0];
+		children[1] = optimizer_expr(self, node->children[1]);
+		size_t symbol = children[0]->symbol;
+		if (once && children[1]->kind == KIND_EXPR_VALUE && symbol < self->symbol_count && self->set_counts[symbol] == 1 && !self->known[symbol])
+		{
+			self->known[symbol] = true;
+			self->values[symbol] = children[1]->u.value;
+		}
+		return optimizer_rebuild(self, node, children);
+	}
+	default:
+		return node;
+	}
+}
+
+/**
+ * Optimize a sequence of commands. The commands before the last one that
+ * changed are copied so that they can be linked to it, the ones after it
+ * are shared with the original sequence.
+ *
+ * @param self the optimizer
+ * @param node the first command of the sequence
+ * @param once true if the sequence is run exactly once, each time the program is run
+ *
+ * @return the first command of the optimized sequence
+ */
+static struct ast_node *optimizer_cmds(struct optimizer *self, struct ast_node *node, bool once)
+{
+	size_t count = 0;
+	for (const struct ast_node *it = node; it != NULL; it = it->next)
+	{
+		count++;
+	}
+	if (count == 0)
+	{
+		return NULL;
+	}
+
+	// the original commands, then their optimized versions
+	struct ast_node **cmds = malloc(2 * count * sizeof(struct ast_node *));
+	struct ast_node **optimized = cmds + count;
+	size_t last_changed = count;
+	size_t i = 0;
+	for (struct ast_node *it = node; it != NULL; it = it->next, i++)
+	{
+		cmds[i] = it;
+		optimized[i] = optimizer_cmd(self, it, once);
+		if (optimized[i] != it)
+		{
+			last_changed = i;
+		}
+	}
+
+	struct ast_node *first = node;
+	if (last_changed < count)
+	{
+		// a changed command is a copy that is already linked to the original tail
+		struct ast_node *next = optimized[last_changed];
+		for (size_t j = last_changed; j-- > 0;)
+		{
+			struct ast_node *cmd = optimized[j];
+			if (cmd == cmds[j])
+			{
+				cmd = ast_node_copy(self->arena, cmd);
+			}
+			cmd->next = next;
+			next = cmd;
+		}
+		first = next;
+		self->stats->commands += last_changed + 1;
+	}
+	free(cmds);
+	return first;
+}
+
+/**
+ * Build the optimized program of a tree, the evaluators run it instead of the parsed one
+ *
+ * @param self the tree
+ * @param stats where the work done by the optimizer is counted
+ */
+void ast_optimize(struct ast *self, struct optimize_stats *stats)
+{
+	memset(stats, 0, sizeof(struct optimize_stats));
+
+	struct optimizer optimizer;
+	optimizer.arena = &self->arena;
+	optimizer.symbol_count = self->symbols.count;
+	optimizer.set_counts = calloc(optimizer.symbol_count + 1, sizeof(size_t));
+	optimizer.known = calloc(optimizer.symbol_count + 1, sizeof(bool));
+	optimizer.values = calloc(optimizer.symbol_count + 1, sizeof(double));
+	optimizer.stats = stats;
+
+	// the builtin variables cannot be set again
+	static const struct
+	{
+		const char *name;
+		double value;
+	} builtins[] = {{"PI", PI}, {"SQRT2", SQRT2}, {"SQRT3", SQRT3}};
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+	{
+		size_t symbol = symbol_find(&self->symbols, builtins[i].name);
+		if (symbol != SYMBOL_NONE)
+		{
+			optimizer.known[symbol] = true;
+			optimizer.values[symbol] = builtins[i].value;
+		}
+	}
+
+	optimizer_count_sets(&optimizer, self->unit);
+	self->optimized = optimizer_cmds(&optimizer, self->unit, true);
+
+	free(optimizer.set_counts);
+	free(optimizer.known);
+	free(optimizer.values);
+}
@@ -0,0 +1,21 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_OPTIMIZE_H
+#define TURTLE_OPTIMIZE_H
+
+#include <stddef.h>
+
+#include "turtle-ast.h"
+
+// what the optimizer did to the tree
+struct optimize_stats
+{
+	size_t folded;		// expressions replaced by their value
+	size_t parentheses; // parentheses removed
+	size_t reduced;		// operations replaced by one of their operands
+	size_t commands;	// commands rewritten because one of their arguments changed
+};
+
+// build the optimized program run by the evaluators, the parsed program is left untouched
+void ast_optimize(struct ast *self, struct optimize_stats *stats);
+
+#endif /* TURTLE_OPTIMIZE_H */
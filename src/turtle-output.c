@@ -0,0 +1,761 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-output.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// room always left in the buffer for one primitive
+#define OUTPUT_LINE_MAX 2048
+
+// points of a line that may be merged into a single segment
+#define OUTPUT_SIMPLIFY_POINTS 256
+
+// deviation below which the points are collinear, relative to the size of the coordinates
+#define OUTPUT_SIMPLIFY_EPSILON 1e-9
+
+// a point of the drawing
+struct output_point
+{
+	double x;
+	double y;
+};
+
+// the state of the simplification: the primitives are held back until
+// it is known whether they can be merged with the next ones
+struct output_simplifier
+{
+	double tolerance;	  // how far a merged line may stray from the points it replaces
+	struct output_point pen; // the last point written, the drawing starts at the origin
+	bool move;			  // whether a move to target is held back
+	struct output_point target;
+	bool color;			  // whether a color change is held back
+	double r, g, b;		  // the color held back
+	bool colored;		  // whether a color was written
+	double cr, cg, cb;	  // the last color written
+	struct output_point line[OUTPUT_SIMPLIFY_POINTS]; // the points of the line held back, from the pen
+	size_t line_count;
+};
+
+static const double powers_of_ten[OUTPUT_PRECISION_MAX + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+static void output_simplifier_flush(struct output *self);
+
+// a buffer of an output, kept by a fragment until it is appended
+struct output_chunk
+{
+	struct output_chunk *next; // the next buffer of the fragment
+	size_t size;			   // the number of bytes in data
+	char data[];
+};
+
+/**
+ * Allocate a buffer
+ *
+ * @param capacity the number of bytes it can hold
+ *
+ * @return the buffer, empty
+ */
+static struct output_chunk *output_chunk_create(size_t capacity)
+{
+	struct output_chunk *chunk = malloc(sizeof(struct output_chunk) + capacity);
+	chunk->next = NULL;
+	chunk->size = 0;
+	return chunk;
+}
+
+/**
+ * Get the chunk holding the buffer of an output
+ *
+ * @param buffer the buffer
+ *
+ * @return its chunk
+ */
+static struct output_chunk *output_chunk_of(char *buffer)
+{
+	return (struct output_chunk *)(buffer - offsetof(struct output_chunk, data));
+}
+
+/**
+ * Hand bytes to the stream, the time it takes is counted
+ *
+ * @param self the output
+ * @param data the bytes
+ * @param size the number of bytes
+ */
+static void output_fwrite(struct output *self, const char *data, size_t size)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fwrite(data, 1, size, self->stream);
+	if (self->copy != NULL)
+	{
+		fwrite(data, 1, size, self->copy);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	self->write_ns += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+}
+
+/**
+ * Hand bytes to the stream, or keep them for a fragment
+ *
+ * @param self the output
+ * @param chunk the chunk of the bytes, a fragment takes it
+ * @param size the number of bytes
+ */
+static void output_write_chunk(struct output *self, struct output_chunk *chunk, size_t size)
+{
+	if (self->fragment)
+	{
+		chunk->size = size;
+		*self->last = chunk;
+		self->last = &chunk->next;
+	}
+	else
+	{
+		output_fwrite(self, chunk->data, size);
+	}
+	self->written += size;
+}
+
+/**
+ * Hand the buffer to the stream, a fragment keeps it and starts a new one
+ *
+ * @param self the output
+ */
+static void output_write_buffer(struct output *self)
+{
+	if (self->used > 0)
+	{
+		output_write_chunk(self, output_chunk_of(self->buffer), self->used);
+		if (self->fragment)
+		{
+			self->buffer = output_chunk_create(OUTPUT_BUFFER_SIZE)->data;
+		}
+		self->used = 0;
+	}
+}
+
+/**
+ * Hand bytes too large for the buffer to the stream, once the buffer is written
+ *
+ * @param self the output
+ * @param data the bytes
+ * @param size the number of bytes
+ */
+static void output_write_large(struct output *self, const char *data, size_t size)
+{
+	if (self->fragment)
+	{
+		struct output_chunk *chunk = output_chunk_create(size);
+		memcpy(chunk->data, data, size);
+		output_write_chunk(self, chunk, size);
+	}
+	else
+	{
+		output_fwrite(self, data, size);
+		self->written += size;
+	}
+}
+
+/**
+ * Hand the buffered primitives to the stream, including the ones held back by the simplification
+ *
+ * @param self the output
+ */
+void output_flush(struct output *self)
+{
+	if (self->simplify != NULL)
+	{
+		output_simplifier_flush(self);
+	}
+	output_write_buffer(self);
+}
+
+/**
+ * Make sure there is room for one more primitive in the buffer
+ *
+ * @param self the output
+ *
+ * @return where the primitive can be written
+ */
+static char *output_reserve(struct output *self)
+{
+	if (self->used + OUTPUT_LINE_MAX > OUTPUT_BUFFER_SIZE)
+	{
+		output_write_buffer(self);
+	}
+	return self->buffer + self->used;
+}
+
+/**
+ * Initialize an output sink, the header is written right away for the binary formats
+ *
+ * @param self the output to initialize
+ * @param stream the stream where the primitives are written
+ * @param format how the primitives are encoded
+ * @param precision the number of decimals of the numbers, for the text format
+ */
+void output_create(struct output *self, FILE *stream, enum output_format format, int precision)
+{
+	assert(precision >= 0 && precision <= OUTPUT_PRECISION_MAX);
+	self->stream = stream;
+	self->format = format;
+	self->precision = precision;
+	self->buffer = output_chunk_create(OUTPUT_BUFFER_SIZE)->data;
+	self->used = 0;
+	self->written = 0;
+	self->primitives = 0;
+	self->requested = 0;
+	self->simplify = NULL;
+	self->write_ns = 0;
+	self->fragment = false;
+	self->chunks = NULL;
+	self->last = &self->chunks;
+	self->copy = NULL;
+
+	if (format != OUTPUT_TEXT)
+	{
+		char *p = self->buffer;
+		memcpy(p, OUTPUT_MAGIC, OUTPUT_MAGIC_SIZE);
+		p[4] = OUTPUT_VERSION;
+		p[5] = format == OUTPUT_BINARY64 ? OUTPUT_FLAG_DOUBLE : 0;
+		p[6] = 0;
+		p[7] = 0;
+		self->used = OUTPUT_HEADER_SIZE;
+	}
+}
+
+/**
+ * Initialize an output sink for a part of the primitives of another output:
+ * its full buffers are kept in memory until they are appended to the other
+ * output, and there is neither header nor end record, even for the binary formats
+ *
+ * @param self the output to initialize
+ * @param format how the primitives are encoded, the format of the other output
+ * @param precision the number of decimals of the numbers, for the text format
+ */
+void output_create_fragment(struct output *self, enum output_format format, int precision)
+{
+	output_create(self, NULL, format, precision);
+	self->used = 0;
+	self->fragment = true;
+}
+
+/**
+ * Flush and free the memory allocated for an output sink
+ *
+ * @param self the output to release
+ * @param end whether the drawing is complete, then the binary formats end with an end record
+ */
+static void output_release(struct output *self, bool end)
+{
+	if (self->simplify != NULL)
+	{
+		output_simplifier_flush(self);
+		free(self->simplify);
+		self->simplify = NULL;
+	}
+	if (end && self->format != OUTPUT_TEXT && !self->fragment)
+	{
+		char *p = output_reserve(self);
+		*p = OUTPUT_RECORD_END;
+		self->used++;
+	}
+	output_write_buffer(self);
+	free(output_chunk_of(self->buffer));
+	while (self->chunks != NULL)
+	{
+		struct output_chunk *next = self->chunks->next;
+		free(self->chunks);
+		self->chunks = next;
+	}
+}
+
+/**
+ * Terminate the stream, flush and free the memory allocated for an output sink
+ *
+ * @param self the output to destroy
+ */
+void output_destroy(struct output *self)
+{
+	output_release(self, true);
+}
+
+/**
+ * Flush and free the memory allocated for an output sink whose drawing
+ * stopped on an error: the stream is left as when the process exits on
+ * the error, without end record
+ *
+ * @param self the output to destroy
+ */
+void output_abort(struct output *self)
+{
+	output_release(self, false);
+}
+
+/**
+ * Free the memory allocated for an output sink whose drawing is written by
+ * other means: nothing is handed to the stream, not even the header
+ *
+ * @param self the output to destroy
+ */
+void output_discard(struct output *self)
+{
+	free(self->simplify);
+	self->simplify = NULL;
+	self->used = 0;
+	output_release(self, false);
+}
+
+/**
+ * Copy the bytes handed to the stream of an output to another stream too,
+ * from the next ones on
+ *
+ * @param self the output
+ * @param copy the other stream, NULL to stop copying
+ */
+void output_copy(struct output *self, FILE *copy)
+{
+	self->copy = copy;
+}
+
+/**
+ * Format a number with a fixed number of decimals. The result is the same
+ * as printf("%.*f"): the exact value of the double is rounded half to even,
+ * using fma to get the rounding error of the scaling. Numbers that are too
+ * big for a 64 bits integer, infinities and NaN are left to snprintf.
+ *
+ * @param buf where the text is written
+ * @param value the number to format
+ * @param precision the number of decimals
+ *
+ * @return the end of the text
+ */
+char *output_format_double(char *buf, double value, int precision)
+{
+	double scale = powers_of_ten[precision];
+	double magnitude = fabs(value);
+
+	if (!(magnitude < 4e15 / scale))
+	{
+		return buf + snprintf(buf, OUTPUT_LINE_MAX / 4, "%.*f", precision, value);
+	}
+
+	// magnitude * scale == scaled + error exactly
+	double scaled = magnitude * scale;
+	double error = fma(magnitude, scale, -scaled);
+	double integral = floor(scaled);
+	double fraction = scaled - integral;
+	uint64_t digits = (uint64_t)integral;
+
+	if (fraction > 0.5 || (fraction == 0.5 && (error > 0 || (error == 0 && (digits & 1) != 0))))
+	{
+		digits++;
+	}
+
+	char tmp[32];
+	char *end = tmp + sizeof(tmp);
+	char *p = end;
+	for (int i = 0; i < precision; i++)
+	{
+		*--p = '0' + digits % 10;
+		digits /= 10;
+	}
+	if (precision > 0)
+	{
+		*--p = '.';
+	}
+	do
+	{
+		*--p = '0' + digits % 10;
+		digits /= 10;
+	} while (digits != 0);
+	if (signbit(value))
+	{
+		*--p = '-';
+	}
+
+	size_t size = end - p;
+	memcpy(buf, p, size);
+	return buf + size;
+}
+
+/**
+ * Encode a number of a binary record in little endian
+ *
+ * @param self the output
+ * @param p where the number is written
+ * @param value the number
+ *
+ * @return the end of the number
+ */
+static char *output_put_number(const struct output *self, char *p, double value)
+{
+	if (self->format == OUTPUT_BINARY64)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 8; i++)
+		{
+			*p++ = (char)(bits >> (8 * i));
+		}
+	}
+	else
+	{
+		float single = value;
+		uint32_t bits;
+		memcpy(&bits, &single, sizeof(bits));
+		for (int i = 0; i < 4; i++)
+		{
+			*p++ = (char)(bits >> (8 * i));
+		}
+	}
+	return p;
+}
+
+/**
+ * Write a primitive with two coordinates
+ *
+ * @param self the output
+ * @param record the opcode of the primitive in the binary formats
+ * @param keyword the primitive in the text format, preceded by a line break
+ * @param size the size of the keyword
+ * @param x the abscissa
+ * @param y the ordinate
+ */
+static void output_write_point(struct output *self, enum output_record record, const char *keyword, size_t size, double x, double y)
+{
+	char *p = output_reserve(self);
+	char *start = p;
+	self->primitives++;
+	if (self->format != OUTPUT_TEXT)
+	{
+		*p++ = record;
+		p = output_put_number(self, p, x);
+		p = output_put_number(self, p, y);
+		self->used += p - start;
+		return;
+	}
+	memcpy(p, keyword, size);
+	p += size;
+	p = output_format_double(p, x, self->precision);
+	*p++ = ' ';
+	p = output_format_double(p, y, self->precision);
+	self->used += p - start;
+}
+
+/**
+ * Write a color change
+ *
+ * @param self the output
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void output_write_color(struct output *self, double r, double g, double b)
+{
+	char *p = output_reserve(self);
+	char *start = p;
+	self->primitives++;
+	if (self->format != OUTPUT_TEXT)
+	{
+		*p++ = OUTPUT_RECORD_COLOR;
+		p = output_put_number(self, p, r);
+		p = output_put_number(self, p, g);
+		p = output_put_number(self, p, b);
+		self->used += p - start;
+		return;
+	}
+	memcpy(p, "\nColor ", 7);
+	p += 7;
+	p = output_format_double(p, r, self->precision);
+	*p++ = ' ';
+	p = output_format_double(p, g, self->precision);
+	*p++ = ' ';
+	p = output_format_double(p, b, self->precision);
+	self->used += p - start;
+}
+
+/**
+ * Check whether the points held back stay close enough to a segment
+ *
+ * @param simplify the simplification
+ * @param to the end of the segment, which starts at the pen
+ *
+ * @return true if every point held back is within the tolerance of the segment
+ */
+static bool output_simplifier_fits(const struct output_simplifier *simplify, struct output_point to)
+{
+	double dx = to.x - simplify->pen.x;
+	double dy = to.y - simplify->pen.y;
+	double length = hypot(dx, dy);
+	double scale = fmax(1.0, fmax(fmax(fabs(to.x), fabs(to.y)), fmax(fabs(simplify->pen.x), fabs(simplify->pen.y))));
+	double tolerance = fmax(simplify->tolerance, OUTPUT_SIMPLIFY_EPSILON * scale);
+
+	for (size_t i = 0; i < simplify->line_count; i++)
+	{
+		double px = simplify->line[i].x - simplify->pen.x;
+		double py = simplify->line[i].y - simplify->pen.y;
+		if (length == 0)
+		{
+			// the line comes back to the pen
+			if (hypot(px, py) > tolerance)
+			{
+				return false;
+			}
+			continue;
+		}
+		// distance to the line and position along the segment, both scaled by its length
+		double across = fabs(dx * py - dy * px);
+		double along = dx * px + dy * py;
+		if (across > tolerance * length || along < -tolerance * length || along > length * (length + tolerance))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Write the line held back as a single segment
+ *
+ * @param self the output
+ */
+static void output_simplifier_flush_line(struct output *self)
+{
+	struct output_simplifier *simplify = self->simplify;
+	if (simplify->line_count > 0)
+	{
+		struct output_point end = simplify->line[simplify->line_count - 1];
+		output_write_point(self, OUTPUT_RECORD_LINE_TO, "\nLineTo ", 8, end.x, end.y);
+		simplify->pen = end;
+		simplify->line_count = 0;
+	}
+}
+
+/**
+ * Write everything held back by the simplification
+ *
+ * @param self the output
+ */
+static void output_simplifier_flush(struct output *self)
+{
+	struct output_simplifier *simplify = self->simplify;
+	output_simplifier_flush_line(self);
+	if (simplify->move)
+	{
+		output_write_point(self, OUTPUT_RECORD_MOVE_TO, "\nMoveTo ", 8, simplify->target.x, simplify->target.y);
+		simplify->pen = simplify->target;
+		simplify->move = false;
+	}
+	if (simplify->color)
+	{
+		output_write_color(self, simplify->r, simplify->g, simplify->b);
+		simplify->colored = true;
+		simplify->cr = simplify->r;
+		simplify->cg = simplify->g;
+		simplify->cb = simplify->b;
+		simplify->color = false;
+	}
+}
+
+/**
+ * Simplify the primitives written from now on
+ *
+ * @param self the output
+ * @param tolerance how far the merged lines may stray from the points they replace, 0 to merge only collinear lines
+ */
+void output_simplify(struct output *self, double tolerance)
+{
+	assert(self->simplify == NULL);
+	struct output_simplifier *simplify = calloc(1, sizeof(struct output_simplifier));
+	simplify->tolerance = tolerance;
+	self->simplify = simplify;
+}
+
+/**
+ * Write a move of the turtle with the pen up. Successive moves are merged,
+ * and a move to where the pen already is is dropped.
+ *
+ * @param self the output
+ * @param x the abscissa of the destination
+ * @param y the ordinate of the destination
+ */
+void output_move_to(struct output *self, double x, double y)
+{
+	self->requested++;
+	struct output_simplifier *simplify = self->simplify;
+	if (simplify == NULL)
+	{
+		output_write_point(self, OUTPUT_RECORD_MOVE_TO, "\nMoveTo ", 8, x, y);
+		return;
+	}
+
+	output_simplifier_flush_line(self);
+	simplify->move = x != simplify->pen.x || y != simplify->pen.y;
+	simplify->target.x = x;
+	simplify->target.y = y;
+}
+
+/**
+ * Write a move of the turtle with the pen down. Lines are held back while
+ * the next points stay on them, and lines of length zero are dropped.
+ *
+ * @param self the output
+ * @param x the abscissa of the destination
+ * @param y the ordinate of the destination
+ */
+void output_line_to(struct output *self, double x, double y)
+{
+	self->requested++;
+	struct output_simplifier *simplify = self->simplify;
+	if (simplify == NULL)
+	{
+		output_write_point(self, OUTPUT_RECORD_LINE_TO, "\nLineTo ", 8, x, y);
+		return;
+	}
+
+	struct output_point to = {x, y};
+	struct output_point from = simplify->move ? simplify->target : simplify->line_count > 0 ? simplify->line[simplify->line_count - 1] : simplify->pen;
+	if (to.x == from.x && to.y == from.y)
+	{
+		return;
+	}
+
+	if (simplify->move || simplify->color)
+	{
+		output_simplifier_flush(self);
+	}
+
+	if (simplify->line_count == OUTPUT_SIMPLIFY_POINTS || !output_simplifier_fits(simplify, to))
+	{
+		output_simplifier_flush_line(self);
+	}
+	simplify->line[simplify->line_count++] = to;
+}
+
+/**
+ * Write a color change. A color equal to the current one is dropped, and
+ * successive colors without any line between them are merged.
+ *
+ * @param self the output
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+void output_color(struct output *self, double r, double g, double b)
+{
+	self->requested++;
+	struct output_simplifier *simplify = self->simplify;
+	if (simplify == NULL)
+	{
+		output_write_color(self, r, g, b);
+		return;
+	}
+
+	if (simplify->colored && r == simplify->cr && g == simplify->cg && b == simplify->cb)
+	{
+		simplify->color = false;
+		return;
+	}
+	// the line held back is drawn with the previous color
+	output_simplifier_flush_line(self);
+	simplify->color = true;
+	simplify->r = r;
+	simplify->g = g;
+	simplify->b = b;
+}
+
+/**
+ * Write some raw text, wrapped in a text record for the binary formats
+ *
+ * @param self the output
+ * @param text the text to write
+ * @param size the size of the text
+ */
+void output_text(struct output *self, const char *text, size_t size)
+{
+	if (self->simplify != NULL)
+	{
+		output_simplifier_flush(self);
+	}
+	if (self->format != OUTPUT_TEXT)
+	{
+		char *p = output_reserve(self);
+		*p++ = OUTPUT_RECORD_TEXT;
+		for (int i = 0; i < 4; i++)
+		{
+			*p++ = (char)((uint32_t)size >> (8 * i));
+		}
+		self->used += 5;
+	}
+
+	if (self->used + size > OUTPUT_BUFFER_SIZE)
+	{
+		output_write_buffer(self);
+		if (size > OUTPUT_BUFFER_SIZE)
+		{
+			output_write_large(self, text, size);
+			return;
+		}
+	}
+	memcpy(self->buffer + self->used, text, size);
+	self->used += size;
+}
+
+/**
+ * Write a nul terminated string
+ *
+ * @param self the output
+ * @param text the string to write
+ */
+void output_string(struct output *self, const char *text)
+{
+	output_text(self, text, strlen(text));
+}
+
+/**
+ * Append the primitives written by a fragment of this output, the full
+ * buffers of the fragment are handed to the stream without being copied
+ *
+ * @param self the output
+ * @param fragment the fragment, it is left empty
+ */
+void output_append(struct output *self, struct output *fragment)
+{
+	assert(fragment->fragment && fragment->simplify == NULL);
+	if (self->simplify != NULL)
+	{
+		output_simplifier_flush(self);
+	}
+	while (fragment->chunks != NULL)
+	{
+		struct output_chunk *chunk = fragment->chunks;
+		fragment->chunks = chunk->next;
+		output_write_buffer(self);
+		output_write_large(self, chunk->data, chunk->size);
+		free(chunk);
+	}
+	fragment->last = &fragment->chunks;
+
+	if (self->used + fragment->used > OUTPUT_BUFFER_SIZE)
+	{
+		output_write_buffer(self);
+	}
+	memcpy(self->buffer + self->used, fragment->buffer, fragment->used);
+	self->used += fragment->used;
+	self->primitives += fragment->primitives;
+	self->requested += fragment->requested;
+	fragment->used = 0;
+	fragment->written = 0;
+	fragment->primitives = 0;
+	fragment->requested = 0;
+}
@@ -0,0 +1,102 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_OUTPUT_H
+#define TURTLE_OUTPUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_PRECISION_DEFAULT 6
+#define OUTPUT_PRECISION_MAX 9
+
+/*
+ * Binary format of the primitives
+ *
+ * The stream starts with an 8 bytes header: the magic "\x89TRT", the
+ * version, the flags (OUTPUT_FLAG_DOUBLE when the numbers are 64 bits
+ * floats, 32 bits floats otherwise) and two reserved bytes.
+ *
+ * Then come records made of an opcode byte and its payload, numbers are
+ * IEEE 754 floats in little endian:
+ *   - OUTPUT_RECORD_COLOR: red, green, blue
+ *   - OUTPUT_RECORD_MOVE_TO: x, y
+ *   - OUTPUT_RECORD_LINE_TO: x, y
+ *   - OUTPUT_RECORD_TEXT: a 32 bits little endian size and the text
+ *   - OUTPUT_RECORD_END: nothing, the end of the drawing
+ */
+#define OUTPUT_MAGIC "\x89TRT"
+#define OUTPUT_MAGIC_SIZE 4
+#define OUTPUT_HEADER_SIZE 8
+#define OUTPUT_VERSION 1
+#define OUTPUT_FLAG_DOUBLE 0x01
+
+enum output_record
+{
+	OUTPUT_RECORD_END = 0,
+	OUTPUT_RECORD_COLOR = 1,
+	OUTPUT_RECORD_MOVE_TO = 2,
+	OUTPUT_RECORD_LINE_TO = 3,
+	OUTPUT_RECORD_TEXT = 4,
+};
+
+// how the primitives are encoded
+enum output_format
+{
+	OUTPUT_TEXT,	 // one line of text per primitive
+	OUTPUT_BINARY32, // binary records with 32 bits floats
+	OUTPUT_BINARY64, // binary records with 64 bits floats
+};
+
+struct output_simplifier;
+struct output_chunk;
+
+// a buffered sink for the drawing primitives
+struct output
+{
+	FILE *stream;			   // where the primitives are written
+	enum output_format format; // how the primitives are encoded
+	int precision;			   // number of decimals of the numbers, for the text format
+	char *buffer;			   // primitives waiting to be written
+	size_t used;			   // number of bytes in the buffer
+	size_t written;			   // number of bytes already handed to the stream
+	size_t primitives;		   // number of moves and colors written
+	size_t requested;		   // number of moves and colors asked for, before the simplification
+	struct output_simplifier *simplify; // primitives held back to be merged, NULL to write them as they come
+	long long write_ns;		   // time spent handing the buffer to the stream, in nanoseconds
+	bool fragment;			   // a part of the primitives of another output, without header nor end record
+	struct output_chunk *chunks;  // for a fragment, the full buffers kept in order until they are appended
+	struct output_chunk **last;	  // where the next full buffer of a fragment is linked
+	FILE *copy;					  // where the bytes handed to the stream are copied too, NULL for none
+};
+
+void output_create(struct output *self, FILE *stream, enum output_format format, int precision);
+void output_create_fragment(struct output *self, enum output_format format, int precision);
+void output_destroy(struct output *self);
+void output_abort(struct output *self);
+void output_discard(struct output *self);
+void output_flush(struct output *self);
+
+// copy the bytes handed to the stream to another stream too
+void output_copy(struct output *self, FILE *copy);
+
+// merge collinear lines, drop the moves and colors that change nothing, and
+// let the lines stray by at most tolerance from the points they replace
+void output_simplify(struct output *self, double tolerance);
+
+// drawing primitives
+void output_move_to(struct output *self, double x, double y);
+void output_line_to(struct output *self, double x, double y);
+void output_color(struct output *self, double r, double g, double b);
+
+// raw text, for anything that is not a primitive
+void output_text(struct output *self, const char *text, size_t size);
+void output_string(struct output *self, const char *text);
+
+// the primitives of a fragment of the same format, written as they are, the fragment is left empty
+void output_append(struct output *self, struct output *fragment);
+
+// format a number like printf("%.*f") would, returns the end of the text
+char *output_format_double(char *buf, double value, int precision);
+
+#endif /* TURTLE_OUTPUT_H */
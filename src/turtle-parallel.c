@@ -0,0 +1,542 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-parallel.h"
+#include "turtle-output.h"
+#include "turtle-vm.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a part of the program run on its own
+struct parallel_section
+{
+	const struct ast_node *cmds; // the top-level set and proc commands of the sections before, then its own commands
+
+	// the state of the run lives here rather than in locals, since it is
+	// still needed after an error jumps back to the trap
+	struct context ctx;		   // where it runs, created before the threads start
+	struct context_trap trap;  // where its errors go
+	struct output out;		   // where its primitives are written
+	struct eval_stats stats;   // the work of the evaluators, when it is counted
+	struct vm_program program; // its commands compiled, when it is run by the virtual machine
+	struct vm vm;			   // the virtual machine running them
+
+	bool failed;	   // it stopped on an error, whose message is in the trap
+	bool done;		   // it was run, protected by the mutex of the pool
+};
+
+// the state of a parallel run
+struct parallel
+{
+	const struct ast *ast;
+	const struct ast_node **bodies; // bodies[symbol] is the body of the top-level procedure named by the symbol
+
+	struct parallel_section *sections;
+	size_t section_count;
+	bool tree_walk; // the sections are run by the tree walker instead of the virtual machine
+
+	pthread_mutex_t mutex; // protects next and the done flags
+	pthread_cond_t cond;   // signaled each time a section is done
+	size_t next;		   // the next section to run
+};
+
+/**
+ * Check whether a program can be split: it never draws a random number, and
+ * sets its variables and defines its procedures only at the top level
+ *
+ * @param node the first node of a sequence of commands, or an expression
+ * @param top true if the commands are the top-level ones
+ *
+ * @return true if the sections can be run in any order
+ */
+static bool parallel_splittable(const struct ast_node *node, bool top)
+{
+	for (; node != NULL; node = node->next)
+	{
+		if ((node->kind == KIND_CMD_SET || node->kind == KIND_CMD_PROC) && !top)
+		{
+			return false;
+		}
+		if (node->kind == KIND_EXPR_FUNC && node->u.func == FUNC_RANDOM)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < node->children_count; i++)
+		{
+			if (!parallel_splittable(node->children[i], false))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool parallel_follow_cmds(const struct parallel *self, const struct ast_node *node, unsigned *known, size_t depth);
+
+/**
+ * Follow the state of the turtle through a command
+ *
+ * @param self the parallel run
+ * @param node the command
+ * @param known the parts of the state set since the start of the section, updated
+ * @param depth the number of calls followed to get there
+ *
+ * @return false if the command may read a part of the state that was not set
+ */
+static bool parallel_follow(const struct parallel *self, const struct ast_node *node, unsigned *known, size_t depth)
+{
+	switch (node->kind)
+	{
+	case KIND_CMD_SIMPLE:
+		switch (node->u.cmd)
+		{
+		case CMD_HOME:
+			*known = PARALLEL_ALL;
+			return true;
+		case CMD_POSITION:
+			*known |= PARALLEL_XY;
+			return true;
+		case CMD_HEADING:
+			*known |= PARALLEL_ANGLE;
+			return true;
+		case CMD_UP:
+		case CMD_DOWN:
+			*known |= PARALLEL_PEN;
+			return true;
+		case CMD_FORWARD:
+		case CMD_BACKWARD:
+			return *known == PARALLEL_ALL;
+		case CMD_RIGHT:
+		case CMD_LEFT:
+			return (*known & PARALLEL_ANGLE) != 0;
+		default:
+			return true;
+		}
+	case KIND_CMD_BLOCK:
+		return parallel_follow_cmds(self, node->children[0], known, depth);
+	case KIND_CMD_REPEAT:
+	{
+		// the body may not run, what it sets is not known afterwards
+		unsigned body = *known;
+		return parallel_follow_cmds(self, node->children[1], &body, depth);
+	}
+	case KIND_CMD_CALL:
+	{
+		size_t symbol = node->children[0]->symbol;
+		if (symbol >= self->ast->symbols.count || self->bodies[symbol] == NULL || depth == PARALLEL_DEPTH_MAX)
+		{
+			return false;
+		}
+		return parallel_follow_cmds(self, self->bodies[symbol], known, depth + 1);
+	}
+	default:
+		return true;
+	}
+}
+
+/**
+ * Follow the state of the turtle through a sequence of commands
+ *
+ * @param self the parallel run
+ * @param node the first command of the sequence
+ * @param known the parts of the state set since the start of the section, updated
+ * @param depth the number of calls followed to get there
+ *
+ * @return false if a command may read a part of the state that was not set
+ */
+static bool parallel_follow_cmds(const struct parallel *self, const struct ast_node *node, unsigned *known, size_t depth)
+{
+	for (; node != NULL; node = node->next)
+	{
+		if (!parallel_follow(self, node, known, depth))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check whether a section can start at a top-level command: the commands
+ * from there set the position, the heading and the pen before reading them
+ *
+ * @param self the parallel run
+ * @param node the top-level command
+ *
+ * @return true if the commands from there do not depend on the ones before
+ */
+static bool parallel_independent(const struct parallel *self, const struct ast_node *node)
+{
+	unsigned known = 0;
+	for (size_t i = 0; node != NULL && i < PARALLEL_SCAN_MAX; node = node->next, i++)
+	{
+		if (!parallel_follow(self, node, &known, 0))
+		{
+			return false;
+		}
+		if (known == PARALLEL_ALL)
+		{
+			return true;
+		}
+	}
+	return node == NULL;
+}
+
+static double parallel_weight_cmds(const struct parallel *self, const struct ast_node *node, size_t depth);
+
+/**
+ * Estimate the number of commands run by a command
+ *
+ * @param self the parallel run
+ * @param node the command
+ * @param depth the number of calls followed to get there
+ *
+ * @return the estimated number of commands
+ */
+static double parallel_weight(const struct parallel *self, const struct ast_node *node, size_t depth)
+{
+	switch (node->kind)
+	{
+	case KIND_CMD_BLOCK:
+		return parallel_weight_cmds(self, node->children[0], depth);
+	case KIND_CMD_REPEAT:
+	{
+		const struct ast_node *count = ast_node_child(node, 0);
+		double times = count != NULL && count->kind == KIND_EXPR_VALUE && count->u.value > 1 ? count->u.value : 1;
+		return 1 + times * parallel_weight_cmds(self, node->children[1], depth);
+	}
+	case KIND_CMD_CALL:
+	{
+		size_t symbol = node->children[0]->symbol;
+		if (symbol >= self->ast->symbols.count || self->bodies[symbol] == NULL || depth == PARALLEL_DEPTH_MAX)
+		{
+			return 1;
+		}
+		return 1 + parallel_weight_cmds(self, self->bodies[symbol], depth + 1);
+	}
+	default:
+		return 1;
+	}
+}
+
+/**
+ * Estimate the number of commands run by a sequence of commands
+ *
+ * @param self the parallel run
+ * @param node the first command of the sequence
+ * @param depth the number of calls followed to get there
+ *
+ * @return the estimated number of commands
+ */
+static double parallel_weight_cmds(const struct parallel *self, const struct ast_node *node, size_t depth)
+{
+	double weight = 0;
+	for (; node != NULL; node = node->next)
+	{
+		weight += parallel_weight(self, node, depth);
+	}
+	return weight;
+}
+
+/**
+ * Split the top-level commands into sections of about the same weight
+ *
+ * @param self the parallel run
+ * @param cmds the top-level commands
+ * @param count the number of top-level commands
+ * @param jobs the number of threads
+ * @param starts where the index of the first command of each section is written, count entries at most
+ *
+ * @return the number of sections, 1 if the program is not worth splitting
+ */
+static size_t parallel_split(const struct parallel *self, const struct ast_node **cmds, size_t count, size_t jobs, size_t *starts)
+{
+	double *weights = malloc(count * sizeof(double));
+	double total = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		weights[i] = parallel_weight(self, cmds[i], 0);
+		total += weights[i];
+	}
+
+	size_t section_count = 1;
+	starts[0] = 0;
+	if (total >= PARALLEL_WEIGHT_MIN)
+	{
+		double target = total / (jobs * PARALLEL_SECTIONS_PER_JOB);
+		double weight = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (weight >= target && parallel_independent(self, cmds[i]))
+			{
+				starts[section_count++] = i;
+				weight = 0;
+			}
+			weight += weights[i];
+		}
+	}
+	free(weights);
+	return section_count;
+}
+
+/**
+ * Run a section, its errors are caught by its trap
+ *
+ * @param self the parallel run
+ * @param section the section
+ */
+static void parallel_run_section(struct parallel *self, struct parallel_section *section)
+{
+	const struct output *out = section->ctx.out;
+	output_create_fragment(&section->out, out->format, out->precision);
+	section->ctx.out = &section->out;
+	section->ctx.trap = &section->trap;
+
+	if (!self->tree_walk)
+	{
+		vm_program_compile_cmds(&section->program, section->cmds, &self->ast->symbols);
+		vm_create(&section->vm, &section->program, &section->ctx);
+	}
+
+	if (setjmp(section->trap.jump) == 0)
+	{
+		if (self->tree_walk)
+		{
+			ast_cmds_eval(section->cmds, &section->ctx);
+		}
+		else
+		{
+			vm_run(&section->vm, &section->ctx);
+		}
+	}
+	else
+	{
+		section->failed = true;
+	}
+
+	if (!self->tree_walk)
+	{
+		vm_destroy(&section->vm);
+		vm_program_destroy(&section->program);
+	}
+	context_destroy(&section->ctx);
+}
+
+/**
+ * Run the sections one after the other until there is none left
+ *
+ * @param arg the parallel run
+ *
+ * @return nothing
+ */
+static void *parallel_worker(void *arg)
+{
+	struct parallel *self = arg;
+	for (;;)
+	{
+		pthread_mutex_lock(&self->mutex);
+		size_t index = self->next++;
+		pthread_mutex_unlock(&self->mutex);
+		if (index >= self->section_count)
+		{
+			return NULL;
+		}
+
+		struct parallel_section *section = &self->sections[index];
+		parallel_run_section(self, section);
+
+		pthread_mutex_lock(&self->mutex);
+		section->done = true;
+		pthread_cond_broadcast(&self->cond);
+		pthread_mutex_unlock(&self->mutex);
+	}
+}
+
+/**
+ * Add the work of the evaluators of a section to the one of the program
+ *
+ * @param stats the work of the program
+ * @param section the work of the section
+ */
+static void parallel_add_stats(struct eval_stats *stats, const struct eval_stats *section)
+{
+	for (size_t i = 0; i < AST_KIND_COUNT; i++)
+	{
+		stats->kinds[i] += section->kinds[i];
+	}
+	for (size_t i = 0; i < AST_CMD_COUNT; i++)
+	{
+		stats->cmds[i] += section->cmds[i];
+	}
+	stats->lookups += section->lookups;
+	stats->replayed += section->replayed;
+	stats->generated += section->generated;
+}
+
+/**
+ * Build the commands run by each section: copies of the top-level set and
+ * proc commands of the sections before it, then copies of its own commands
+ *
+ * @param self the parallel run
+ * @param arena where the copies are allocated
+ * @param cmds the top-level commands
+ * @param count the number of top-level commands
+ * @param starts the index of the first command of each section
+ */
+static void parallel_build_sections(struct parallel *self, struct arena *arena, const struct ast_node **cmds, size_t count, const size_t *starts)
+{
+	for (size_t s = 0; s < self->section_count; s++)
+	{
+		size_t end = s + 1 < self->section_count ? starts[s + 1] : count;
+		struct ast_node_list list = {NULL, NULL};
+		for (size_t i = 0; i < end; i++)
+		{
+			bool definition = cmds[i]->kind == KIND_CMD_SET || cmds[i]->kind == KIND_CMD_PROC;
+			if (i < starts[s] && !definition)
+			{
+				continue;
+			}
+			struct ast_node *copy = ast_node_copy(arena, cmds[i]);
+			copy->next = NULL;
+			if (list.last == NULL)
+			{
+				list.first = copy;
+			}
+			else
+			{
+				list.last->next = copy;
+			}
+			list.last = copy;
+		}
+		self->sections[s].cmds = list.first;
+	}
+}
+
+/**
+ * Run a program on several threads if it can be split into independent
+ * sections, and write their primitives in order in the output of the context
+ *
+ * @param ast the program
+ * @param ctx the execution context, in its initial state
+ * @param jobs the number of threads
+ * @param tree_walk true to run the sections with the tree walker instead of the virtual machine
+ * @param stats where the number of sections and threads is written
+ *
+ * @return false if the program cannot be split, nothing was run then
+ */
+bool parallel_eval(const struct ast *ast, struct context *ctx, size_t jobs, bool tree_walk, struct parallel_stats *stats)
+{
+	stats->sections = 0;
+	stats->jobs = 1;
+	const struct ast_node *program = ast_program(ast);
+	if (jobs < 2 || program == NULL || ctx->rigid || ctx->out->simplify != NULL || !parallel_splittable(program, true))
+	{
+		return false;
+	}
+
+	struct parallel self;
+	self.ast = ast;
+	self.tree_walk = tree_walk;
+	self.bodies = calloc(ast->symbols.count + 1, sizeof(struct ast_node *));
+
+	size_t count = 0;
+	for (const struct ast_node *node = program; node != NULL; node = node->next)
+	{
+		count++;
+		if (node->kind == KIND_CMD_PROC && self.bodies[node->children[0]->symbol] == NULL)
+		{
+			self.bodies[node->children[0]->symbol] = node->children[1];
+		}
+	}
+	const struct ast_node **cmds = malloc(count * sizeof(struct ast_node *));
+	count = 0;
+	for (const struct ast_node *node = program; node != NULL; node = node->next)
+	{
+		cmds[count++] = node;
+	}
+
+	size_t *starts = malloc(count * sizeof(size_t));
+	self.section_count = parallel_split(&self, cmds, count, jobs, starts);
+	if (self.section_count < 2)
+	{
+		free(starts);
+		free(cmds);
+		free(self.bodies);
+		return false;
+	}
+
+	struct arena arena;
+	arena_create(&arena);
+	self.sections = calloc(self.section_count, sizeof(struct parallel_section));
+	parallel_build_sections(&self, &arena, cmds, count, starts);
+	free(starts);
+	free(cmds);
+
+	// the contexts intern the builtin variables, so they are created before the threads start
+	for (size_t s = 0; s < self.section_count; s++)
+	{
+		struct parallel_section *section = &self.sections[s];
+		context_create(&section->ctx, ctx->symbols, ctx->out);
+		section->ctx.memoize = ctx->memoize;
+		if (ctx->stats != NULL)
+		{
+			section->ctx.stats = &section->stats;
+		}
+	}
+
+	pthread_mutex_init(&self.mutex, NULL);
+	pthread_cond_init(&self.cond, NULL);
+	self.next = 0;
+	if (jobs > self.section_count)
+	{
+		jobs = self.section_count;
+	}
+	pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+	for (size_t i = 0; i < jobs; i++)
+	{
+		pthread_create(&threads[i], NULL, parallel_worker, &self);
+	}
+
+	// the outputs are written in order, as soon as each one is ready
+	for (size_t s = 0; s < self.section_count; s++)
+	{
+		struct parallel_section *section = &self.sections[s];
+		pthread_mutex_lock(&self.mutex);
+		while (!section->done)
+		{
+			pthread_cond_wait(&self.cond, &self.mutex);
+		}
+		pthread_mutex_unlock(&self.mutex);
+
+		output_append(ctx->out, &section->out);
+		output_destroy(&section->out);
+		if (ctx->stats != NULL)
+		{
+			parallel_add_stats(ctx->stats, &section->stats);
+		}
+		if (section->failed)
+		{
+			// the threads still running are stopped by the exit
+			context_error(ctx, "%s", section->trap.message);
+		}
+	}
+
+	for (size_t i = 0; i < jobs; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_cond_destroy(&self.cond);
+	pthread_mutex_destroy(&self.mutex);
+
+	stats->sections = self.section_count;
+	stats->jobs = jobs;
+	free(self.sections);
+	free(self.bodies);
+	arena_destroy(&arena);
+
+	output_text(ctx->out, "\n", 1);
+	output_flush(ctx->out);
+	return true;
+}
@@ -0,0 +1,58 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_PARALLEL_H
+#define TURTLE_PARALLEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "turtle-ast.h"
+
+/*
+ * Parallel evaluation of independent sections
+ *
+ * The top-level commands of a program are split into sections that do not
+ * depend on the turtle left by the previous ones: a section starts where
+ * the position, the heading and the pen are all set again (by home,
+ * position, heading, up or down) before any command reads them. The
+ * variables and the procedures are the only things shared between the
+ * sections, so each section first runs the top-level set and proc commands
+ * of the sections before it. The sections are run by a pool of threads,
+ * each one with its own context and its own output, and their outputs are
+ * written in the order of the program, so the output is exactly the one of
+ * a run on a single thread, up to the first error.
+ *
+ * A program is run on a single thread when it uses random (whose sequence
+ * is shared), when it sets a variable or defines a procedure anywhere else
+ * than at the top level, when its output is simplified (the simplification
+ * merges lines across the sections), with rigid replays (which depend on
+ * the first recorded call), or when it is too small to be worth it.
+ */
+
+// parts of the state of the turtle set since the start of a section
+#define PARALLEL_XY 0x1
+#define PARALLEL_ANGLE 0x2
+#define PARALLEL_PEN 0x4
+#define PARALLEL_ALL (PARALLEL_XY | PARALLEL_ANGLE | PARALLEL_PEN)
+
+// top-level commands looked at to decide whether a section can start at a command
+#define PARALLEL_SCAN_MAX 64
+
+// nested calls followed by the analysis
+#define PARALLEL_DEPTH_MAX 16
+
+// estimated commands run by a program below which it is run on a single thread
+#define PARALLEL_WEIGHT_MIN 100000
+
+// sections made for each thread, so that a long section does not leave the others idle
+#define PARALLEL_SECTIONS_PER_JOB 4
+
+// how a program was run
+struct parallel_stats
+{
+	size_t sections; // the number of sections, 0 if the program was run on a single thread
+	size_t jobs;	 // the number of threads
+};
+
+bool parallel_eval(const struct ast *ast, struct context *ctx, size_t jobs, bool tree_walk, struct parallel_stats *stats);
+
+#endif /* TURTLE_PARALLEL_H */
@@ -1,29 +1,64 @@
 /*Jade GURNAUD and Charlotte KRUZIC*/
 %{
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "turtle-ast.h"
+%}
 
-int yylex();
-void yyerror(struct ast *ret, const char *);
+// the state of the scanner, declared the way Flex does
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
 
-%}
+// the Flex scanner, the tokens are read from it when the tree has no scanner of its own
+%code provides {
+int lexer_next(YYSTYPE *lvalp, struct ast *ret, yyscan_t scanner);
+}
+
+%code {
+struct scan;
+int scan_next(struct scan *self, YYSTYPE *value, struct ast *ret);
+
+/**
+ * Read the next token, with the hand-written scanner of the tree if it has one
+ *
+ * @param lvalp where the value of the token is set
+ * @param ret the tree being parsed
+ * @param scanner the Flex scanner, unused when the tree has its own
+ *
+ * @return the token
+ */
+static int yylex(YYSTYPE *lvalp, struct ast *ret, yyscan_t scanner)
+{
+	return ret->scan != NULL ? scan_next(ret->scan, lvalp, ret) : lexer_next(lvalp, ret, scanner);
+}
+
+void yyerror(struct ast *ret, yyscan_t scanner, const char *);
+}
 
 %debug
 %defines
 
 %define parse.error verbose
 
-%parse-param { struct ast *ret }
+/* no global state, so that several programs can be parsed at the same time */
+%define api.pure full
+%parse-param { struct ast *ret } { yyscan_t scanner }
+%lex-param { struct ast *ret } { yyscan_t scanner }
 
 %union {
   	double value;
-  	char *name;
+  	size_t symbol;
   	struct ast_node *node;
+  	struct ast_node_list list;
 }
 
 %token <value>		VALUE       "value"
-%token <name>     	NAME        "name"
+%token <symbol>   	NAME        "name"
 %token				KW_PRINT	"print"
 %token				KW_UP		"up"
 %token				KW_DOWN		"down"
@@ -54,60 +89,77 @@ void yyerror(struct ast *ret, const char *);
 %left RANDOM
 
 
-%type <node> unit cmds cmd expr
+%type <node> unit cmd expr
+%type <list> program cmds
 
 /*Grammar rules*/
 %%
 
 unit:
-	cmds              	{ $$ = $1; ret->unit = $$; }
+	program            	{ $$ = $1.first; ret->unit = $$; }
+;
+
+/* the top-level commands, run and released one by one when the program is streamed */
+program:
+	program cmd         {
+							$$ = $1;
+							if (ret->stream != NULL) { ast_stream_command(ret, $2); }
+							else if ($$.last == NULL) { $$.first = $2; $$.last = $2; }
+							else { $$.last->next = $2; $$.last = $2; }
+						}
+	| /* empty */  		{ $$.first = NULL; $$.last = NULL; }
 ;
 
+/* left recursive so that the parser stack does not grow with the length of the program */
 cmds:
-	cmd cmds          	{ $1->next = $2; $$ = $1; }
-  	| /* empty */  		{ $$ = NULL; }
+	cmds cmd          	{
+							$$ = $1;
+							if ($$.last == NULL) { $$.first = $2; } else { $$.last->next = $2; }
+							$$.last = $2;
+						}
+  	| /* empty */  		{ $$.first = NULL; $$.last = NULL; }
 ;
 
 cmd:
-	KW_PRINT expr					{ $$ = make_cmd_print($2); }
-	| KW_UP							{ $$ = make_cmd_up(); }
-	| KW_DOWN						{ $$ = make_cmd_down(); }
-	| KW_FORWARD expr   			{ $$ = make_cmd_forward($2); }
-	| KW_BACKWARD expr  			{ $$ = make_cmd_backward($2); }
-	| KW_POSITION expr				{ $$ = make_cmd_position($2); }
-	| RIGHT	expr					{ $$ = make_cmd_right($2); }
-	| LEFT	expr					{ $$ = make_cmd_left($2); }
-	| HEADING expr					{ $$ = make_cmd_heading($2); }
-	| COLOR	expr 					{ $$ = make_cmd_color($2); }
-	| HOME							{ $$ = make_cmd_home(); }
-	| REPEAT expr cmd				{ $$ = make_cmd_repeat($2,$3); }
-	| SET expr expr					{ $$ = make_cmd_set($2,$3); }
-	| PROC expr cmd					{ $$ = make_cmd_proc($2,$3); }
-	| CALL expr 					{ $$ = make_cmd_call($2); }
-	| '{' cmds '}'      			{ $$ = make_block_cmds($2); }
+	KW_PRINT expr					{ $$ = make_cmd_print(&ret->arena, $2); }
+	| KW_UP							{ $$ = make_cmd_up(&ret->arena); }
+	| KW_DOWN						{ $$ = make_cmd_down(&ret->arena); }
+	| KW_FORWARD expr   			{ $$ = make_cmd_forward(&ret->arena, $2); }
+	| KW_BACKWARD expr  			{ $$ = make_cmd_backward(&ret->arena, $2); }
+	| KW_POSITION expr				{ $$ = make_cmd_position(&ret->arena, $2); }
+	| RIGHT	expr					{ $$ = make_cmd_right(&ret->arena, $2); }
+	| LEFT	expr					{ $$ = make_cmd_left(&ret->arena, $2); }
+	| HEADING expr					{ $$ = make_cmd_heading(&ret->arena, $2); }
+	| COLOR	expr 					{ $$ = make_cmd_color(&ret->arena, $2); }
+	| HOME							{ $$ = make_cmd_home(&ret->arena); }
+	| REPEAT expr cmd				{ $$ = make_cmd_repeat(&ret->arena, $2,$3); }
+	| SET expr expr					{ $$ = make_cmd_set(&ret->arena, $2,$3); }
+	| PROC expr cmd					{ $$ = make_cmd_proc(&ret->arena, $2,$3); }
+	| CALL expr 					{ $$ = make_cmd_call(&ret->arena, $2); }
+	| '{' cmds '}'      			{ $$ = make_block_cmds(&ret->arena, $2.first); }
 	;
 	
 expr:
-    VALUE             				{ $$ = make_expr_value($1); }
-	| NAME           				{ $$ = make_expr_name($1);}
-	| '-' expr %prec UMINUS 		{ $$ = make_op_uminus($2); }
-	| expr '^' expr     			{ $$ = make_binary_op($1, $3, '^');}
-	| expr '*' expr     			{ $$ = make_binary_op($1, $3, '*');}
-	| expr '/' expr     			{ $$ = make_binary_op($1, $3, '/');}
-	| expr '+' expr    				{ $$ = make_binary_op($1,$3 ,'+'); }
-  	| expr '-' expr     			{ $$ = make_binary_op($1,$3, '-'); }
-	| expr ','  expr 				{ $$ = make_expr_virgule($1, $3);}
-	| '(' expr ')'      			{ $$ = make_expr_parentheses($2);}
-	| SQRT '(' expr ')'  			{ $$ = make_expr_sqrt($3); }
-	| SIN '(' expr ')'  			{ $$ = make_expr_sin($3); }
-	| COS '(' expr ')'  			{ $$ = make_expr_cos($3); }
-	| TAN '(' expr ')'  			{ $$ = make_expr_tan($3); }
-	| RANDOM expr					{ $$ = make_expr_random($2); }
+    VALUE             				{ $$ = make_expr_value(&ret->arena, $1); }
+	| NAME           				{ $$ = make_expr_name(&ret->arena, &ret->symbols, $1); }
+	| '-' expr %prec UMINUS 		{ $$ = make_op_uminus(&ret->arena, $2); }
+	| expr '^' expr     			{ $$ = make_binary_op(&ret->arena, $1, $3, '^');}
+	| expr '*' expr     			{ $$ = make_binary_op(&ret->arena, $1, $3, '*');}
+	| expr '/' expr     			{ $$ = make_binary_op(&ret->arena, $1, $3, '/');}
+	| expr '+' expr    				{ $$ = make_binary_op(&ret->arena, $1,$3 ,'+'); }
+  	| expr '-' expr     			{ $$ = make_binary_op(&ret->arena, $1,$3, '-'); }
+	| expr ','  expr 				{ $$ = make_expr_virgule(&ret->arena, $1, $3);}
+	| '(' expr ')'      			{ $$ = make_expr_parentheses(&ret->arena, $2);}
+	| SQRT '(' expr ')'  			{ $$ = make_expr_sqrt(&ret->arena, $3); }
+	| SIN '(' expr ')'  			{ $$ = make_expr_sin(&ret->arena, $3); }
+	| COS '(' expr ')'  			{ $$ = make_expr_cos(&ret->arena, $3); }
+	| TAN '(' expr ')'  			{ $$ = make_expr_tan(&ret->arena, $3); }
+	| RANDOM expr					{ $$ = make_expr_random(&ret->arena, $2); }
 ;
 
 %%
 
-void yyerror(struct ast *ret, const char *msg) {
-  	(void) ret;
-  	fprintf(stderr, "%s\n", msg);
+void yyerror(struct ast *ret, yyscan_t scanner, const char *msg) {
+  	(void) scanner;
+  	ast_error(ret, "%s", msg);
 }
\ No newline at end of file
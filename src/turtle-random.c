@@ -0,0 +1,145 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-random.h"
+
+#include <time.h>
+#include <unistd.h>
+
+// the increment of splitmix64, the fractional part of the golden ratio
+#define RANDOM_GOLDEN 0x9E3779B97F4A7C15ull
+
+// the polynomial of the jump of 2^128 numbers of xoshiro256
+static const uint64_t random_jump[4] = {
+	0x180EC6D33CFD0ABAull,
+	0xD5A61266F0C9392Cull,
+	0xA9582618E03FC9AAull,
+	0x39ABDC4529B1661Cull,
+};
+
+/**
+ * Rotate a word to the left
+ *
+ * @param word the word
+ * @param count the number of bits, between 1 and 63
+ *
+ * @return the rotated word
+ */
+static inline uint64_t random_rotl(uint64_t word, int count)
+{
+	return (word << count) | (word >> (64 - count));
+}
+
+/**
+ * Fill the state of a generator from a seed with splitmix64, which never
+ * gives the state made only of zeros
+ *
+ * @param self the generator
+ * @param seed the seed
+ */
+void random_seed(struct random *self, uint64_t seed)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		seed += RANDOM_GOLDEN;
+		uint64_t z = seed;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		self->state[i] = z ^ (z >> 31);
+	}
+}
+
+/**
+ * Draw the next number of a generator
+ *
+ * @param self the generator
+ *
+ * @return 64 random bits
+ */
+uint64_t random_next(struct random *self)
+{
+	uint64_t *s = self->state;
+	uint64_t result = random_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = random_rotl(s[3], 45);
+	return result;
+}
+
+/**
+ * Give the current stream of a generator to another one, then jump 2^128
+ * numbers ahead: the numbers of the other generator are never drawn by
+ * this one, unless it draws 2^128 of them
+ *
+ * @param self the generator
+ * @param stream the other generator
+ */
+void random_split(struct random *self, struct random *stream)
+{
+	*stream = *self;
+	uint64_t s[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 4; i++)
+	{
+		for (int bit = 0; bit < 64; bit++)
+		{
+			if (random_jump[i] & (1ull << bit))
+			{
+				for (int j = 0; j < 4; j++)
+				{
+					s[j] ^= self->state[j];
+				}
+			}
+			random_next(self);
+		}
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		self->state[j] = s[j];
+	}
+}
+
+/**
+ * Draw a number between two bounds, all equally likely (Lemire): the high
+ * bits of a product by the size of the range, the rare products that would
+ * favour some numbers are drawn again
+ *
+ * @param self the generator
+ * @param min the lower bound
+ * @param max the upper bound, not below min
+ *
+ * @return the number
+ */
+int random_range(struct random *self, int min, int max)
+{
+	uint64_t range = (uint64_t)((int64_t)max - min) + 1;
+	if (range > UINT32_MAX)
+	{
+		return (int)((int64_t)min + (int64_t)(random_next(self) >> 32));
+	}
+	uint32_t bound = (uint32_t)range;
+	uint64_t product = (random_next(self) >> 32) * bound;
+	if ((uint32_t)product < bound)
+	{
+		// 2^32 modulo the range: the products whose low bits are below it are drawn again
+		uint32_t threshold = -bound % bound;
+		while ((uint32_t)product < threshold)
+		{
+			product = (random_next(self) >> 32) * bound;
+		}
+	}
+	return (int)((int64_t)min + (int64_t)(product >> 32));
+}
+
+/**
+ * Make a seed that changes at every run, from the clock and the process
+ *
+ * @return the seed
+ */
+uint64_t random_entropy(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec + ((uint64_t)getpid() << 48);
+}
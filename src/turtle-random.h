@@ -0,0 +1,36 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_RANDOM_H
+#define TURTLE_RANDOM_H
+
+#include <stdint.h>
+
+/*
+ * Random numbers
+ *
+ * The generator is xoshiro256** (Blackman and Vigna): 256 bits of state, a
+ * period of 2^256 - 1 and a few cycles per number. Its state is filled by
+ * splitmix64 from a 64 bits seed, so that close seeds give unrelated
+ * streams. A generator is split by giving its current stream to a new one
+ * and jumping 2^128 numbers ahead, so that the streams of the workers never
+ * overlap.
+ */
+
+// a generator, each evaluation has its own
+struct random
+{
+	uint64_t state[4];
+};
+
+void random_seed(struct random *self, uint64_t seed);
+uint64_t random_next(struct random *self);
+
+// give the current stream to another generator and jump past it
+void random_split(struct random *self, struct random *stream);
+
+// a number between min and max included, all equally likely
+int random_range(struct random *self, int min, int max);
+
+// a seed that changes at every run
+uint64_t random_entropy(void);
+
+#endif /* TURTLE_RANDOM_H */
@@ -0,0 +1,235 @@
+// Jade GURNAUD and Charlotte KRUZIC
+// O_TMPFILE, the unnamed files of Linux
+#define _GNU_SOURCE
+
+#include "turtle-replay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+// the size of the buffer copying a drawing when the kernel cannot send it
+#define REPLAY_BUFFER_SIZE (64 * 1024)
+
+// the largest number of bytes sent at once
+#define REPLAY_SEND_MAX (1 << 30)
+
+// what makes two runs of the same source draw differently
+struct replay_options
+{
+	uint32_t version; // REPLAY_VERSION
+	uint32_t format;
+	int32_t precision;
+	uint32_t rigid;
+	uint32_t optimize;
+	uint32_t reserved; // 0
+	double simplify;   // the tolerance, negative without simplification
+};
+
+/**
+ * Check whether a program draws the same at every run: it never draws a
+ * random number, in any of its commands nor of its procedures
+ *
+ * @param node the first node of a sequence of commands, or an expression
+ *
+ * @return true if the program is deterministic
+ */
+bool replay_deterministic(const struct ast_node *node)
+{
+	for (; node != NULL; node = node->next)
+	{
+		if (node->kind == KIND_EXPR_FUNC && node->u.func == FUNC_RANDOM)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < node->children_count; i++)
+		{
+			if (!replay_deterministic(node->children[i]))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Hash the version of the interpreter and the options that change the
+ * drawing of a program, the others (the evaluator, the threads, the
+ * memoization) give the same bytes
+ *
+ * @param format how the primitives are encoded
+ * @param precision the number of decimals of the text format
+ * @param simplify the tolerance of the simplification, negative without
+ * @param rigid the replays are rotated, with other roundings
+ * @param optimize the constants are folded
+ *
+ * @return the hash
+ */
+uint64_t replay_variant(enum output_format format, int precision, double simplify, bool rigid, bool optimize)
+{
+	struct replay_options options;
+	memset(&options, 0, sizeof(options));
+	options.version = REPLAY_VERSION;
+	options.format = format;
+	options.precision = precision;
+	options.rigid = rigid;
+	options.optimize = optimize;
+	options.simplify = simplify;
+
+	struct image_key key;
+	image_key(&key, (const char *)&options, sizeof(options));
+	return key.hash;
+}
+
+/**
+ * Build the path of the drawing of a program in a cache directory
+ *
+ * @param path where the path is written
+ * @param size the size of path
+ * @param dir the cache directory
+ * @param key the key of the source of the program
+ * @param variant the hash of the version and of the options
+ *
+ * @return false if the path does not fit in size
+ */
+bool replay_path(char *path, size_t size, const char *dir, const struct image_key *key, uint64_t variant)
+{
+	int length = snprintf(path, size, "%s/%016llx-%llx-%016llx" REPLAY_EXTENSION, dir, (unsigned long long)key->hash,
+						  (unsigned long long)key->size, (unsigned long long)variant);
+	return length >= 0 && (size_t)length < size;
+}
+
+/**
+ * Copy the rest of a file to a file descriptor through a buffer
+ *
+ * @param in the file
+ * @param fd the file descriptor
+ *
+ * @return the number of bytes copied
+ */
+static size_t replay_copy(int in, int fd)
+{
+	char *buffer = malloc(REPLAY_BUFFER_SIZE);
+	size_t copied = 0;
+	ssize_t size;
+	while ((size = read(in, buffer, REPLAY_BUFFER_SIZE)) > 0)
+	{
+		for (ssize_t done = 0; done < size;)
+		{
+			ssize_t written = write(fd, buffer + done, size - done);
+			if (written < 0 && errno != EINTR)
+			{
+				free(buffer);
+				return copied;
+			}
+			done += written > 0 ? written : 0;
+			copied += written > 0 ? written : 0;
+		}
+	}
+	free(buffer);
+	return copied;
+}
+
+/**
+ * Send a drawing to a file descriptor. The kernel moves the bytes from the
+ * page cache to the descriptor, a file or a pipe, without copying them to
+ * the process; they are copied through a buffer where it cannot
+ *
+ * @param path the path of the drawing
+ * @param fd the file descriptor, nothing must be waiting to be written to it
+ * @param size where the number of bytes sent is set
+ *
+ * @return false if there is no drawing, then nothing is sent
+ */
+bool replay_send(const char *path, int fd, size_t *size)
+{
+	int in = open(path, O_RDONLY);
+	if (in < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(in, &info) != 0)
+	{
+		close(in);
+		return false;
+	}
+
+	*size = 0;
+	size_t left = info.st_size;
+	while (left > 0)
+	{
+		ssize_t sent = sendfile(fd, in, NULL, left < REPLAY_SEND_MAX ? left : REPLAY_SEND_MAX);
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (sent < 0 && (errno == EINVAL || errno == ENOSYS) && *size == 0)
+		{
+			*size = replay_copy(in, fd);
+			break;
+		}
+		if (sent <= 0)
+		{
+			break;
+		}
+		*size += sent;
+		left -= sent;
+	}
+	close(in);
+	return true;
+}
+
+/**
+ * Start recording a drawing in an unnamed file of the cache directory,
+ * which disappears with the process unless it is linked
+ *
+ * @param self the recording
+ * @param dir the cache directory
+ * @param path where the drawing is linked once complete
+ *
+ * @return false if the file system of the directory has no unnamed files
+ */
+bool replay_record(struct replay *self, const char *dir, const char *path)
+{
+	int fd = open(dir, O_WRONLY | O_TMPFILE, 0666);
+	self->stream = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (self->stream == NULL)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+	self->path = strdup(path);
+	return true;
+}
+
+/**
+ * Link a recorded drawing under its name, once the program ran to its end,
+ * through the link of its descriptor in /proc, and release the recording
+ *
+ * @param self the recording
+ *
+ * @return true if the drawing is in the cache
+ */
+bool replay_finish(struct replay *self)
+{
+	bool kept = fflush(self->stream) == 0 && !ferror(self->stream);
+	if (kept)
+	{
+		char link[64];
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", fileno(self->stream));
+		// another run may have linked the same drawing first
+		kept = linkat(AT_FDCWD, link, AT_FDCWD, self->path, AT_SYMLINK_FOLLOW) == 0 || errno == EEXIST;
+	}
+	fclose(self->stream);
+	free(self->path);
+	return kept;
+}
@@ -0,0 +1,61 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_REPLAY_H
+#define TURTLE_REPLAY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-ast.h"
+#include "turtle-image.h"
+#include "turtle-output.h"
+
+/*
+ * Replays of the drawings
+ *
+ * A program that never draws a random number writes the same bytes at
+ * every run. Its drawing is kept in the cache directory next to its image,
+ * named after the key of its source and a hash of the version of the
+ * interpreter and of the options that change the drawing. The next runs
+ * send it to their output as it is, without parsing nor running the
+ * program.
+ *
+ * A drawing is copied to an unnamed file of the cache directory as the
+ * program runs, and only linked under its name once the run is complete:
+ * a run stopped by an error leaves nothing behind, and the runs reading
+ * the drawing at the same time see it whole or not at all. REPLAY_VERSION
+ * changes whenever the interpreter changes the drawing of a program.
+ */
+
+#define REPLAY_VERSION 1
+
+// the extension of the drawings in the cache
+#define REPLAY_EXTENSION ".trd"
+
+// a drawing being recorded
+struct replay
+{
+	FILE *stream; // where the drawing is copied, an unnamed file
+	char *path;	  // where it is linked once complete
+};
+
+// whether a program draws the same at every run: no random number anywhere in it
+bool replay_deterministic(const struct ast_node *node);
+
+// a hash of the version of the interpreter and of the options that change the drawing
+uint64_t replay_variant(enum output_format format, int precision, double simplify, bool rigid, bool optimize);
+
+// the path of the drawing of a program in a cache directory, false if it does not fit
+bool replay_path(char *path, size_t size, const char *dir, const struct image_key *key, uint64_t variant);
+
+// send a drawing to a file descriptor, false if there is no such drawing
+bool replay_send(const char *path, int fd, size_t *size);
+
+// start recording a drawing in an unnamed file of the cache directory, false if its file system has none
+bool replay_record(struct replay *self, const char *dir, const char *path);
+
+// link the drawing recorded under its name, once the program ran to its end, and release it
+bool replay_finish(struct replay *self);
+
+#endif /* TURTLE_REPLAY_H */
@@ -0,0 +1,527 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// whitespace is compared 16 bytes at a time, SSE2 is always there on x86-64
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SCAN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// the size of the table of the keywords, a power of two
+#define SCAN_KEYWORD_BUCKETS 64
+
+// the longest keyword
+#define SCAN_KEYWORD_MAX 8
+
+// the first size of the buffer of a program read from a pipe
+#define SCAN_READ_SIZE (64 * 1024)
+
+// the longest number converted on the stack, the longer ones are copied on the heap for strtod
+#define SCAN_NUMBER_MAX 64
+
+// a word in lower case and its token
+struct scan_keyword
+{
+	const char *word; // NULL for an empty bucket
+	size_t size;
+	int token; // NAME for the colors, which are names of variables
+};
+
+// the keywords and the colors, indexed by scan_hash that has no collision on them
+static const struct scan_keyword scan_keywords[SCAN_KEYWORD_BUCKETS] = {
+	[0] = {"pos", 3, KW_POSITION},
+	[4] = {"set", 3, SET},
+	[5] = {"position", 8, KW_POSITION},
+	[7] = {"backward", 8, KW_BACKWARD},
+	[11] = {"yellow", 6, NAME},
+	[14] = {"tan", 3, TAN},
+	[16] = {"sin", 3, SIN},
+	[17] = {"home", 4, HOME},
+	[20] = {"gray", 4, NAME},
+	[21] = {"green", 5, NAME},
+	[22] = {"heading", 7, HEADING},
+	[25] = {"call", 4, CALL},
+	[26] = {"proc", 4, PROC},
+	[27] = {"print", 5, KW_PRINT},
+	[30] = {"hd", 2, HEADING},
+	[32] = {"up", 2, KW_UP},
+	[33] = {"cyan", 4, NAME},
+	[34] = {"cos", 3, COS},
+	[35] = {"bw", 2, KW_BACKWARD},
+	[36] = {"color", 5, COLOR},
+	[37] = {"random", 6, RANDOM},
+	[38] = {"lt", 2, LEFT},
+	[40] = {"forward", 7, KW_FORWARD},
+	[41] = {"sqrt", 4, SQRT},
+	[42] = {"rt", 2, RIGHT},
+	[43] = {"left", 4, LEFT},
+	[46] = {"red", 3, NAME},
+	[49] = {"repeat", 6, REPEAT},
+	[52] = {"blue", 4, NAME},
+	[53] = {"black", 5, NAME},
+	[55] = {"white", 5, NAME},
+	[56] = {"magenta", 7, NAME},
+	[57] = {"down", 4, KW_DOWN},
+	[59] = {"fw", 2, KW_FORWARD},
+	[60] = {"right", 5, RIGHT},
+};
+
+// the powers of ten that are exact in a double
+static const double scan_powers_of_ten[SCAN_FAST_DIGITS + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+
+/**
+ * Initialize a scanner on a program already in memory
+ *
+ * @param self the scanner
+ * @param text the program, it must outlive the scanner
+ * @param size its size in bytes
+ */
+void scan_create(struct scan *self, const char *text, size_t size)
+{
+	self->text = text;
+	self->cursor = text;
+	self->end = text + size;
+	self->mapped = 0;
+	self->owned = NULL;
+}
+
+/**
+ * Initialize a scanner on a file mapped in memory
+ *
+ * @param self the scanner
+ * @param path the path of the file
+ *
+ * @return false if the file cannot be mapped, errno tells why
+ */
+bool scan_map(struct scan *self, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool loaded = scan_load(self, fd);
+	int error = errno;
+	close(fd);
+	errno = error;
+	return loaded;
+}
+
+/**
+ * Initialize a scanner on an open file, mapped in memory if it is a regular
+ * file and read to its end otherwise, as a pipe
+ *
+ * @param self the scanner
+ * @param fd the file descriptor, left open
+ *
+ * @return false if the file cannot be read, errno tells why
+ */
+bool scan_load(struct scan *self, int fd)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		return false;
+	}
+
+	if (S_ISREG(info.st_mode))
+	{
+		// an empty file cannot be mapped
+		if (info.st_size == 0)
+		{
+			scan_create(self, "", 0);
+			return true;
+		}
+		void *text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text == MAP_FAILED)
+		{
+			return false;
+		}
+		posix_madvise(text, info.st_size, POSIX_MADV_SEQUENTIAL);
+		scan_create(self, text, info.st_size);
+		self->mapped = info.st_size;
+		return true;
+	}
+
+	size_t size = 0;
+	size_t capacity = SCAN_READ_SIZE;
+	char *text = malloc(capacity);
+	for (;;)
+	{
+		ssize_t count = read(fd, text + size, capacity - size);
+		if (count < 0)
+		{
+			int error = errno;
+			free(text);
+			errno = error;
+			return false;
+		}
+		if (count == 0)
+		{
+			break;
+		}
+		size += count;
+		if (size == capacity)
+		{
+			capacity *= 2;
+			text = realloc(text, capacity);
+		}
+	}
+	scan_create(self, text, size);
+	self->owned = text;
+	return true;
+}
+
+/**
+ * Release a scanner, and the mapping or the copy of its file. The names already
+ * interned were copied and do not depend on it
+ *
+ * @param self the scanner
+ */
+void scan_destroy(struct scan *self)
+{
+	if (self->mapped > 0)
+	{
+		munmap((void *)self->text, self->mapped);
+	}
+	free(self->owned);
+}
+
+/**
+ * Check whether a character is skipped between the tokens
+ *
+ * @param c the character
+ *
+ * @return true for a space, a tab or a newline
+ */
+static bool scan_is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/**
+ * Skip the whitespace
+ *
+ * @param p the first character
+ * @param end the end of the program
+ *
+ * @return the first character that is not a space, a tab or a newline
+ */
+static const char *scan_skip_blanks(const char *p, const char *end)
+{
+	// most tokens are separated by a single space
+	if (p < end && !scan_is_blank(*p))
+	{
+		return p;
+	}
+#ifdef SCAN_SSE2
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (end - p >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		__m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)), _mm_cmpeq_epi8(chunk, newline));
+		unsigned mask = ~(unsigned)_mm_movemask_epi8(blank) & 0xFFFF;
+		if (mask != 0)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && scan_is_blank(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+/**
+ * Check whether a character is a digit
+ *
+ * @param c the character
+ *
+ * @return true for 0 to 9
+ */
+static bool scan_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * Count the digits at the start of a text, as {DIGIT}*
+ *
+ * @param p the text
+ * @param end its end
+ *
+ * @return the number of digits
+ */
+static size_t scan_digits(const char *p, const char *end)
+{
+	const char *start = p;
+	while (p < end && scan_is_digit(*p))
+	{
+		p++;
+	}
+	return p - start;
+}
+
+/**
+ * Match an integer at the start of a text, as {INTEGER}: 0|[1-9]{DIGIT}*
+ *
+ * @param p the text
+ * @param end its end
+ *
+ * @return the length of the integer, 0 if there is none
+ */
+static size_t scan_integer(const char *p, const char *end)
+{
+	if (p == end || !scan_is_digit(*p))
+	{
+		return 0;
+	}
+	return *p == '0' ? 1 : 1 + scan_digits(p + 1, end);
+}
+
+/**
+ * Match the longest number at the start of a text, as {DOUBLE}:
+ * {INTEGER}?\.{DIGIT}* | {DIGIT}?(\.{DIGIT}*)?[eE][-+]?{INTEGER} | {INTEGER}
+ *
+ * @param p the text
+ * @param end its end
+ *
+ * @return the length of the number, 0 if there is none
+ */
+static size_t scan_number(const char *p, const char *end)
+{
+	// an integer, maybe followed by a fraction
+	size_t best = scan_integer(p, end);
+	if (p + best < end && p[best] == '.')
+	{
+		best += 1 + scan_digits(p + best + 1, end);
+	}
+
+	// a single digit and a fraction, both optional, then an exponent
+	size_t size = 0;
+	if (p + size < end && scan_is_digit(p[size]))
+	{
+		size++;
+	}
+	if (p + size < end && p[size] == '.')
+	{
+		size += 1 + scan_digits(p + size + 1, end);
+	}
+	if (p + size < end && (p[size] == 'e' || p[size] == 'E'))
+	{
+		size++;
+		if (p + size < end && (p[size] == '+' || p[size] == '-'))
+		{
+			size++;
+		}
+		size_t exponent = scan_integer(p + size, end);
+		if (exponent > 0 && size + exponent > best)
+		{
+			best = size + exponent;
+		}
+	}
+	return best;
+}
+
+/**
+ * Convert a number matched by scan_number like strtod does
+ *
+ * @param p the number
+ * @param size its length
+ *
+ * @return its value
+ */
+static double scan_value(const char *p, size_t size)
+{
+	// digits and a fraction: the digits are exact, so one division is correctly rounded
+	uint64_t digits = 0;
+	size_t count = 0;
+	size_t fraction = 0;
+	bool dot = false;
+	size_t i = 0;
+	for (; i < size && count <= SCAN_FAST_DIGITS; i++)
+	{
+		if (p[i] == '.' && !dot)
+		{
+			dot = true;
+		}
+		else if (scan_is_digit(p[i]))
+		{
+			digits = digits * 10 + (p[i] - '0');
+			count++;
+			fraction += dot;
+		}
+		else
+		{
+			break;
+		}
+	}
+	if (i == size && count <= SCAN_FAST_DIGITS)
+	{
+		return (double)digits / scan_powers_of_ten[fraction];
+	}
+
+	// an exponent, or too many digits
+	char buffer[SCAN_NUMBER_MAX];
+	char *copy = size < SCAN_NUMBER_MAX ? buffer : malloc(size + 1);
+	memcpy(copy, p, size);
+	copy[size] = '\0';
+	double value = strtod(copy, NULL);
+	if (copy != buffer)
+	{
+		free(copy);
+	}
+	return value;
+}
+
+/**
+ * Compute the hash of a word of at least two characters
+ *
+ * @param p the word
+ * @param size its length
+ *
+ * @return its bucket in the table of the keywords
+ */
+static size_t scan_hash(const char *p, size_t size)
+{
+	return (size + 22 * (unsigned char)p[0] + 51 * (unsigned char)p[1]) & (SCAN_KEYWORD_BUCKETS - 1);
+}
+
+/**
+ * Match the longest keyword or color at the start of a word in lower case
+ *
+ * @param p the word
+ * @param size its length
+ *
+ * @return the keyword, NULL if the word does not start with one
+ */
+static const struct scan_keyword *scan_keyword(const char *p, size_t size)
+{
+	// the whole word is the common case, then its prefixes, from the longest
+	for (size_t n = size < SCAN_KEYWORD_MAX ? size : SCAN_KEYWORD_MAX; n >= 2; n--)
+	{
+		const struct scan_keyword *keyword = &scan_keywords[scan_hash(p, n)];
+		if (keyword->word != NULL && keyword->size == n && memcmp(keyword->word, p, n) == 0)
+		{
+			return keyword;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Read the next token
+ *
+ * @param self the scanner
+ * @param value where the value of a number or the symbol of a name is set
+ * @param ret the tree, whose symbol table interns the names
+ *
+ * @return the token, 0 at the end of the program, YYerror for an unknown character
+ */
+int scan_next(struct scan *self, YYSTYPE *value, struct ast *ret)
+{
+	const char *p = self->cursor;
+	const char *end = self->end;
+	for (;;)
+	{
+		p = scan_skip_blanks(p, end);
+		if (p == end)
+		{
+			self->cursor = p;
+			return 0;
+		}
+		if (*p != '#')
+		{
+			break;
+		}
+		// a comment, its newline is skipped with the whitespace
+		const char *newline = memchr(p, '\n', end - p);
+		p = newline != NULL ? newline : end;
+	}
+
+	char c = *p;
+	size_t size = 0;
+	int token = YYerror;
+	if (c >= 'a' && c <= 'z')
+	{
+		const char *q = p;
+		while (q < end && *q >= 'a' && *q <= 'z')
+		{
+			q++;
+		}
+		const struct scan_keyword *keyword = scan_keyword(p, q - p);
+		if (keyword != NULL)
+		{
+			size = keyword->size;
+			token = keyword->token;
+		}
+		else if (c == 'e' && (size = scan_number(p, end)) > 0)
+		{
+			token = VALUE;
+		}
+	}
+	else if (c >= 'A' && c <= 'Z')
+	{
+		const char *q = p + 1;
+		while (q < end && ((*q >= 'A' && *q <= 'Z') || scan_is_digit(*q)))
+		{
+			q++;
+		}
+		size = q - p;
+		token = NAME;
+		// an exponent as long as the name wins, its rule comes first
+		if (c == 'E')
+		{
+			size_t number = scan_number(p, end);
+			if (number >= size)
+			{
+				size = number;
+				token = VALUE;
+			}
+		}
+	}
+	else if (scan_is_digit(c) || c == '.')
+	{
+		size = scan_number(p, end);
+		token = VALUE;
+	}
+	else if (strchr("+-*/^(){},", c) != NULL && c != '\0')
+	{
+		size = 1;
+		token = c;
+	}
+
+	if (token == YYerror)
+	{
+		// as the catch-all rule of Flex, which matches a single character
+		ast_error(ret, "Unknown token: '%.1s'", p);
+		self->cursor = p + 1;
+		return YYerror;
+	}
+	if (token == VALUE)
+	{
+		value->value = scan_value(p, size);
+	}
+	else if (token == NAME)
+	{
+		value->symbol = symbol_intern_view(&ret->symbols, p, size);
+	}
+	self->cursor = p + size;
+	return token;
+}
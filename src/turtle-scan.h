@@ -0,0 +1,48 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_SCAN_H
+#define TURTLE_SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "turtle-ast.h"
+#include "turtle-parser.h"
+
+/*
+ * Hand-written scanner of a program held in memory
+ *
+ * The program is read where it is, usually a file mapped in memory, instead
+ * of being copied by Flex into its own buffer: the names are interned
+ * straight from the text and the numbers are converted from it. The tokens
+ * are exactly the ones of the Flex scanner (turtle-lexer.l), including its
+ * longest match rule and the order of its rules:
+ *   - the words in lower case are looked up in a perfect hash of the
+ *     keywords and the colors;
+ *   - the whitespace is skipped 16 bytes at a time with SSE2, the comments
+ *     with memchr;
+ *   - the numbers without exponent and with at most SCAN_FAST_DIGITS digits
+ *     are converted exactly without strtod.
+ */
+
+// digits of the numbers converted without strtod: the digits hold in a double, so one division is correctly rounded
+#define SCAN_FAST_DIGITS 15
+
+// a program held in memory and where the scanner is in it
+struct scan
+{
+	const char *text;	// the program, not nul terminated
+	const char *cursor; // the next character to read
+	const char *end;	// the end of the program
+	size_t mapped;		// the size of the mapping of the file, 0 if the program is not mapped by the scanner
+	char *owned;		// the program read from a pipe, NULL if it is not a copy made by the scanner
+};
+
+void scan_create(struct scan *self, const char *text, size_t size);
+bool scan_map(struct scan *self, const char *path);
+bool scan_load(struct scan *self, int fd);
+void scan_destroy(struct scan *self);
+
+// the next token, its value is set for the numbers and the names
+int scan_next(struct scan *self, YYSTYPE *value, struct ast *ret);
+
+#endif /* TURTLE_SCAN_H */
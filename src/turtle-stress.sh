@@ -0,0 +1,77 @@
+#!/bin/sh
+# Jade GURNAUD and Charlotte KRUZIC
+#
+# Stress test of the long command sequences: a flat program of a million
+# commands and a repeat whose body has half a million of them go through
+# the scanners, the parser, both evaluators and the printer of the tree,
+# with a stack of 1 MiB. Any recursion over the sequences overflows it.
+#
+# Every run must exit with 0 and draw the same primitives, as many lines
+# as the program has forward and backward commands, and the printed tree
+# must give back the program, command by command.
+#
+# usage: turtle-stress.sh path/to/turtle [commands]
+
+turtle=${1:?usage: turtle-stress.sh path/to/turtle [commands]}
+commands=${2:-1000000}
+body=$((commands / 2))
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+program=$work/program.turtle
+
+awk -v n="$commands" -v m="$body" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		print (i % 2 == 0) ? "fw 1" : "right 1"
+	}
+	print "repeat 2 {"
+	for (i = 0; i < m; i++) {
+		print (i % 2 == 0) ? "bw 1" : "left 1"
+	}
+	print "}"
+}' > "$program" || exit 1
+
+# one line per forward of the flat part, two per backward of the body
+lines=$(((commands + 1) / 2 + 2 * ((body + 1) / 2)))
+
+ulimit -s 1024 || exit 1
+
+status=0
+
+# run turtle with some options, its output goes to $work/$name.out and $work/$name.err
+run() {
+	name=$1
+	shift
+	if ! "$turtle" "$@" > "$work/$name.out" 2> "$work/$name.err"; then
+		echo "turtle-stress: $name run failed, end of its stderr:" >&2
+		tail -n 20 "$work/$name.err" >&2
+		status=1
+	fi
+}
+
+run vm "$program"
+run tree --tree "$program"
+run ast --print-ast "$program"
+# a program read from stdin goes through the Flex scanner
+run flex < "$program"
+
+count=$(grep -c '^LineTo' "$work/vm.out")
+if [ "$count" -ne "$lines" ]; then
+	echo "turtle-stress: $count lines drawn instead of $lines" >&2
+	status=1
+fi
+
+for name in tree ast flex; do
+	if ! cmp -s "$work/vm.out" "$work/$name.out"; then
+		echo "turtle-stress: the $name run does not draw as the vm run" >&2
+		status=1
+	fi
+done
+
+# the tree is printed with two decimals and a space after each command
+if ! sed 's/\.00 *$//; s/\.00 {$/ {/' "$work/ast.err" | cmp -s - "$program"; then
+	echo "turtle-stress: the printed tree is not the program" >&2
+	status=1
+fi
+
+exit $status
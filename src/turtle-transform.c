@@ -0,0 +1,213 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-transform.h"
+
+#include <pthread.h>
+
+// the vector kernels rely on the target attribute and the x86 intrinsics
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#endif
+
+// the signature of the kernels
+typedef void (*transform_fn)(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys);
+
+/**
+ * Rotate and translate the points one at a time
+ *
+ * @param px the abscissas of the points, relative to the start point
+ * @param py their ordinates
+ * @param count the number of points
+ * @param x the abscissa of the start point in the world
+ * @param y its ordinate
+ * @param c the cosine of the rotation
+ * @param s its sine
+ * @param xs where the abscissas of the points in the world are written
+ * @param ys where their ordinates are written
+ */
+static void transform_scalar(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		double cx = c * px[i];
+		double sy = s * py[i];
+		double sx = s * px[i];
+		double cy = c * py[i];
+		xs[i] = x + (cx - sy);
+		ys[i] = y + (sx + cy);
+	}
+}
+
+#ifdef TRANSFORM_X86
+
+/**
+ * Rotate and translate the points two at a time
+ *
+ * @param px the abscissas of the points, relative to the start point
+ * @param py their ordinates
+ * @param count the number of points
+ * @param x the abscissa of the start point in the world
+ * @param y its ordinate
+ * @param c the cosine of the rotation
+ * @param s its sine
+ * @param xs where the abscissas of the points in the world are written
+ * @param ys where their ordinates are written
+ */
+__attribute__((target("sse2"))) static void transform_sse2(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys)
+{
+	__m128d vx = _mm_set1_pd(x);
+	__m128d vy = _mm_set1_pd(y);
+	__m128d vc = _mm_set1_pd(c);
+	__m128d vs = _mm_set1_pd(s);
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128d a = _mm_loadu_pd(px + i);
+		__m128d b = _mm_loadu_pd(py + i);
+		__m128d rx = _mm_sub_pd(_mm_mul_pd(vc, a), _mm_mul_pd(vs, b));
+		__m128d ry = _mm_add_pd(_mm_mul_pd(vs, a), _mm_mul_pd(vc, b));
+		_mm_storeu_pd(xs + i, _mm_add_pd(vx, rx));
+		_mm_storeu_pd(ys + i, _mm_add_pd(vy, ry));
+	}
+	transform_scalar(px + i, py + i, count - i, x, y, c, s, xs + i, ys + i);
+}
+
+/**
+ * Rotate and translate the points four at a time
+ *
+ * @param px the abscissas of the points, relative to the start point
+ * @param py their ordinates
+ * @param count the number of points
+ * @param x the abscissa of the start point in the world
+ * @param y its ordinate
+ * @param c the cosine of the rotation
+ * @param s its sine
+ * @param xs where the abscissas of the points in the world are written
+ * @param ys where their ordinates are written
+ */
+__attribute__((target("avx2"))) static void transform_avx2(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys)
+{
+	__m256d vx = _mm256_set1_pd(x);
+	__m256d vy = _mm256_set1_pd(y);
+	__m256d vc = _mm256_set1_pd(c);
+	__m256d vs = _mm256_set1_pd(s);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256d a = _mm256_loadu_pd(px + i);
+		__m256d b = _mm256_loadu_pd(py + i);
+		__m256d rx = _mm256_sub_pd(_mm256_mul_pd(vc, a), _mm256_mul_pd(vs, b));
+		__m256d ry = _mm256_add_pd(_mm256_mul_pd(vs, a), _mm256_mul_pd(vc, b));
+		_mm256_storeu_pd(xs + i, _mm256_add_pd(vx, rx));
+		_mm256_storeu_pd(ys + i, _mm256_add_pd(vy, ry));
+	}
+	transform_scalar(px + i, py + i, count - i, x, y, c, s, xs + i, ys + i);
+}
+
+#endif /* TRANSFORM_X86 */
+
+static const struct
+{
+	const char *name;
+	transform_fn fn;
+} transform_kernels[TRANSFORM_KERNEL_COUNT] = {
+	[TRANSFORM_SCALAR] = {"scalar", transform_scalar},
+#ifdef TRANSFORM_X86
+	[TRANSFORM_SSE2] = {"sse2", transform_sse2},
+	[TRANSFORM_AVX2] = {"avx2", transform_avx2},
+#else
+	[TRANSFORM_SSE2] = {"sse2", NULL},
+	[TRANSFORM_AVX2] = {"avx2", NULL},
+#endif
+};
+
+/**
+ * Check whether a kernel can run on this processor
+ *
+ * @param kernel the kernel
+ *
+ * @return true if it can be used
+ */
+bool transform_kernel_supported(enum transform_kernel kernel)
+{
+	switch (kernel)
+	{
+	case TRANSFORM_SCALAR:
+		return true;
+#ifdef TRANSFORM_X86
+	case TRANSFORM_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case TRANSFORM_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+ * Get the name of a kernel
+ *
+ * @param kernel the kernel
+ *
+ * @return its name
+ */
+const char *transform_kernel_name(enum transform_kernel kernel)
+{
+	return transform_kernels[kernel].name;
+}
+
+/**
+ * Rotate and translate points with a given kernel, which must be supported
+ *
+ * @param kernel the kernel
+ * @param px the abscissas of the points, relative to the start point
+ * @param py their ordinates
+ * @param count the number of points
+ * @param x the abscissa of the start point in the world
+ * @param y its ordinate
+ * @param c the cosine of the rotation
+ * @param s its sine
+ * @param xs where the abscissas of the points in the world are written
+ * @param ys where their ordinates are written
+ */
+void transform_points_with(enum transform_kernel kernel, const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys)
+{
+	transform_kernels[kernel].fn(px, py, count, x, y, c, s, xs, ys);
+}
+
+// the fastest kernel of the processor, chosen once for all the threads
+static pthread_once_t transform_once = PTHREAD_ONCE_INIT;
+static transform_fn transform_best = NULL;
+
+/**
+ * Choose the fastest kernel supported by the processor
+ */
+static void transform_choose(void)
+{
+	enum transform_kernel kernel = TRANSFORM_AVX2;
+	while (!transform_kernel_supported(kernel))
+	{
+		kernel--;
+	}
+	transform_best = transform_kernels[kernel].fn;
+}
+
+/**
+ * Rotate and translate points with the fastest kernel of the processor
+ *
+ * @param px the abscissas of the points, relative to the start point
+ * @param py their ordinates
+ * @param count the number of points
+ * @param x the abscissa of the start point in the world
+ * @param y its ordinate
+ * @param c the cosine of the rotation
+ * @param s its sine
+ * @param xs where the abscissas of the points in the world are written
+ * @param ys where their ordinates are written
+ */
+void transform_points(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys)
+{
+	pthread_once(&transform_once, transform_choose);
+	transform_best(px, py, count, x, y, c, s, xs, ys);
+}
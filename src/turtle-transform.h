@@ -0,0 +1,40 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_TRANSFORM_H
+#define TURTLE_TRANSFORM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Rotation and translation of blocks of points
+ *
+ * A block of points known relative to a start point is placed in the world
+ * by a rotation followed by a translation:
+ *   xs[i] = x + c * px[i] - s * py[i]
+ *   ys[i] = y + s * px[i] + c * py[i]
+ * The kernels only multiply and add, in this order and without fused
+ * operations, so that they all give exactly the same points. The fastest
+ * one supported by the processor is chosen the first time it is needed.
+ */
+
+// implementations of the transformation
+enum transform_kernel
+{
+	TRANSFORM_SCALAR, // portable C, one point at a time
+	TRANSFORM_SSE2,	  // two points at a time, on x86 processors
+	TRANSFORM_AVX2,	  // four points at a time, on x86 processors that support it
+};
+
+#define TRANSFORM_KERNEL_COUNT (TRANSFORM_AVX2 + 1)
+
+// the points transformed at once by the callers that keep them on the stack
+#define TRANSFORM_BLOCK 256
+
+void transform_points(const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys);
+
+// a given kernel, for the benchmark
+bool transform_kernel_supported(enum transform_kernel kernel);
+void transform_points_with(enum transform_kernel kernel, const double *px, const double *py, size_t count, double x, double y, double c, double s, double *xs, double *ys);
+const char *transform_kernel_name(enum transform_kernel kernel);
+
+#endif /* TURTLE_TRANSFORM_H */
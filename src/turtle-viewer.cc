@@ -1,8 +1,15 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gf/Action.h>
 #include <gf/Clock.h>
@@ -14,28 +21,258 @@
 #include <gf/Shapes.h>
 #include <gf/Vector.h>
 #include <gf/VectorOps.h>
+#include <gf/Vertex.h>
+#include <gf/VertexBuffer.h>
 #include <gf/ViewContainer.h>
 #include <gf/Views.h>
 #include <gf/Window.h>
 
-enum Command {
-  Color,
-  MoveTo,
-  LineTo,
-};
-
 static constexpr const char *ColorKw = "Color";
 static constexpr const char *MoveToKw = "MoveTo";
 static constexpr const char *LineToKw = "LineTo";
 
-int main() {
-  std::vector<Command> commands;
-  std::vector<gf::Vector2f> points;
-  std::vector<gf::Color4f> colors;
+// binary format written by turtle --format binary32|binary64 (see turtle-output.h)
+static constexpr const char *BinaryMagic = "\x89TRT";
+static constexpr std::size_t BinaryMagicSize = 4;
+static constexpr std::size_t BinaryHeaderSize = 8;
+static constexpr unsigned char BinaryVersion = 1;
+static constexpr unsigned char BinaryFlagDouble = 0x01;
+
+enum BinaryRecord : unsigned char {
+  EndRecord = 0,
+  ColorRecord = 1,
+  MoveToRecord = 2,
+  LineToRecord = 3,
+  TextRecord = 4,
+};
+
+static constexpr float LineWidth = 3.0f;
+
+// segments per vertex buffer, a buffer is uploaded once all its segments are revealed
+static constexpr std::size_t ChunkSegments = 4096;
+static constexpr std::size_t VerticesPerSegment = 6;
+static constexpr std::size_t ChunkVertices = ChunkSegments * VerticesPerSegment;
+
+// a movement of the turtle
+struct Step {
+  gf::Vector2f from;
+  gf::Vector2f to;
+  gf::Color4f color;
+  bool line;
+  std::size_t vertexEnd; // number of vertices of the segments drawn up to this step included
+};
+
+static void appendSegment(std::vector<gf::Vertex>& vertices, gf::Vector2f from, gf::Vector2f to, gf::Color4f color) {
+  gf::Vector2f direction = to - from;
+  float length = std::hypot(direction.x, direction.y);
+
+  if (length == 0.0f) {
+    direction = gf::Vector2f(1.0f, 0.0f);
+  } else {
+    direction = direction / length;
+  }
+
+  gf::Vector2f normal(-direction.y * LineWidth / 2, direction.x * LineWidth / 2);
+  gf::Vector2f corners[4] = { from + normal, from - normal, to + normal, to - normal };
+  std::size_t order[VerticesPerSegment] = { 0, 1, 2, 2, 1, 3 };
+
+  for (std::size_t i : order) {
+    gf::Vertex vertex;
+    vertex.position = corners[i];
+    vertex.color = color;
+    vertices.push_back(vertex);
+  }
+}
+
+// the box around some vertices, in world coordinates
+struct Bounds {
+  gf::Vector2f min;
+  gf::Vector2f max;
+};
+
+static Bounds computeBounds(const gf::Vertex *vertices, std::size_t count) {
+  Bounds bounds = { vertices[0].position, vertices[0].position };
+
+  for (std::size_t i = 1; i < count; ++i) {
+    gf::Vector2f position = vertices[i].position;
+    bounds.min.x = std::min(bounds.min.x, position.x);
+    bounds.min.y = std::min(bounds.min.y, position.y);
+    bounds.max.x = std::max(bounds.max.x, position.x);
+    bounds.max.y = std::max(bounds.max.y, position.y);
+  }
+
+  return bounds;
+}
+
+static bool intersects(const Bounds& lhs, const Bounds& rhs) {
+  return lhs.min.x <= rhs.max.x && rhs.min.x <= lhs.max.x && lhs.min.y <= rhs.max.y && rhs.min.y <= lhs.max.y;
+}
+
+// level 0 draws every segment, level L merges the segments into lines that stray at most LodTolerance * 2^(L-1) from them
+static constexpr float LodTolerance = 0.5f;
+static constexpr std::size_t LodLevels = 24;
+
+// the coarsest level whose error is below a pixel
+static std::size_t levelOfDetail(float pixelSize) {
+  std::size_t level = 0;
+
+  while (level < LodLevels && std::ldexp(LodTolerance, static_cast<int>(level)) <= pixelSize) {
+    ++level;
+  }
+
+  return level;
+}
+
+static bool sameColor(gf::Color4f lhs, gf::Color4f rhs) {
+  return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b && lhs.a == rhs.a;
+}
+
+// the segments of some steps, the lines of connected segments of the same color only keep the points at least tolerance apart
+static void appendSimplified(std::vector<gf::Vertex>& vertices, const Step *steps, std::size_t count, float tolerance) {
+  gf::Vector2f anchor;  // the last point kept
+  gf::Vector2f last;    // the end of the line so far
+  gf::Color4f color;
+  bool open = false;
+
+  auto flush = [&]() {
+    if (open && (anchor.x != last.x || anchor.y != last.y)) {
+      appendSegment(vertices, anchor, last, color);
+    }
+
+    open = false;
+  };
+
+  for (std::size_t i = 0; i < count; ++i) {
+    const Step& step = steps[i];
+
+    if (!step.line) {
+      flush();
+      continue;
+    }
+
+    if (!open || step.from.x != last.x || step.from.y != last.y || !sameColor(step.color, color)) {
+      flush();
+      anchor = last = step.from;
+      color = step.color;
+      open = true;
+    }
+
+    last = step.to;
+
+    if (std::hypot(last.x - anchor.x, last.y - anchor.y) >= tolerance) {
+      appendSegment(vertices, anchor, last, color);
+      anchor = last;
+    }
+  }
+
+  flush();
+}
+
+// the segments of a vertex buffer, culled as a whole and drawn simplified when they are smaller than the pixels
+struct Chunk {
+  Chunk(const gf::Vertex *vertices, std::size_t firstStep, std::size_t endStep)
+  : buffer(vertices, ChunkVertices, gf::PrimitiveType::Triangles)
+  , bounds(computeBounds(vertices, ChunkVertices))
+  , firstStep(firstStep)
+  , endStep(endStep)
+  , levels(LodLevels)
+  {
+  }
+
+  // the segments at a level of detail above 0, simplified the first time they are drawn at this level
+  const gf::VertexBuffer *getLevel(const std::vector<Step>& steps, std::size_t level) {
+    Level& simplified = levels[level - 1];
+
+    if (!simplified.built) {
+      std::vector<gf::Vertex> vertices;
+      appendSimplified(vertices, steps.data() + firstStep, endStep - firstStep, std::ldexp(LodTolerance, static_cast<int>(level) - 1));
+
+      if (!vertices.empty()) {
+        simplified.buffer.reset(new gf::VertexBuffer(vertices.data(), vertices.size(), gf::PrimitiveType::Triangles));
+      }
+
+      simplified.built = true;
+    }
+
+    return simplified.buffer.get();
+  }
+
+  struct Level {
+    std::unique_ptr<gf::VertexBuffer> buffer; // null when every segment vanished
+    bool built = false;
+  };
+
+  gf::VertexBuffer buffer;
+  Bounds bounds;
+  std::size_t firstStep; // the steps whose segments are in the buffer
+  std::size_t endStep;
+  std::vector<Level> levels;
+};
+
+// steps handed to the main loop at once, a smaller batch is handed over when no more input is buffered
+static constexpr std::size_t BatchSteps = 1024;
+
+// steps read from the input and not yet taken by the main loop
+struct Incoming {
+  std::mutex mutex;
+  std::vector<Step> steps;
+  std::vector<gf::Vertex> vertices;
+  bool done = false;
+};
+
+// the state of the thread reading the input
+struct Reader {
+  explicit Reader(std::shared_ptr<Incoming> incoming)
+  : incoming(std::move(incoming))
+  {
+  }
+
+  std::shared_ptr<Incoming> incoming;
+  gf::Vector2f point = gf::Vector2f(0, 0);
+  gf::Color4f color = gf::Color::Black;
+  std::size_t vertexCount = 0;      // vertices already produced, including the batch
+  std::vector<Step> steps;          // the batch being filled
+  std::vector<gf::Vertex> vertices;
+};
+
+static void publish(Reader& reader, bool done) {
+  std::lock_guard<std::mutex> lock(reader.incoming->mutex);
+  Incoming& incoming = *reader.incoming;
+  incoming.steps.insert(incoming.steps.end(), reader.steps.begin(), reader.steps.end());
+  incoming.vertices.insert(incoming.vertices.end(), reader.vertices.begin(), reader.vertices.end());
+  incoming.done = done;
+  reader.steps.clear();
+  reader.vertices.clear();
+}
+
+static void readColor(Reader& reader, gf::Color4f color) {
+  reader.color = color;
+}
+
+static void readMove(Reader& reader, gf::Vector2f to, bool line, std::istream& in) {
+  Step step;
+  step.from = reader.point;
+  step.to = to;
+  step.color = reader.color;
+  step.line = line;
+
+  if (line) {
+    appendSegment(reader.vertices, step.from, step.to, step.color);
+    reader.vertexCount += VerticesPerSegment;
+  }
+
+  step.vertexEnd = reader.vertexCount;
+  reader.steps.push_back(step);
+  reader.point = to;
 
-  std::size_t movements = 0;
+  // the next read may wait for the producer, what was read so far is shown meanwhile
+  if (reader.steps.size() >= BatchSteps || in.rdbuf()->in_avail() <= 0) {
+    publish(reader, false);
+  }
+}
 
-  for (std::string line; std::getline(std::cin, line); ) {
+static void readText(std::istream& in, Reader& reader) {
+  for (std::string line; std::getline(in, line); ) {
     if (line.find(ColorKw) != std::string::npos) {
       gf::Color4f color;
 
@@ -45,8 +282,7 @@ int main() {
       color.b = std::strtod(endptr, &endptr);
       color.a = 1.0f;
 
-      commands.push_back(Command::Color);
-      colors.push_back(color);
+      readColor(reader, color);
     }
 
     if (line.find(MoveToKw) != std::string::npos) {
@@ -56,10 +292,7 @@ int main() {
       point.x = std::strtod(endptr, &endptr);
       point.y = std::strtod(endptr, &endptr);
 
-      commands.push_back(Command::MoveTo);
-      points.push_back(point);
-
-      ++movements;
+      readMove(reader, point, false, in);
     }
 
     if (line.find(LineToKw) != std::string::npos) {
@@ -69,13 +302,120 @@ int main() {
       point.x = std::strtod(endptr, &endptr);
       point.y = std::strtod(endptr, &endptr);
 
-      commands.push_back(Command::LineTo);
-      points.push_back(point);
+      readMove(reader, point, true, in);
+    }
+  }
+}
 
-      ++movements;
+static bool readNumbers(std::istream& in, bool isDouble, float *values, std::size_t count) {
+  unsigned char bytes[3 * 8];
+  std::size_t size = isDouble ? 8 : 4;
+
+  if (!in.read(reinterpret_cast<char *>(bytes), size * count)) {
+    return false;
+  }
+
+  for (std::size_t i = 0; i < count; ++i) {
+    const unsigned char *p = bytes + i * size;
+
+    if (isDouble) {
+      uint64_t bits = 0;
+      for (std::size_t j = 0; j < 8; ++j) {
+        bits |= uint64_t(p[j]) << (8 * j);
+      }
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      values[i] = static_cast<float>(value);
+    } else {
+      uint32_t bits = 0;
+      for (std::size_t j = 0; j < 4; ++j) {
+        bits |= uint32_t(p[j]) << (8 * j);
+      }
+      std::memcpy(&values[i], &bits, sizeof(float));
     }
   }
 
+  return true;
+}
+
+static void readBinary(std::istream& in, Reader& reader) {
+  char header[BinaryHeaderSize];
+
+  if (!in.read(header, BinaryHeaderSize) || std::memcmp(header, BinaryMagic, BinaryMagicSize) != 0) {
+    std::cerr << "Invalid binary header\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (static_cast<unsigned char>(header[4]) > BinaryVersion) {
+    std::cerr << "Unsupported binary version: " << int(static_cast<unsigned char>(header[4])) << '\n';
+    std::exit(EXIT_FAILURE);
+  }
+
+  bool isDouble = (header[5] & BinaryFlagDouble) != 0;
+
+  for (int record; (record = in.get()) != std::char_traits<char>::eof(); ) {
+    float values[3];
+
+    switch (record) {
+      case EndRecord:
+        return;
+
+      case ColorRecord:
+        if (!readNumbers(in, isDouble, values, 3)) {
+          return;
+        }
+        readColor(reader, gf::Color4f(values[0], values[1], values[2], 1.0f));
+        break;
+
+      case MoveToRecord:
+      case LineToRecord:
+        if (!readNumbers(in, isDouble, values, 2)) {
+          return;
+        }
+        readMove(reader, gf::Vector2f(values[0], values[1]), record == LineToRecord, in);
+        break;
+
+      case TextRecord: {
+        unsigned char bytes[4];
+        if (!in.read(reinterpret_cast<char *>(bytes), 4)) {
+          return;
+        }
+        uint32_t size = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+        in.ignore(size);
+        break;
+      }
+
+      default:
+        std::cerr << "Unknown binary record: " << record << '\n';
+        return;
+    }
+  }
+}
+
+static void readInput(std::shared_ptr<Incoming> incoming) {
+  Reader reader(std::move(incoming));
+
+  // the binary format is recognized by its first byte, which is never found in the text format
+  if (std::cin.peek() == static_cast<unsigned char>(BinaryMagic[0])) {
+    readBinary(std::cin, reader);
+  } else {
+    readText(std::cin, reader);
+  }
+
+  publish(reader, true);
+}
+
+int main() {
+  std::ios::sync_with_stdio(false);
+
+  // the input is read while the animation runs, the thread is left behind if the window is closed first
+  auto incoming = std::make_shared<Incoming>();
+  std::thread(readInput, incoming).detach();
+
+  std::vector<Step> steps;
+  std::vector<gf::Vertex> vertices;
+  bool loaded = false;
+
   static constexpr gf::Vector2u ScreenSize(1024, 576);
   static constexpr gf::Vector2f ViewSize(1000.0f, 1000.0f);
   static constexpr gf::Vector2f ViewCenter(0.0f, 0.0f);
@@ -94,6 +434,9 @@ int main() {
 
   views.setInitialFramebufferSize(ScreenSize);
 
+  // the mouse wheel zooms, dragging moves
+  gf::ZoomingViewAdaptor adaptor(renderer, mainView);
+
   // actions
 
   gf::ActionContainer actions;
@@ -125,9 +468,13 @@ int main() {
   renderer.clear(gf::Color::White);
   gf::Clock clock;
 
+  // the whole drawing is animated in Duration seconds, the speed is adapted as more steps arrive
   static constexpr float Duration = 10.0f;
   static constexpr float Jump = 1.0f; // for forward and backward
-  float elapsed = 0;
+  double progress = 0; // steps revealed, the fractional part is the current step
+
+  // vertex buffers of the chunks already revealed, kept when going backward
+  std::vector<Chunk> chunks;
 
   while (window.isOpen()) {
     // 1. input
@@ -137,6 +484,7 @@ int main() {
     while (window.pollEvent(event)) {
       actions.processEvent(event);
       views.processEvent(event);
+      adaptor.processEvent(event);
     }
 
     if (closeWindowAction.isActive()) {
@@ -147,75 +495,98 @@ int main() {
       window.toggleFullscreen();
     }
 
+    // 2. update
+
+    if (!loaded) {
+      std::lock_guard<std::mutex> lock(incoming->mutex);
+      steps.insert(steps.end(), incoming->steps.begin(), incoming->steps.end());
+      vertices.insert(vertices.end(), incoming->vertices.begin(), incoming->vertices.end());
+      incoming->steps.clear();
+      incoming->vertices.clear();
+      loaded = incoming->done;
+    }
+
+    const std::size_t movements = steps.size();
+    const double speed = movements / Duration; // steps per second
+
     if (finishAction.isActive()) {
-      elapsed = Duration;
+      progress = movements;
     }
 
     if (forwardAction.isActive()) {
-      elapsed += Jump;
+      progress += Jump * speed;
     }
 
     if (backwardAction.isActive()) {
-      elapsed -= Jump;
+      progress -= Jump * speed;
     }
 
-    // 2. update
-
     float dt = clock.restart().asSeconds();
-    elapsed += dt;
+    progress += dt * speed;
 
-    elapsed = gf::clamp(elapsed, 0.0f, Duration);
+    progress = gf::clamp(progress, 0.0, static_cast<double>(movements));
 
     // 3. draw
 
     renderer.clear();
     renderer.setView(mainView);
 
-    if (!commands.empty()) {
-      float steps = elapsed / Duration * movements;
-      std::size_t maxStep = std::floor(steps);
-      float inStep = std::fmod(steps, 1.0f);
+    if (!steps.empty()) {
+      std::size_t maxStep = std::floor(progress);
+      float inStep = static_cast<float>(progress - maxStep);
+
+      // the segments of the steps before the current one are complete
+      std::size_t complete = maxStep == 0 ? 0 : steps[std::min(maxStep, movements) - 1].vertexEnd;
+
+      while (chunks.size() < complete / ChunkVertices) {
+        // the steps ending in the chunk, their vertex ends are sorted
+        auto endsAfter = [](std::size_t end, const Step& step) { return end < step.vertexEnd; };
+        std::size_t firstStep = std::upper_bound(steps.begin(), steps.end(), chunks.size() * ChunkVertices, endsAfter) - steps.begin();
+        std::size_t endStep = std::upper_bound(steps.begin(), steps.end(), (chunks.size() + 1) * ChunkVertices, endsAfter) - steps.begin();
+        chunks.emplace_back(vertices.data() + chunks.size() * ChunkVertices, firstStep, endStep);
+      }
 
-      gf::Vector2f currPoint(0, 0);
-      gf::Color4f currColor = gf::Color::Black;
+      std::size_t chunked = complete / ChunkVertices;
 
-      auto itPoint = points.begin();
-      auto itColor = colors.begin();
+      // the chunks out of the view are skipped, the others are drawn at the detail of the pixels
+      gf::Vector2f viewCenter = mainView.getCenter();
+      gf::Vector2f viewSize = mainView.getSize();
+      Bounds visible = { viewCenter - viewSize / 2, viewCenter + viewSize / 2 };
+      std::size_t level = levelOfDetail(viewSize.x / renderer.getSize().x);
 
-      std::size_t currStep = 0;
+      for (std::size_t i = 0; i < chunked; ++i) {
+        Chunk& chunk = chunks[i];
 
-      for (auto cmd : commands) {
-        if (currStep > maxStep) {
-          break;
+        if (!intersects(chunk.bounds, visible)) {
+          continue;
         }
 
-        switch (cmd) {
-          case Command::Color:
-            currColor = *itColor++;
-            break;
-          case Command::MoveTo:
-            currPoint = *itPoint++;
-            break;
-          case Command::LineTo: {
-            gf::Vector2f nextPoint = *itPoint++;
-
-            if (currStep == maxStep) {
-              nextPoint = gf::lerp(currPoint, nextPoint, inStep);
-            }
-
-            gf::Line line(currPoint, nextPoint);
-            line.setColor(currColor);
-            line.setWidth(3.0f);
-            renderer.draw(line);
-
-            currPoint = nextPoint;
-            break;
-          }
+        if (level == 0) {
+          renderer.draw(chunk.buffer);
+        } else if (const gf::VertexBuffer *simplified = chunk.getLevel(steps, level)) {
+          renderer.draw(*simplified);
         }
+      }
+
+      std::size_t pending = complete - chunked * ChunkVertices;
+
+      if (pending > 0) {
+        renderer.draw(vertices.data() + chunked * ChunkVertices, pending, gf::PrimitiveType::Triangles);
+      }
+
+      gf::Vector2f currPoint = maxStep == 0 ? steps[0].from : steps[std::min(maxStep, movements) - 1].to;
+
+      if (maxStep < movements) {
+        const Step& step = steps[maxStep];
 
+        if (step.line) {
+          currPoint = gf::lerp(step.from, step.to, inStep);
 
-        if (cmd != Command::Color) {
-          ++currStep;
+          std::vector<gf::Vertex> current;
+          appendSegment(current, step.from, currPoint, step.color);
+          renderer.draw(current.data(), current.size(), gf::PrimitiveType::Triangles);
+        } else {
+          currPoint = step.to;
         }
       }
 
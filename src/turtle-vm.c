@@ -0,0 +1,962 @@
+// Jade GURNAUD and Charlotte KRUZIC
+#include "turtle-vm.h"
+#include "turtle-memo.h"
+#include "turtle-output.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// threaded dispatch relies on the labels as values extension
+#if defined(__GNUC__)
+#define VM_THREADED 1
+#endif
+
+#define VM_CALL_DEPTH_MAX 1000000
+
+/**
+ * Append an instruction to the program
+ *
+ * @param self the program being compiled
+ * @param op the operation of the instruction
+ * @param a the first operand
+ * @param b the second operand
+ * @param c the third operand
+ *
+ * @return the address of the new instruction
+ */
+static size_t vm_emit(struct vm_program *self, enum vm_opcode op, int a, int b, int c)
+{
+	if (self->code_count == self->code_capacity)
+	{
+		self->code_capacity = self->code_capacity == 0 ? 64 : self->code_capacity * 2;
+		self->code = realloc(self->code, self->code_capacity * sizeof(struct vm_instr));
+	}
+
+	struct vm_instr *instr = &self->code[self->code_count];
+	instr->op = op;
+	instr->a = a;
+	instr->b = b;
+	instr->c = c;
+	instr->u.value = 0;
+	return self->code_count++;
+}
+
+/**
+ * Append an instruction that stops the program with an error message
+ *
+ * @param self the program being compiled
+ * @param message the message printed on stderr
+ */
+static void vm_emit_fail(struct vm_program *self, const char *message)
+{
+	size_t addr = vm_emit(self, OP_FAIL, 0, 0, 0);
+	self->code[addr].u.message = message;
+}
+
+/**
+ * Append an instruction that loads a constant in a register
+ *
+ * @param self the program being compiled
+ * @param dst the destination register
+ * @param value the constant
+ */
+static void vm_emit_const(struct vm_program *self, int dst, double value)
+{
+	size_t addr = vm_emit(self, OP_CONST, dst, 0, 0);
+	self->code[addr].u.value = value;
+}
+
+/**
+ * Reserve a register
+ *
+ * @param self the program being compiled
+ * @param reg the register that will be used
+ */
+static void vm_use_register(struct vm_program *self, int reg)
+{
+	if ((size_t)reg >= self->register_count)
+	{
+		self->register_count = reg + 1;
+	}
+}
+
+/**
+ * Tell whether a node is a literal outside of the given bounds. The
+ * evaluator only checks the range of literal arguments, so does the compiler.
+ *
+ * @param node the node to check
+ * @param min the lower bound
+ * @param max the upper bound
+ *
+ * @return true if the node is a literal outside of [min, max]
+ */
+static bool vm_literal_out_of(const struct ast_node *node, double min, double max)
+{
+	return node != NULL && node->kind == KIND_EXPR_VALUE && !(node->u.value >= min && node->u.value <= max);
+}
+
+/**
+ * Tell whether a node is a literal angle outside of ]-360, 360[
+ *
+ * @param node the node to check
+ *
+ * @return true if the node is a literal that is not a valid angle
+ */
+static bool vm_literal_bad_angle(const struct ast_node *node)
+{
+	return node != NULL && node->kind == KIND_EXPR_VALUE && !(node->u.value < 360 && node->u.value > -360);
+}
+
+/**
+ * Compile an expression so that its value ends up in a register
+ *
+ * @param self the program being compiled
+ * @param node the expression to compile
+ * @param dst the destination register, registers above are free to use
+ */
+static void vm_compile_expr(struct vm_program *self, const struct ast_node *node, int dst)
+{
+	vm_use_register(self, dst);
+
+	if (node == NULL)
+	{
+		vm_emit_const(self, dst, 0);
+		return;
+	}
+
+	switch (node->kind)
+	{
+	case KIND_EXPR_VALUE:
+		vm_emit_const(self, dst, node->u.value);
+		break;
+	case KIND_EXPR_NAME:
+		vm_emit(self, OP_LOAD, dst, node->symbol, 0);
+		break;
+	case KIND_EXPR_BLOCK:
+		vm_compile_expr(self, node->children[0], dst);
+		break;
+	case KIND_EXPR_UNOP:
+		vm_compile_expr(self, node->children[0], dst);
+		vm_emit(self, OP_NEG, dst, dst, 0);
+		break;
+	case KIND_EXPR_BINOP:
+	{
+		enum vm_opcode op;
+		switch (node->u.op)
+		{
+		case '+':
+			op = OP_ADD;
+			break;
+		case '-':
+			op = OP_SUB;
+			break;
+		case '*':
+			op = OP_MUL;
+			break;
+		case '/':
+			op = OP_DIV;
+			break;
+		case '^':
+			op = OP_POW;
+			break;
+		default:
+			// the comma only makes sense as an argument of position, color and random
+			vm_emit_const(self, dst, 0);
+			return;
+		}
+		vm_compile_expr(self, node->children[0], dst);
+		vm_compile_expr(self, node->children[1], dst + 1);
+		vm_emit(self, op, dst, dst, dst + 1);
+	}
+	break;
+	case KIND_EXPR_FUNC:
+		switch (node->u.func)
+		{
+		case FUNC_SQRT:
+			if (vm_literal_out_of(node->children[0], 0, INFINITY))
+			{
+				vm_emit_fail(self, "Error ! The sqrt function only takes positive or null numbers.\n");
+				return;
+			}
+			vm_compile_expr(self, node->children[0], dst);
+			vm_emit(self, OP_SQRT, dst, dst, 0);
+			break;
+		case FUNC_SIN:
+			if (vm_literal_out_of(node->children[0], 0, 90))
+			{
+				vm_emit_fail(self, "Error! The sin function only takes angles between 0° and 90°\n");
+				return;
+			}
+			vm_compile_expr(self, node->children[0], dst);
+			vm_emit(self, OP_SIN, dst, dst, 0);
+			break;
+		case FUNC_COS:
+			if (vm_literal_out_of(node->children[0], 0, 180))
+			{
+				vm_emit_fail(self, "Error! The cos function only takes angles between 0° and 180°\n");
+				return;
+			}
+			vm_compile_expr(self, node->children[0], dst);
+			vm_emit(self, OP_COS, dst, dst, 0);
+			break;
+		case FUNC_TAN:
+			vm_compile_expr(self, node->children[0], dst);
+			vm_emit(self, OP_TAN, dst, dst, 0);
+			break;
+		case FUNC_RANDOM:
+		{
+			const struct ast_node *parenthese = node->children[0];
+			const struct ast_node *virgule = ast_node_child(parenthese, 0);
+			vm_compile_expr(self, ast_node_child(virgule, 0), dst);
+			vm_compile_expr(self, ast_node_child(virgule, 1), dst + 1);
+			vm_emit(self, OP_RANDOM, dst, dst, dst + 1);
+		}
+		break;
+		}
+		break;
+	default:
+		vm_emit_const(self, dst, 0);
+		break;
+	}
+}
+
+static void vm_compile_cmds(struct vm_program *self, const struct ast_node *node);
+
+/**
+ * Compile a command with a single argument evaluated in the register 0
+ *
+ * @param self the program being compiled
+ * @param op the operation of the command
+ * @param expr the argument of the command
+ */
+static void vm_compile_unary_cmd(struct vm_program *self, enum vm_opcode op, const struct ast_node *expr)
+{
+	vm_compile_expr(self, expr, 0);
+	vm_emit(self, op, 0, 0, 0);
+}
+
+/**
+ * Compile a simple command
+ *
+ * @param self the program being compiled
+ * @param node the command to compile
+ */
+static void vm_compile_simple(struct vm_program *self, const struct ast_node *node)
+{
+	switch (node->u.cmd)
+	{
+	case CMD_UP:
+		vm_emit(self, OP_UP, 0, 0, 0);
+		break;
+	case CMD_DOWN:
+		vm_emit(self, OP_DOWN, 0, 0, 0);
+		break;
+	case CMD_HOME:
+		vm_emit(self, OP_HOME, 0, 0, 0);
+		break;
+	case CMD_FORWARD:
+		vm_compile_unary_cmd(self, OP_FORWARD, node->children[0]);
+		break;
+	case CMD_BACKWARD:
+		vm_compile_unary_cmd(self, OP_BACKWARD, node->children[0]);
+		break;
+	case CMD_RIGHT:
+		if (vm_literal_bad_angle(node->children[0]))
+		{
+			vm_emit_fail(self, "Error ! The angle to go right must be between -360° and 360°\n");
+			break;
+		}
+		vm_compile_unary_cmd(self, OP_RIGHT, node->children[0]);
+		break;
+	case CMD_LEFT:
+		if (vm_literal_bad_angle(node->children[0]))
+		{
+			vm_emit_fail(self, "Error ! The angle to go left must be between -360° and 360°\n");
+			break;
+		}
+		vm_compile_unary_cmd(self, OP_LEFT, node->children[0]);
+		break;
+	case CMD_HEADING:
+		if (vm_literal_bad_angle(node->children[0]))
+		{
+			vm_emit_fail(self, "Error ! The absolute angle must be between -360° and 360°\n");
+			break;
+		}
+		vm_compile_unary_cmd(self, OP_HEADING, node->children[0]);
+		break;
+	case CMD_POSITION:
+	{
+		const struct ast_node *virgule = node->children[0];
+		vm_compile_expr(self, ast_node_child(virgule, 0), 0);
+		vm_compile_expr(self, ast_node_child(virgule, 1), 1);
+		vm_emit(self, OP_POSITION, 0, 1, 0);
+	}
+	break;
+	case CMD_COLOR:
+	{
+		const struct ast_node *child = node->children[0];
+
+		// If the color was given by name
+		if (child->children_count == 0)
+		{
+			double r, g, b;
+			if (child->kind != KIND_EXPR_NAME || !color_from_name(child->u.name, &r, &g, &b))
+			{
+				vm_emit_fail(self, "Error ! The color does not exist.");
+				break;
+			}
+			vm_use_register(self, 2);
+			vm_emit_const(self, 0, r);
+			vm_emit_const(self, 1, g);
+			vm_emit_const(self, 2, b);
+		}
+		// If the color was given by three doubles
+		else
+		{
+			vm_compile_expr(self, ast_node_child(child->children[0], 0), 0);
+			vm_compile_expr(self, ast_node_child(child->children[0], 1), 1);
+			vm_compile_expr(self, ast_node_child(child, 1), 2);
+		}
+		vm_emit(self, OP_COLOR, 0, 1, 2);
+	}
+	break;
+	case CMD_PRINT:
+	{
+		size_t addr = vm_emit(self, OP_PRINT, 0, 0, 0);
+		self->code[addr].u.node = node->children[0];
+	}
+	break;
+	}
+}
+
+/**
+ * Compile a single command, without the commands that follow it
+ *
+ * @param self the program being compiled
+ * @param node the command to compile
+ */
+static void vm_compile_cmd(struct vm_program *self, const struct ast_node *node)
+{
+	switch (node->kind)
+	{
+	case KIND_CMD_SIMPLE:
+		vm_compile_simple(self, node);
+		break;
+	case KIND_CMD_BLOCK:
+		vm_compile_cmds(self, node->children[0]);
+		break;
+	case KIND_CMD_REPEAT:
+	{
+		vm_compile_expr(self, node->children[0], 0);
+		size_t start = vm_emit(self, OP_REPEAT, 0, 0, 0);
+		self->code[start].u.node = node->children[1];
+		vm_compile_cmds(self, node->children[1]);
+		vm_emit(self, OP_LOOP, 0, start + 1, 0);
+		self->code[start].b = self->code_count;
+	}
+	break;
+	case KIND_CMD_SET:
+	{
+		int slot = node->children[0]->symbol;
+		vm_emit(self, OP_DECLARE, slot, 0, 0);
+		vm_compile_expr(self, node->children[1], 0);
+		vm_emit(self, OP_STORE, slot, 0, 0);
+	}
+	break;
+	case KIND_CMD_PROC:
+	{
+		// the body is laid out inline and skipped when the definition is executed
+		int slot = node->children[0]->symbol;
+		size_t define = vm_emit(self, OP_PROC, slot, 0, 0);
+		self->code[define].u.node = node->children[1];
+		size_t skip = vm_emit(self, OP_JUMP, 0, 0, 0);
+		self->code[define].b = self->code_count;
+		vm_compile_cmds(self, node->children[1]);
+		vm_emit(self, OP_RETURN, 0, 0, 0);
+		self->code[skip].a = self->code_count;
+	}
+	break;
+	case KIND_CMD_CALL:
+		vm_emit(self, OP_CALL, node->children[0]->symbol, 0, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Compile a sequence of commands
+ *
+ * @param self the program being compiled
+ * @param node the first command of the sequence
+ */
+static void vm_compile_cmds(struct vm_program *self, const struct ast_node *node)
+{
+	for (; node != NULL; node = node->next)
+	{
+		vm_compile_cmd(self, node);
+	}
+}
+
+/**
+ * Compile an abstract syntax tree into a program for the virtual machine
+ *
+ * @param self the program to initialize
+ * @param ast the tree to compile
+ */
+void vm_program_compile(struct vm_program *self, const struct ast *ast)
+{
+	vm_program_compile_cmds(self, ast_program(ast), &ast->symbols);
+}
+
+/**
+ * Compile a sequence of commands into a program for the virtual machine
+ *
+ * @param self the program to initialize
+ * @param cmds the first command of the sequence
+ * @param symbols the names used by the commands
+ */
+void vm_program_compile_cmds(struct vm_program *self, const struct ast_node *cmds, const struct symbol_table *symbols)
+{
+	memset(self, 0, sizeof(struct vm_program));
+	self->symbols = symbols;
+	vm_use_register(self, 0);
+	vm_compile_cmds(self, cmds);
+	vm_emit(self, OP_HALT, 0, 0, 0);
+}
+
+/**
+ * Free the memory allocated for a compiled program
+ *
+ * @param self the program to destroy
+ */
+void vm_program_destroy(struct vm_program *self)
+{
+	free(self->code);
+}
+
+/**
+ * Initialize the execution state of a program. The variables live in the
+ * context, indexed by the same symbols as the program.
+ *
+ * @param self the virtual machine to initialize
+ * @param program the program that will be executed
+ * @param ctx the execution context
+ */
+void vm_create(struct vm *self, const struct vm_program *program, struct context *ctx)
+{
+	self->program = program;
+	self->registers = calloc(program->register_count, sizeof(double));
+
+	context_reserve(ctx);
+	size_t symbol_count = program->symbols->count;
+	self->proc_entries = malloc((symbol_count + 1) * sizeof(long));
+	for (size_t i = 0; i < symbol_count; i++)
+	{
+		self->proc_entries[i] = -1;
+	}
+
+	self->loops = NULL;
+	self->loop_count = 0;
+	self->loop_capacity = 0;
+	self->calls = NULL;
+	self->call_count = 0;
+	self->call_capacity = 0;
+	self->record_depth = VM_NOT_RECORDING;
+	self->record_loop = VM_NOT_RECORDING;
+	self->loop_remaining = 0;
+}
+
+/**
+ * Free the memory allocated for the execution state
+ *
+ * @param self the virtual machine to destroy
+ */
+void vm_destroy(struct vm *self)
+{
+	free(self->registers);
+	free(self->proc_entries);
+	free(self->loops);
+	free(self->calls);
+}
+
+// the node kind each instruction was compiled from, -1 for the control flow added by the compiler
+static const int vm_op_kinds[OP_COUNT] = {
+	[OP_HALT] = -1,
+	[OP_CONST] = KIND_EXPR_VALUE,
+	[OP_LOAD] = KIND_EXPR_NAME,
+	[OP_NEG] = KIND_EXPR_UNOP,
+	[OP_ADD] = KIND_EXPR_BINOP,
+	[OP_SUB] = KIND_EXPR_BINOP,
+	[OP_MUL] = KIND_EXPR_BINOP,
+	[OP_DIV] = KIND_EXPR_BINOP,
+	[OP_POW] = KIND_EXPR_BINOP,
+	[OP_SQRT] = KIND_EXPR_FUNC,
+	[OP_SIN] = KIND_EXPR_FUNC,
+	[OP_COS] = KIND_EXPR_FUNC,
+	[OP_TAN] = KIND_EXPR_FUNC,
+	[OP_RANDOM] = KIND_EXPR_FUNC,
+	[OP_UP] = KIND_CMD_SIMPLE,
+	[OP_DOWN] = KIND_CMD_SIMPLE,
+	[OP_HOME] = KIND_CMD_SIMPLE,
+	[OP_FORWARD] = KIND_CMD_SIMPLE,
+	[OP_BACKWARD] = KIND_CMD_SIMPLE,
+	[OP_RIGHT] = KIND_CMD_SIMPLE,
+	[OP_LEFT] = KIND_CMD_SIMPLE,
+	[OP_HEADING] = KIND_CMD_SIMPLE,
+	[OP_POSITION] = KIND_CMD_SIMPLE,
+	[OP_COLOR] = KIND_CMD_SIMPLE,
+	[OP_PRINT] = KIND_CMD_SIMPLE,
+	[OP_DECLARE] = -1,
+	[OP_STORE] = KIND_CMD_SET,
+	[OP_PROC] = KIND_CMD_PROC,
+	[OP_CALL] = KIND_CMD_CALL,
+	[OP_RETURN] = -1,
+	[OP_REPEAT] = KIND_CMD_REPEAT,
+	[OP_LOOP] = -1,
+	[OP_JUMP] = -1,
+	[OP_FAIL] = -1,
+};
+
+// the simple command of the instructions of kind KIND_CMD_SIMPLE
+static const int vm_op_cmds[OP_COUNT] = {
+	[OP_UP] = CMD_UP,
+	[OP_DOWN] = CMD_DOWN,
+	[OP_HOME] = CMD_HOME,
+	[OP_FORWARD] = CMD_FORWARD,
+	[OP_BACKWARD] = CMD_BACKWARD,
+	[OP_RIGHT] = CMD_RIGHT,
+	[OP_LEFT] = CMD_LEFT,
+	[OP_HEADING] = CMD_HEADING,
+	[OP_POSITION] = CMD_POSITION,
+	[OP_COLOR] = CMD_COLOR,
+	[OP_PRINT] = CMD_PRINT,
+};
+
+/**
+ * Add the instructions executed by a run to the statistics of the evaluators
+ *
+ * @param counts the number of executions of each opcode
+ * @param stats the statistics
+ */
+static void vm_count(const size_t *counts, struct eval_stats *stats)
+{
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		int kind = vm_op_kinds[op];
+		if (kind < 0)
+		{
+			continue;
+		}
+		stats->kinds[kind] += counts[op];
+		if (kind == KIND_CMD_SIMPLE)
+		{
+			stats->cmds[vm_op_cmds[op]] += counts[op];
+		}
+	}
+	stats->lookups += counts[OP_LOAD] + counts[OP_DECLARE] + counts[OP_STORE] + counts[OP_PROC] + counts[OP_CALL];
+}
+
+/**
+ * Run a program from its first instruction until it halts. When the context
+ * collects statistics, each instruction is counted before being dispatched.
+ *
+ * @param self the virtual machine
+ * @param ctx the execution context
+ */
+void vm_run(struct vm *self, struct context *ctx)
+{
+	const struct vm_instr *code = self->program->code;
+	const struct vm_instr *ip = code;
+	double *r = self->registers;
+	struct variable *variables = ctx->variables;
+	size_t counts[OP_COUNT] = {0};
+
+#ifdef VM_THREADED
+	static const void *dispatch[OP_COUNT] = {
+		[OP_HALT] = &&L_OP_HALT,
+		[OP_CONST] = &&L_OP_CONST,
+		[OP_LOAD] = &&L_OP_LOAD,
+		[OP_NEG] = &&L_OP_NEG,
+		[OP_ADD] = &&L_OP_ADD,
+		[OP_SUB] = &&L_OP_SUB,
+		[OP_MUL] = &&L_OP_MUL,
+		[OP_DIV] = &&L_OP_DIV,
+		[OP_POW] = &&L_OP_POW,
+		[OP_SQRT] = &&L_OP_SQRT,
+		[OP_SIN] = &&L_OP_SIN,
+		[OP_COS] = &&L_OP_COS,
+		[OP_TAN] = &&L_OP_TAN,
+		[OP_RANDOM] = &&L_OP_RANDOM,
+		[OP_UP] = &&L_OP_UP,
+		[OP_DOWN] = &&L_OP_DOWN,
+		[OP_HOME] = &&L_OP_HOME,
+		[OP_FORWARD] = &&L_OP_FORWARD,
+		[OP_BACKWARD] = &&L_OP_BACKWARD,
+		[OP_RIGHT] = &&L_OP_RIGHT,
+		[OP_LEFT] = &&L_OP_LEFT,
+		[OP_HEADING] = &&L_OP_HEADING,
+		[OP_POSITION] = &&L_OP_POSITION,
+		[OP_COLOR] = &&L_OP_COLOR,
+		[OP_PRINT] = &&L_OP_PRINT,
+		[OP_DECLARE] = &&L_OP_DECLARE,
+		[OP_STORE] = &&L_OP_STORE,
+		[OP_PROC] = &&L_OP_PROC,
+		[OP_CALL] = &&L_OP_CALL,
+		[OP_RETURN] = &&L_OP_RETURN,
+		[OP_REPEAT] = &&L_OP_REPEAT,
+		[OP_LOOP] = &&L_OP_LOOP,
+		[OP_JUMP] = &&L_OP_JUMP,
+		[OP_FAIL] = &&L_OP_FAIL,
+	};
+	// every instruction goes through the counter first
+	static const void *counted[OP_COUNT] = {
+		[0 ... OP_COUNT - 1] = &&L_COUNT,
+	};
+	const void *const *table = ctx->stats != NULL ? counted : dispatch;
+#define VM_CASE(op) L_##op:
+#define VM_DISPATCH() goto *table[ip->op]
+#define VM_NEXT()  \
+	do             \
+	{              \
+		++ip;      \
+		VM_DISPATCH(); \
+	} while (0)
+
+	VM_DISPATCH();
+
+L_COUNT:
+	counts[ip->op]++;
+	goto *dispatch[ip->op];
+#else
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() continue
+#define VM_NEXT()  \
+	{              \
+		++ip;      \
+		continue;  \
+	}
+
+	bool counting = ctx->stats != NULL;
+	for (;;)
+	{
+		if (counting)
+		{
+			counts[ip->op]++;
+		}
+		switch (ip->op)
+		{
+#endif
+
+	VM_CASE(OP_HALT)
+	{
+		if (ctx->stats != NULL)
+		{
+			vm_count(counts, ctx->stats);
+		}
+		return;
+	}
+	VM_CASE(OP_CONST)
+	{
+		r[ip->a] = ip->u.value;
+		VM_NEXT();
+	}
+	VM_CASE(OP_LOAD)
+	{
+		if (!variables[ip->b].defined)
+		{
+			context_error(ctx, "Error ! Variable does not exist.");
+		}
+		r[ip->a] = variables[ip->b].value;
+		VM_NEXT();
+	}
+	VM_CASE(OP_NEG)
+	{
+		r[ip->a] = -r[ip->b];
+		VM_NEXT();
+	}
+	VM_CASE(OP_ADD)
+	{
+		r[ip->a] = r[ip->b] + r[ip->c];
+		VM_NEXT();
+	}
+	VM_CASE(OP_SUB)
+	{
+		r[ip->a] = r[ip->b] - r[ip->c];
+		VM_NEXT();
+	}
+	VM_CASE(OP_MUL)
+	{
+		r[ip->a] = r[ip->b] * r[ip->c];
+		VM_NEXT();
+	}
+	VM_CASE(OP_DIV)
+	{
+		r[ip->a] = r[ip->b] / r[ip->c];
+		VM_NEXT();
+	}
+	VM_CASE(OP_POW)
+	{
+		r[ip->a] = pow(r[ip->b], r[ip->c]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_SQRT)
+	{
+		r[ip->a] = sqrt(r[ip->b]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_SIN)
+	{
+		r[ip->a] = sin(r[ip->b]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_COS)
+	{
+		r[ip->a] = cos(r[ip->b]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_TAN)
+	{
+		r[ip->a] = tan(r[ip->b]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_RANDOM)
+	{
+		int min = r[ip->b];
+		int max = r[ip->c];
+		if (min > max)
+		{
+			context_error(ctx, "Error ! The first bound of the random is greater than the second.\n");
+		}
+		r[ip->a] = random_range(&ctx->random, min, max);
+		VM_NEXT();
+	}
+	VM_CASE(OP_UP)
+	{
+		ctx->up = true;
+		VM_NEXT();
+	}
+	VM_CASE(OP_DOWN)
+	{
+		ctx->up = false;
+		VM_NEXT();
+	}
+	VM_CASE(OP_HOME)
+	{
+		context_home(ctx);
+		VM_NEXT();
+	}
+	VM_CASE(OP_FORWARD)
+	{
+		context_move(ctx, r[ip->a]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_BACKWARD)
+	{
+		context_move(ctx, -r[ip->a]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_RIGHT)
+	{
+		context_turn(ctx, ctx->angle + r[ip->a]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_LEFT)
+	{
+		context_turn(ctx, ctx->angle - r[ip->a]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_HEADING)
+	{
+		context_turn(ctx, r[ip->a]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_POSITION)
+	{
+		context_position(ctx, r[ip->a], r[ip->b]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_COLOR)
+	{
+		if (r[ip->a] < 0 || r[ip->a] > 1 ||
+			r[ip->b] < 0 || r[ip->b] > 1 ||
+			r[ip->c] < 0 || r[ip->c] > 1)
+		{
+			context_error(ctx, "Error ! Color values must be in the range [0, 1].\n");
+		}
+		context_color(ctx, r[ip->a], r[ip->b], r[ip->c]);
+		VM_NEXT();
+	}
+	VM_CASE(OP_PRINT)
+	{
+		context_print(ctx, ip->u.node);
+		VM_NEXT();
+	}
+	VM_CASE(OP_DECLARE)
+	{
+		if (variables[ip->a].defined)
+		{
+			context_error(ctx, "Error ! The variable already exists.\n");
+		}
+		VM_NEXT();
+	}
+	VM_CASE(OP_STORE)
+	{
+		variables[ip->a].value = r[ip->b];
+		variables[ip->a].defined = true;
+		VM_NEXT();
+	}
+	VM_CASE(OP_PROC)
+	{
+		if (self->proc_entries[ip->a] >= 0)
+		{
+			context_error(ctx, "Error ! The procedure already exists.\n");
+		}
+		self->proc_entries[ip->a] = ip->b;
+		// the body is looked up by the memoization of the calls
+		ctx->procedures[ip->a].nodes = ip->u.node;
+		VM_NEXT();
+	}
+	VM_CASE(OP_CALL)
+	{
+		long entry = self->proc_entries[ip->a];
+		if (entry < 0)
+		{
+			context_error(ctx, "Error ! Procedure %s does not exist.\n", self->program->symbols->names[ip->a]);
+		}
+		if (self->call_count >= VM_CALL_DEPTH_MAX)
+		{
+			context_error(ctx, "Error ! Too many nested procedure calls.\n");
+		}
+		enum memo_call call = memo_call(ctx, ip->a);
+		if (call == MEMO_CALL_REPLAYED)
+		{
+			VM_NEXT();
+		}
+		if (call == MEMO_CALL_RECORD)
+		{
+			self->record_depth = self->call_count;
+		}
+		if (self->call_count == self->call_capacity)
+		{
+			size_t capacity = self->call_capacity == 0 ? 64 : self->call_capacity * 2;
+			size_t *calls = realloc(self->calls, capacity * sizeof(size_t));
+			if (calls == NULL)
+			{
+				context_error(ctx, "Error ! Not enough memory for the procedure calls.\n");
+			}
+			self->calls = calls;
+			self->call_capacity = capacity;
+		}
+		self->calls[self->call_count++] = ip - code + 1;
+		ip = code + entry;
+		VM_DISPATCH();
+	}
+	VM_CASE(OP_RETURN)
+	{
+		assert(self->call_count > 0);
+		ip = code + self->calls[--self->call_count];
+		if (self->call_count == self->record_depth)
+		{
+			memo_record_end(ctx);
+			self->record_depth = VM_NOT_RECORDING;
+		}
+		VM_DISPATCH();
+	}
+	VM_CASE(OP_REPEAT)
+	{
+		int nb_repeat = r[ip->a];
+		if (nb_repeat < 0)
+		{
+			context_error(ctx, "Error ! Cannot repeat a command a negative number of times.\n");
+		}
+		if (nb_repeat == 0)
+		{
+			ip = code + ip->b;
+			VM_DISPATCH();
+		}
+		if (self->loop_count == self->loop_capacity)
+		{
+			self->loop_capacity = self->loop_capacity == 0 ? 16 : self->loop_capacity * 2;
+			self->loops = realloc(self->loops, self->loop_capacity * sizeof(int));
+		}
+		self->loops[self->loop_count++] = nb_repeat;
+		if (memo_repeat_begin(ctx, ip->u.node, nb_repeat, &self->loop_trace))
+		{
+			// one iteration is run, OP_LOOP generates the others
+			self->loops[self->loop_count - 1] = 1;
+			self->record_loop = self->loop_count;
+			self->loop_remaining = nb_repeat - 1;
+		}
+		VM_NEXT();
+	}
+	VM_CASE(OP_LOOP)
+	{
+		if (--self->loops[self->loop_count - 1] > 0)
+		{
+			ip = code + ip->b;
+			VM_DISPATCH();
+		}
+		if (self->loop_count == self->record_loop)
+		{
+			self->record_loop = VM_NOT_RECORDING;
+			if (!memo_repeat_end(ctx, &self->loop_trace, self->loop_remaining))
+			{
+				self->loops[self->loop_count - 1] = self->loop_remaining;
+				ip = code + ip->b;
+				VM_DISPATCH();
+			}
+		}
+		--self->loop_count;
+		VM_NEXT();
+	}
+	VM_CASE(OP_JUMP)
+	{
+		ip = code + ip->a;
+		VM_DISPATCH();
+	}
+	VM_CASE(OP_FAIL)
+	{
+		context_error(ctx, "%s", ip->u.message);
+	}
+
+#ifndef VM_THREADED
+		default:
+			return;
+		}
+	}
+#endif
+
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_NEXT
+}
+
+/**
+ * Compile and run an abstract syntax tree
+ *
+ * @param ast the tree to evaluate
+ * @param ctx the execution context
+ */
+void vm_eval(const struct ast *ast, struct context *ctx)
+{
+	if (ast == NULL)
+	{
+		return;
+	}
+
+	struct vm_program program;
+	vm_program_compile(&program, ast);
+
+	struct vm vm;
+	vm_create(&vm, &program, ctx);
+	vm_run(&vm, ctx);
+	vm_destroy(&vm);
+
+	vm_program_destroy(&program);
+	output_text(ctx->out, "\n", 1);
+	output_flush(ctx->out);
+}
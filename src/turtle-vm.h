@@ -0,0 +1,119 @@
+//Jade GURNAUD and Charlotte KRUZIC
+#ifndef TURTLE_VM_H
+#define TURTLE_VM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "turtle-ast.h"
+#include "turtle-memo.h"
+
+// instructions of the virtual machine
+enum vm_opcode
+{
+	OP_HALT,	 // stop the execution
+	OP_CONST,	 // r[a] = value
+	OP_LOAD,	 // r[a] = variable b
+	OP_NEG,		 // r[a] = -r[b]
+	OP_ADD,		 // r[a] = r[b] + r[c]
+	OP_SUB,		 // r[a] = r[b] - r[c]
+	OP_MUL,		 // r[a] = r[b] * r[c]
+	OP_DIV,		 // r[a] = r[b] / r[c]
+	OP_POW,		 // r[a] = r[b] ^ r[c]
+	OP_SQRT,	 // r[a] = sqrt(r[b])
+	OP_SIN,		 // r[a] = sin(r[b])
+	OP_COS,		 // r[a] = cos(r[b])
+	OP_TAN,		 // r[a] = tan(r[b])
+	OP_RANDOM,	 // r[a] = random integer between r[b] and r[c]
+	OP_UP,		 // pen up
+	OP_DOWN,	 // pen down
+	OP_HOME,	 // back to the initial state
+	OP_FORWARD,	 // move forward by r[a]
+	OP_BACKWARD, // move backward by r[a]
+	OP_RIGHT,	 // turn right by r[a]
+	OP_LEFT,	 // turn left by r[a]
+	OP_HEADING,	 // set the angle to r[a]
+	OP_POSITION, // go to (r[a], r[b])
+	OP_COLOR,	 // set the color to (r[a], r[b], r[c])
+	OP_PRINT,	 // print the expression node
+	OP_DECLARE,	 // fail if variable a already exists
+	OP_STORE,	 // variable a = r[b]
+	OP_PROC,	 // define procedure a with its entry point at b
+	OP_CALL,	 // call procedure a
+	OP_RETURN,	 // return from a procedure
+	OP_REPEAT,	 // start a loop of r[a] iterations running the body node, jump to b if there is none
+	OP_LOOP,	 // end of a loop body, jump back to b if iterations remain
+	OP_JUMP,	 // jump to a
+	OP_FAIL,	 // print the message and exit
+	OP_COUNT,
+};
+
+// an instruction of the virtual machine
+struct vm_instr
+{
+	enum vm_opcode op; // the operation
+
+	int a; // the operands: registers, variable or procedure symbols, jump targets
+	int b;
+	int c;
+
+	union
+	{
+		double value;				 // op == OP_CONST
+		const char *message;		 // op == OP_FAIL
+		const struct ast_node *node; // op == OP_PRINT, or the body of the procedure or loop when op == OP_PROC or op == OP_REPEAT
+	} u;
+};
+
+// a program compiled from the abstract syntax tree
+struct vm_program
+{
+	struct vm_instr *code;
+	size_t code_count;
+	size_t code_capacity;
+
+	size_t register_count; // registers needed by the biggest expression
+
+	const struct symbol_table *symbols; // variables and procedures are indexed by their symbol
+};
+
+// no call or loop is being recorded
+#define VM_NOT_RECORDING ((size_t)-1)
+
+// the execution state of the virtual machine
+struct vm
+{
+	const struct vm_program *program;
+
+	double *registers;
+	long *proc_entries; // entry point of each procedure, -1 if not defined yet
+
+	int *loops; // remaining iterations of the enclosing loops
+	size_t loop_count;
+	size_t loop_capacity;
+
+	size_t *calls; // return addresses of the enclosing calls
+	size_t call_count;
+	size_t call_capacity;
+
+	size_t record_depth; // the depth of the call being recorded, VM_NOT_RECORDING if none
+
+	struct memo_trace loop_trace; // the first iteration of the loop being recorded
+	size_t record_loop;			  // the depth of this loop, VM_NOT_RECORDING if none
+	int loop_remaining;			  // the iterations to generate after it
+};
+
+// compilation
+void vm_program_compile(struct vm_program *self, const struct ast *ast);
+void vm_program_compile_cmds(struct vm_program *self, const struct ast_node *cmds, const struct symbol_table *symbols);
+void vm_program_destroy(struct vm_program *self);
+
+// execution
+void vm_create(struct vm *self, const struct vm_program *program, struct context *ctx);
+void vm_destroy(struct vm *self);
+void vm_run(struct vm *self, struct context *ctx);
+
+// compile and run the tree in one go, like ast_eval
+void vm_eval(const struct ast *ast, struct context *ctx);
+
+#endif /* TURTLE_VM_H */
@@ -1,36 +1,771 @@
 //Jade GURNAUD and Charlotte KRUZIC
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include "turtle-ast.h"
-#include "turtle-lexer.h"
+#include "turtle-batch.h"
+#include "turtle-image.h"
+#include "turtle-optimize.h"
+#include "turtle-output.h"
+#include "turtle-parallel.h"
+#include "turtle-replay.h"
+#include "turtle-scan.h"
+#include "turtle-vm.h"
+// the declarations of the scanner use the types of the parser
 #include "turtle-parser.h"
+#include "turtle-lexer.h"
+
+// command line options
+struct options
+{
+	bool tree_walk; // evaluate with the tree walker instead of the virtual machine
+	int precision;	// number of decimals of the primitives
+	enum output_format format; // encoding of the primitives
+	bool optimize;	// run the optimized program instead of the parsed one
+	bool dump_optimized; // print the optimized program on stderr
+	int print_ast;	// file descriptor where the parsed program is printed, -1 to not print it
+	bool stats;		// report the time of each phase, the work of the evaluators and the memory on stderr
+	bool stream;	// run each top-level command as soon as it is parsed, with the tree walker
+	double simplify; // how far the simplified lines may stray, negative to write the primitives as they come
+	bool memoize;	// replay the calls of the procedures without side effects
+	bool rigid;		// replay the calls rotated from any heading, and generate the rigid loops in closed form
+	long jobs;		// threads running the independent sections of the program, 1 to run it on the main thread
+	bool batch;		// run the programs given as arguments instead of the standard input, on jobs threads
+	const char *output_dir; // where the drawings of a batch are written, NULL to write each one next to its program
+	char **inputs;	// the programs of a batch, files or directories, or the program to run instead of the standard input
+	size_t input_count;
+	bool flex;		// read the programs given as arguments with the Flex scanner instead of mapping them
+	const char *cache_dir; // where the images of the parsed programs are kept, NULL to parse every program
+	uint64_t seed;		   // the seed of the random numbers
+	bool seeded;		   // the seed was given, otherwise it changes at every run
+};
+
+// phases of a run, timed for the statistics
+enum phase
+{
+	PHASE_PARSE,
+	PHASE_OPTIMIZE,
+	PHASE_EVAL,
+	PHASE_FLUSH,
+	PHASE_PRINT,
+	PHASE_CLEANUP,
+	PHASE_COUNT,
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_PARSE] = "parse",
+	[PHASE_OPTIMIZE] = "optimize",
+	[PHASE_EVAL] = "eval",
+	[PHASE_FLUSH] = "flush",
+	[PHASE_PRINT] = "print",
+	[PHASE_CLEANUP] = "cleanup",
+};
+
+static const char *kind_names[AST_KIND_COUNT] = {
+	[KIND_CMD_SIMPLE] = "simple",
+	[KIND_CMD_REPEAT] = "repeat",
+	[KIND_CMD_BLOCK] = "block",
+	[KIND_CMD_PROC] = "proc",
+	[KIND_CMD_CALL] = "call",
+	[KIND_CMD_SET] = "set",
+	[KIND_EXPR_FUNC] = "function",
+	[KIND_EXPR_VALUE] = "value",
+	[KIND_EXPR_UNOP] = "unary",
+	[KIND_EXPR_BINOP] = "binary",
+	[KIND_EXPR_BLOCK] = "parentheses",
+	[KIND_EXPR_NAME] = "name",
+};
+
+static const char *cmd_names[AST_CMD_COUNT] = {
+	[CMD_UP] = "up",
+	[CMD_DOWN] = "down",
+	[CMD_RIGHT] = "right",
+	[CMD_LEFT] = "left",
+	[CMD_HEADING] = "heading",
+	[CMD_FORWARD] = "forward",
+	[CMD_BACKWARD] = "backward",
+	[CMD_POSITION] = "position",
+	[CMD_HOME] = "home",
+	[CMD_COLOR] = "color",
+	[CMD_PRINT] = "print",
+};
+
+// what a run did, gathered along the phases and reported once everything is released
+struct run_stats
+{
+	long long phase_ns[PHASE_COUNT]; // wall time of each phase
+	struct timespec phase_start;	 // start of the current phase
+	struct optimize_stats optimized; // what the optimizer did
+	bool optimize;					 // whether the optimizer ran
+	struct eval_stats eval;			 // what the evaluators did
+	size_t tree_allocated;			 // bytes allocated for the tree and the names
+	size_t tree_reserved;			 // bytes reserved by the arena
+	size_t tree_blocks;				 // blocks of the arena
+	size_t names;					 // symbols of the program
+	struct ast_stream stream;		 // the commands run while parsing, when the program is streamed
+	struct parallel_stats parallel;	 // the sections run on threads
+	size_t primitives;				 // moves and colors written
+	size_t requested;				 // moves and colors asked for by the program
+	size_t bytes;					 // bytes written on the standard output
+	long long write_ns;				 // time spent writing the output
+	const char *image;				 // the image of the program in the cache, NULL without cache
+	bool image_loaded;				 // the program was loaded from its image instead of being parsed
+	bool image_saved;				 // the image was written after the program was parsed
+	const char *drawing;			 // the drawing of the program in the cache, NULL without cache
+	bool replayed;					 // the drawing was sent from the cache instead of running the program
+	bool deterministic;				 // the program draws the same at every run
+	bool recorded;					 // the drawing was kept in the cache after the run
+	uint64_t seed;					 // the seed of the random numbers, to run the program again with the same ones
+};
+
+/**
+ * Print how to use the interpreter
+ *
+ * @param program the name of the executable
+ */
+static void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [options] < program.turtle\n", program);
+	fprintf(stderr, "       %s [options] program.turtle\n", program);
+	fprintf(stderr, "       %s --batch [options] program.turtle|directory...\n", program);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --tree           evaluate the tree directly instead of compiling it to bytecode\n");
+	fprintf(stderr, "  --precision N    number of decimals of the coordinates and colors (0 to %d, default %d)\n", OUTPUT_PRECISION_MAX, OUTPUT_PRECISION_DEFAULT);
+	fprintf(stderr, "  --format F       encoding of the primitives: text (default), binary32 or binary64\n");
+	fprintf(stderr, "  --no-optimize    run the program as it was parsed, without folding the constants\n");
+	fprintf(stderr, "  --dump-optimized print the optimized program on stderr\n");
+	fprintf(stderr, "  --print-ast[=FD] print the parsed program on the file descriptor FD (default 2, stderr)\n");
+	fprintf(stderr, "  --stream         run each top-level command as soon as it is parsed, in bounded memory\n");
+	fprintf(stderr, "                   (tree walker without optimizer, cannot be combined with --dump-optimized or --print-ast)\n");
+	fprintf(stderr, "  --simplify[=TOL] merge collinear lines, drop the moves and colors that change nothing,\n");
+	fprintf(stderr, "                   and let the merged lines stray by at most TOL from the points they replace (default 0)\n");
+	fprintf(stderr, "  --no-memoize     run every call, instead of replaying the calls of the procedures without side effects\n");
+	fprintf(stderr, "  --rigid          also replay them rotated when they are called from another heading, and generate\n");
+	fprintf(stderr, "                   the loops whose body only moves and turns by rotating their first iteration,\n");
+	fprintf(stderr, "                   at the cost of rounding differences in the output\n");
+	fprintf(stderr, "  --jobs[=N]       run the independent sections of the program on N threads (default: one per processor),\n");
+	fprintf(stderr, "                   with the same output as on one thread\n");
+	fprintf(stderr, "  --stats          report the time of each phase, the work of the evaluators and the memory on stderr\n");
+	fprintf(stderr, "  --batch          run the programs given as arguments (and the .turtle files of the directories)\n");
+	fprintf(stderr, "                   on --jobs threads, write each drawing to a .txt file (.trt for the binary formats)\n");
+	fprintf(stderr, "                   and report the time of each program on stdout\n");
+	fprintf(stderr, "  --output-dir DIR where the drawings of a batch are written (default: next to each program)\n");
+	fprintf(stderr, "  --flex           read the programs given as arguments with the Flex scanner instead of mapping them\n");
+	fprintf(stderr, "                   in memory for the hand-written one\n");
+	fprintf(stderr, "  --cache DIR      load the parsed and optimized programs from their images in DIR instead of parsing them,\n");
+	fprintf(stderr, "                   and save the images of the programs that are not there yet; the drawings of the programs\n");
+	fprintf(stderr, "                   without random are kept there too, and sent again instead of running the programs\n");
+	fprintf(stderr, "  --seed N         draw the same random numbers at every run (default: a new seed at each run)\n");
+}
+
+/**
+ * Parse the command line options
+ *
+ * @param opts the options to fill
+ * @param argc the number of arguments
+ * @param argv the arguments
+ *
+ * @return true if the options are valid, false otherwise
+ */
+static bool parse_options(struct options *opts, int argc, char *argv[])
+{
+	opts->tree_walk = false;
+	opts->precision = OUTPUT_PRECISION_DEFAULT;
+	opts->format = OUTPUT_TEXT;
+	opts->optimize = true;
+	opts->dump_optimized = false;
+	opts->print_ast = -1;
+	opts->stats = false;
+	opts->stream = false;
+	opts->simplify = -1;
+	opts->memoize = true;
+	opts->rigid = false;
+	opts->jobs = 1;
+	opts->batch = false;
+	opts->output_dir = NULL;
+	opts->inputs = argv + 1;
+	opts->input_count = 0;
+	opts->flex = false;
+	opts->cache_dir = NULL;
+	opts->seed = 0;
+	opts->seeded = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+		{
+			// the programs are gathered at the start of the arguments, over the ones already read
+			opts->inputs[opts->input_count++] = argv[i];
+		}
+		else if (strcmp(argv[i], "--tree") == 0)
+		{
+			opts->tree_walk = true;
+		}
+		else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc)
+		{
+			char *end;
+			long precision = strtol(argv[++i], &end, 10);
+			if (*end != '\0' || precision < 0 || precision > OUTPUT_PRECISION_MAX)
+			{
+				return false;
+			}
+			opts->precision = precision;
+		}
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+		{
+			const char *format = argv[++i];
+			if (strcmp(format, "text") == 0)
+			{
+				opts->format = OUTPUT_TEXT;
+			}
+			else if (strcmp(format, "binary32") == 0)
+			{
+				opts->format = OUTPUT_BINARY32;
+			}
+			else if (strcmp(format, "binary64") == 0)
+			{
+				opts->format = OUTPUT_BINARY64;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--no-optimize") == 0)
+		{
+			opts->optimize = false;
+		}
+		else if (strcmp(argv[i], "--dump-optimized") == 0)
+		{
+			opts->dump_optimized = true;
+		}
+		else if (strcmp(argv[i], "--print-ast") == 0)
+		{
+			opts->print_ast = STDERR_FILENO;
+		}
+		else if (strncmp(argv[i], "--print-ast=", 12) == 0)
+		{
+			char *end;
+			long fd = strtol(argv[i] + 12, &end, 10);
+			if (argv[i][12] == '\0' || *end != '\0' || fd < 0 || fd > INT_MAX)
+			{
+				return false;
+			}
+			opts->print_ast = fd;
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			opts->stats = true;
+		}
+		else if (strcmp(argv[i], "--simplify") == 0)
+		{
+			opts->simplify = 0;
+		}
+		else if (strncmp(argv[i], "--simplify=", 11) == 0)
+		{
+			char *end;
+			double tolerance = strtod(argv[i] + 11, &end);
+			if (argv[i][11] == '\0' || *end != '\0' || !(tolerance >= 0))
+			{
+				return false;
+			}
+			opts->simplify = tolerance;
+		}
+		else if (strcmp(argv[i], "--no-memoize") == 0)
+		{
+			opts->memoize = false;
+		}
+		else if (strcmp(argv[i], "--rigid") == 0)
+		{
+			opts->rigid = true;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0)
+		{
+			opts->jobs = sysconf(_SC_NPROCESSORS_ONLN);
+			if (opts->jobs < 1)
+			{
+				opts->jobs = 1;
+			}
+		}
+		else if (strncmp(argv[i], "--jobs=", 7) == 0)
+		{
+			char *end;
+			opts->jobs = strtol(argv[i] + 7, &end, 10);
+			if (argv[i][7] == '\0' || *end != '\0' || opts->jobs < 1)
+			{
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+		{
+			opts->stream = true;
+		}
+		else if (strcmp(argv[i], "--batch") == 0)
+		{
+			opts->batch = true;
+		}
+		else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc)
+		{
+			opts->output_dir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--flex") == 0)
+		{
+			opts->flex = true;
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+		{
+			opts->cache_dir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			char *end;
+			errno = 0;
+			opts->seed = strtoull(argv[++i], &end, 0);
+			if (*end != '\0' || end == argv[i] || errno != 0)
+			{
+				return false;
+			}
+			opts->seeded = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	// a single program is run without --batch, the programs of a batch are reported together and their trees are not printed
+	if ((opts->batch ? opts->input_count == 0 : opts->input_count > 1) || (opts->output_dir != NULL && !opts->batch))
+	{
+		return false;
+	}
+	if (opts->batch && (opts->dump_optimized || opts->print_ast >= 0 || opts->stats))
+	{
+		return false;
+	}
+
+	// the images are keyed by the sources held in memory, nothing is kept of a streamed program
+	if (opts->cache_dir != NULL && opts->flex)
+	{
+		return false;
+	}
+	if (opts->stream)
+	{
+		if (opts->dump_optimized || opts->print_ast >= 0 || opts->cache_dir != NULL)
+		{
+			return false;
+		}
+		opts->tree_walk = true;
+		opts->optimize = false;
+	}
+	return true;
+}
+
+/**
+ * Start timing a phase
+ *
+ * @param stats the statistics of the run
+ */
+static void phase_start(struct run_stats *stats)
+{
+	clock_gettime(CLOCK_MONOTONIC, &stats->phase_start);
+}
+
+/**
+ * Stop timing a phase
+ *
+ * @param stats the statistics of the run
+ * @param phase the phase that ends
+ */
+static void phase_end(struct run_stats *stats, enum phase phase)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stats->phase_ns[phase] += (end.tv_sec - stats->phase_start.tv_sec) * 1000000000LL + (end.tv_nsec - stats->phase_start.tv_nsec);
+}
+
+/**
+ * Report on stderr where the time went, what the evaluators did and the memory used
+ *
+ * @param stats the statistics of the run
+ */
+static void print_stats(const struct run_stats *stats)
+{
+	long long total_ns = 0;
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		total_ns += stats->phase_ns[phase];
+	}
+	fprintf(stderr, "time: %.3f ms\n", total_ns / 1e6);
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		fprintf(stderr, "  %-9s %10.3f ms %5.1f%%\n", phase_names[phase], stats->phase_ns[phase] / 1e6,
+				total_ns > 0 ? 100.0 * stats->phase_ns[phase] / total_ns : 0.0);
+	}
+	fprintf(stderr, "  of which %.3f ms writing the output\n", stats->write_ns / 1e6);
+
+	fprintf(stderr, "nodes evaluated:");
+	for (int kind = 0; kind < AST_KIND_COUNT; kind++)
+	{
+		if (stats->eval.kinds[kind] > 0)
+		{
+			fprintf(stderr, " %s %zu", kind_names[kind], stats->eval.kinds[kind]);
+		}
+	}
+	fprintf(stderr, "\ncommands run:");
+	for (int cmd = 0; cmd < AST_CMD_COUNT; cmd++)
+	{
+		if (stats->eval.cmds[cmd] > 0)
+		{
+			fprintf(stderr, " %s %zu", cmd_names[cmd], stats->eval.cmds[cmd]);
+		}
+	}
+	fprintf(stderr, "\nsymbol lookups: %zu\n", stats->eval.lookups);
+	fprintf(stderr, "random seed: %llu\n", (unsigned long long)stats->seed);
+	fprintf(stderr, "calls replayed: %zu, loop iterations generated: %zu\n", stats->eval.replayed, stats->eval.generated);
+	fprintf(stderr, "output: %zu primitives, %zu bytes\n", stats->primitives, stats->bytes);
+	if (stats->requested != stats->primitives)
+	{
+		fprintf(stderr, "simplification: %zu primitives reduced to %zu (%.1f%% removed)\n", stats->requested, stats->primitives,
+				100.0 * (stats->requested - stats->primitives) / stats->requested);
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	if (stats->parallel.sections > 0)
+	{
+		fprintf(stderr, "parallel: %zu sections on %zu threads\n", stats->parallel.sections, stats->parallel.jobs);
+	}
+	if (stats->stream.commands > 0)
+	{
+		fprintf(stderr, "stream: %zu top-level commands run while parsing, %zu kept for their procedures\n",
+				stats->stream.commands, stats->stream.kept);
+	}
+	if (stats->image != NULL)
+	{
+		fprintf(stderr, "image: %s %s\n", stats->image_loaded ? "loaded from" : stats->image_saved ? "saved to" : "cannot be saved to", stats->image);
+	}
+	if (stats->replayed || stats->recorded)
+	{
+		fprintf(stderr, "drawing: %s %s\n", stats->replayed ? "replayed from" : "recorded to", stats->drawing);
+	}
+	else if (stats->drawing != NULL && !stats->deterministic)
+	{
+		fprintf(stderr, "drawing: not recorded, the program draws random numbers\n");
+	}
+	else if (stats->drawing != NULL)
+	{
+		fprintf(stderr, "drawing: cannot be recorded to %s\n", stats->drawing);
+	}
+	fprintf(stderr, "memory: %zu bytes allocated for the tree in %zu blocks (%zu bytes reserved), %zu names, peak %ld KiB\n",
+			stats->tree_allocated, stats->tree_blocks, stats->tree_reserved, stats->names, usage.ru_maxrss);
+	if (stats->optimize)
+	{
+		fprintf(stderr, "optimizer: %zu expressions folded, %zu parentheses removed, %zu operations reduced, %zu commands rewritten\n",
+				stats->optimized.folded, stats->optimized.parentheses, stats->optimized.reduced, stats->optimized.commands);
+	}
+}
+
+/**
+ * Print the program run by the evaluators on stderr
+ *
+ * @param root the tree
+ */
+static void dump_optimized(const struct ast *root)
+{
+	struct output dump;
+	output_create(&dump, stderr, OUTPUT_TEXT, OUTPUT_PRECISION_DEFAULT);
+	ast_node_print(ast_program(root), &dump);
+	output_string(&dump, "\n");
+	output_destroy(&dump);
+}
+
+/**
+ * Print the parsed program on a file descriptor
+ *
+ * @param root the tree
+ * @param fd the file descriptor, stdout and stderr share the streams of the drawing and the messages
+ *
+ * @return true if the program was printed, false if the file descriptor cannot be written
+ */
+static bool print_ast(const struct ast *root, int fd)
+{
+	FILE *stream = fd == STDOUT_FILENO ? stdout : fd == STDERR_FILENO ? stderr : fdopen(fd, "w");
+	if (stream == NULL)
+	{
+		return false;
+	}
+	struct output print;
+	output_create(&print, stream, OUTPUT_TEXT, OUTPUT_PRECISION_DEFAULT);
+	ast_print(root, &print);
+	output_destroy(&print);
+	if (stream == stdout || stream == stderr)
+	{
+		return fflush(stream) == 0;
+	}
+	return fclose(stream) == 0;
+}
+
+/**
+ * Run the programs of a batch and report their times on stdout
+ *
+ * @param opts the options
+ *
+ * @return the exit status of the process
+ */
+static int run_batch(const struct options *opts)
+{
+	struct batch_settings settings = {
+		.format = opts->format,
+		.precision = opts->precision,
+		.simplify = opts->simplify,
+		.tree_walk = opts->tree_walk,
+		.optimize = opts->optimize,
+		.memoize = opts->memoize,
+		.rigid = opts->rigid,
+		.stream = opts->stream,
+		.flex = opts->flex,
+		.cache_dir = opts->cache_dir,
+		.seed = opts->seeded ? opts->seed : random_entropy(),
+	};
+	struct batch batch;
+	batch_create(&batch, opts->output_dir, opts->format);
+	for (size_t i = 0; i < opts->input_count; i++)
+	{
+		if (!batch_add(&batch, opts->inputs[i]))
+		{
+			fprintf(stderr, "Cannot read %s\n", opts->inputs[i]);
+			batch_destroy(&batch);
+			return 1;
+		}
+	}
+
+	int ret = batch_run(&batch, &settings, opts->jobs);
+	batch_report(&batch, stdout);
+	batch_destroy(&batch);
+	return ret;
+}
 
-int main()
+int main(int argc, char *argv[])
 {
-	srand(time(NULL));
+	struct options opts;
+	if (!parse_options(&opts, argc, argv))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (opts.cache_dir != NULL && !image_cache_create(opts.cache_dir))
+	{
+		fprintf(stderr, "Cannot create the cache directory %s\n", opts.cache_dir);
+		return 1;
+	}
+
+	if (opts.batch)
+	{
+		return run_batch(&opts);
+	}
+
+	struct run_stats stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.optimize = opts.optimize;
 
 	struct ast root;
-	int ret = yyparse(&root);
+	ast_create(&root);
+
+	struct output out;
+	output_create(&out, stdout, opts.format, opts.precision);
+	if (opts.simplify >= 0)
+	{
+		output_simplify(&out, opts.simplify);
+	}
+
+	struct context ctx;
+	context_create(&ctx, &root.symbols, &out);
+	ctx.memoize = opts.memoize;
+	ctx.rigid = opts.rigid;
+	stats.seed = opts.seeded ? opts.seed : random_entropy();
+	random_seed(&ctx.random, stats.seed);
+	if (opts.stats)
+	{
+		ctx.stats = &stats.eval;
+	}
+	if (opts.stream)
+	{
+		ast_stream_create(&stats.stream, &root, &ctx);
+	}
+
+	// a streamed program is run during this phase, a program given as argument is mapped in it
+	phase_start(&stats);
+	// the images are keyed by the source, so a program read from the standard input is held in memory too
+	struct scan scan;
+	FILE *input = stdin;
+	bool opened = true;
+	if (opts.input_count == 1 && opts.flex)
+	{
+		opened = (input = fopen(opts.inputs[0], "r")) != NULL;
+	}
+	else if (opts.input_count == 1 || opts.cache_dir != NULL)
+	{
+		opened = opts.input_count == 1 ? scan_map(&scan, opts.inputs[0]) : scan_load(&scan, STDIN_FILENO);
+		root.scan = &scan;
+	}
+	if (!opened)
+	{
+		fprintf(stderr, "Cannot read %s\n", opts.input_count == 1 ? opts.inputs[0] : "the standard input");
+		return 1;
+	}
+	if (opts.input_count == 1)
+	{
+		root.source = opts.inputs[0];
+	}
+
+	struct image_key key;
+	char image[PATH_MAX];
+	char drawing[PATH_MAX];
+	if (opts.cache_dir != NULL)
+	{
+		image_key(&key, scan.text, scan.end - scan.text);
+		// the drawing of a deterministic program is sent as it was recorded, without the tree
+		uint64_t variant = replay_variant(opts.format, opts.precision, opts.simplify, opts.rigid, opts.optimize);
+		if (opts.print_ast < 0 && !opts.dump_optimized && replay_path(drawing, sizeof(drawing), opts.cache_dir, &key, variant))
+		{
+			stats.drawing = drawing;
+			stats.replayed = replay_send(drawing, STDOUT_FILENO, &stats.bytes);
+		}
+		if (!stats.replayed && image_path(image, sizeof(image), opts.cache_dir, &key))
+		{
+			stats.image = image;
+			stats.image_loaded = image_load(&root, image, &key, opts.optimize);
+		}
+	}
+
+	int ret = 0;
+	if (!stats.image_loaded && !stats.replayed)
+	{
+		yyscan_t scanner;
+		yylex_init(&scanner);
+		yyset_in(input, scanner);
+		ret = yyparse(&root, scanner);
+		yylex_destroy(scanner);
+	}
+	if (root.scan != NULL)
+	{
+		scan_destroy(&scan);
+	}
+	if (input != stdin)
+	{
+		fclose(input);
+	}
 
 	if (ret != 0)
 	{
+		// the commands already run keep their drawing
+		if (opts.stream)
+		{
+			output_destroy(&out);
+		}
 		return ret;
 	}
+	phase_end(&stats, PHASE_PARSE);
 
-	yylex_destroy();
+	assert(opts.stream || stats.replayed || root.unit);
 
-	assert(root.unit);
+	phase_start(&stats);
+	if (opts.optimize && !stats.image_loaded && !stats.replayed)
+	{
+		ast_optimize(&root, &stats.optimized);
+	}
+	// saved once optimized, so that the next runs skip both phases
+	if (stats.image != NULL && !stats.image_loaded)
+	{
+		stats.image_saved = image_save(&root, image, &key);
+	}
+	phase_end(&stats, PHASE_OPTIMIZE);
+	if (opts.dump_optimized)
+	{
+		dump_optimized(&root);
+	}
 
-	struct context ctx;
-	context_create(&ctx);
+	// the drawing is copied as it is written, and kept once the program ran to its end
+	struct replay replay;
+	bool recording = false;
+	if (stats.drawing != NULL && !stats.replayed)
+	{
+		stats.deterministic = replay_deterministic(ast_program(&root));
+		recording = stats.deterministic && replay_record(&replay, opts.cache_dir, drawing);
+		if (recording)
+		{
+			output_copy(&out, replay.stream);
+		}
+	}
+
+	phase_start(&stats);
+	if (opts.stream)
+	{
+		ast_stream_finish(&stats.stream);
+	}
+	else if (!stats.replayed && !parallel_eval(&root, &ctx, opts.jobs, opts.tree_walk, &stats.parallel))
+	{
+		if (opts.tree_walk)
+		{
+			ast_eval(&root, &ctx);
+		}
+		else
+		{
+			vm_eval(&root, &ctx);
+		}
+	}
+	phase_end(&stats, PHASE_EVAL);
 
-	ast_eval(&root, &ctx);
-	ast_print(&root);
+	stats.tree_allocated = root.arena.allocated + root.names.allocated;
+	stats.tree_reserved = root.arena.reserved + root.names.reserved;
+	stats.tree_blocks = root.arena.block_count + root.names.block_count;
+	stats.names = root.symbols.count;
 
+	phase_start(&stats);
+	if (stats.replayed)
+	{
+		output_discard(&out);
+	}
+	else
+	{
+		output_destroy(&out);
+		stats.primitives = out.primitives;
+		stats.requested = out.requested;
+		stats.bytes = out.written;
+		stats.write_ns = out.write_ns;
+	}
+	fflush(stdout);
+	if (recording)
+	{
+		stats.recorded = replay_finish(&replay);
+	}
+	phase_end(&stats, PHASE_FLUSH);
+
+	phase_start(&stats);
+	if (opts.print_ast >= 0 && !print_ast(&root, opts.print_ast))
+	{
+		fprintf(stderr, "Cannot print the program on the file descriptor %d\n", opts.print_ast);
+	}
+	phase_end(&stats, PHASE_PRINT);
+
+	phase_start(&stats);
 	ast_destroy(&root);
 	context_destroy(&ctx);
+	phase_end(&stats, PHASE_CLEANUP);
+
+	if (opts.stats)
+	{
+		print_stats(&stats);
+	}
 
 	return ret;
-}
\ No newline at end of file
+}